@@ -0,0 +1,264 @@
+#include "K4AUtil.h"
+#include "K4ACalibrationTable.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+#if defined( _M_X64 ) || defined( __x86_64__ ) || defined( __SSE2__ )
+#define K4A_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Depth that is used to measure footprint of depth pixel in color image
+#define FOOTPRINT_REFERENCE_DEPTH 1000.0f
+
+namespace oni
+{
+    namespace driver
+    {
+        K4ACalibrationTable::K4ACalibrationTable( const k4a::calibration& calibration )
+            : valid( false )
+        {
+            K4ALogDebug( "K4ACalibrationTable::K4ACalibrationTable" );
+
+            const k4a_calibration_camera_t& color_camera = calibration.color_camera_calibration;
+            const k4a_calibration_intrinsic_parameters_t::_param& param = color_camera.intrinsics.parameters.param;
+
+            switch( color_camera.intrinsics.type ){
+                case K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY:
+                    is_rational = false;
+                    break;
+                case K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT:
+                    is_rational = true;
+                    break;
+                default:
+                    K4ATraceError( "unsupported lens distortion model %d", static_cast<int32_t>( color_camera.intrinsics.type ) );
+                    return;
+            }
+
+            cx   = param.cx;   cy   = param.cy;
+            fx   = param.fx;   fy   = param.fy;
+            k1   = param.k1;   k2   = param.k2;   k3 = param.k3;
+            k4   = param.k4;   k5   = param.k5;   k6 = param.k6;
+            codx = param.codx; cody = param.cody;
+            p1   = param.p1;   p2   = param.p2;
+            const float max_radius = ( color_camera.metric_radius > 0.0f ) ? color_camera.metric_radius : param.metric_radius;
+            max_radius_squared = ( max_radius > 0.0f ) ? max_radius * max_radius : 1e9f;
+
+            depth_width  = calibration.depth_camera_calibration.resolution_width;
+            depth_height = calibration.depth_camera_calibration.resolution_height;
+            color_width  = color_camera.resolution_width;
+            color_height = color_camera.resolution_height;
+
+            const k4a_calibration_extrinsics_t& extrinsics = calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+            const float* r = extrinsics.rotation;
+            translation[0] = extrinsics.translation[0];
+            translation[1] = extrinsics.translation[1];
+            translation[2] = extrinsics.translation[2];
+
+            const size_t size = static_cast<size_t>( depth_width ) * depth_height;
+            ray_x.assign( size, 0.0f );
+            ray_y.assign( size, 0.0f );
+            ray_z.assign( size, 0.0f );
+            depth_ray_x.assign( size, 0.0f );
+            depth_ray_y.assign( size, 0.0f );
+            footprint_x.assign( size, 0.0f );
+            footprint_y.assign( size, 0.0f );
+
+            // Undistortion of each pixel is iterative, rows are unprojected in parallel
+            concurrency::parallel_for( 0, depth_height, [&]( int32_t y ){
+                for( int32_t x = 0; x < depth_width; x++ ){
+                    k4a_float2_t point2d;
+                    point2d.xy.x = static_cast<float>( x );
+                    point2d.xy.y = static_cast<float>( y );
+                    k4a_float3_t ray;
+                    if( !calibration.convert_2d_to_3d( point2d, 1.0f, K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_DEPTH, &ray ) ){
+                        continue;
+                    }
+
+                    const size_t index = static_cast<size_t>( y ) * depth_width + x;
+                    depth_ray_x[index] = ray.xyz.x;
+                    depth_ray_y[index] = ray.xyz.y;
+                    ray_x[index] = r[0] * ray.xyz.x + r[1] * ray.xyz.y + r[2] * ray.xyz.z;
+                    ray_y[index] = r[3] * ray.xyz.x + r[4] * ray.xyz.y + r[5] * ray.xyz.z;
+                    ray_z[index] = r[6] * ray.xyz.x + r[7] * ray.xyz.y + r[8] * ray.xyz.z;
+                }
+            } );
+
+            // Footprint is half of the larger distance to neighbor pixels so that neighbors overlap and leave no holes
+            const std::vector<uint16_t> reference_depth( size, static_cast<uint16_t>( FOOTPRINT_REFERENCE_DEPTH ) );
+            std::vector<float> u( size ), v( size );
+            depth_to_color( &reference_depth[0], &u[0], &v[0], nullptr, 0, size );
+
+            concurrency::parallel_for( 0, depth_height, [&]( int32_t y ){
+                for( int32_t x = 0; x < depth_width; x++ ){
+                    const size_t index = static_cast<size_t>( y ) * depth_width + x;
+                    if( u[index] < 0.0f ){
+                        continue;
+                    }
+
+                    float extent_x = 0.0f;
+                    float extent_y = 0.0f;
+                    if( x > 0 && u[index - 1] >= 0.0f ){
+                        extent_x = std::max( extent_x, std::fabs( u[index] - u[index - 1] ) );
+                    }
+                    if( x < depth_width - 1 && u[index + 1] >= 0.0f ){
+                        extent_x = std::max( extent_x, std::fabs( u[index + 1] - u[index] ) );
+                    }
+                    if( y > 0 && u[index - depth_width] >= 0.0f ){
+                        extent_y = std::max( extent_y, std::fabs( v[index] - v[index - depth_width] ) );
+                    }
+                    if( y < depth_height - 1 && u[index + depth_width] >= 0.0f ){
+                        extent_y = std::max( extent_y, std::fabs( v[index + depth_width] - v[index] ) );
+                    }
+
+                    footprint_x[index] = 0.5f * extent_x;
+                    footprint_y[index] = 0.5f * extent_y;
+                }
+            } );
+
+            valid = true;
+        }
+
+        K4ACalibrationTable::~K4ACalibrationTable()
+        {
+            K4ALogDebug( "K4ACalibrationTable::~K4ACalibrationTable" );
+        }
+
+        void K4ACalibrationTable::depth_to_color( const uint16_t* depth, float* color_x, float* color_y, float* color_z, size_t begin, size_t end ) const
+        {
+            project( depth + begin, &ray_x[begin], &ray_y[begin], &ray_z[begin], color_x + begin, color_y + begin, color_z ? color_z + begin : nullptr, end - begin );
+        }
+
+        void K4ACalibrationTable::points_to_color( const int32_t* x, const int32_t* y, const uint16_t* depth, float* color_x, float* color_y, size_t count ) const
+        {
+            // Gather rays of points into small blocks so that projection runs on contiguous arrays
+            const size_t block_size = 256;
+            uint16_t block_depth[block_size];
+            float block_ray_x[block_size];
+            float block_ray_y[block_size];
+            float block_ray_z[block_size];
+
+            for( size_t begin = 0; begin < count; begin += block_size ){
+                const size_t size = std::min( block_size, count - begin );
+                for( size_t i = 0; i < size; i++ ){
+                    const int32_t px = x[begin + i];
+                    const int32_t py = y[begin + i];
+                    if( px < 0 || px >= depth_width || py < 0 || py >= depth_height ){
+                        block_depth[i] = 0;
+                        block_ray_x[i] = block_ray_y[i] = block_ray_z[i] = 0.0f;
+                        continue;
+                    }
+
+                    const size_t index = static_cast<size_t>( py ) * depth_width + px;
+                    block_depth[i] = depth[begin + i];
+                    block_ray_x[i] = ray_x[index];
+                    block_ray_y[i] = ray_y[index];
+                    block_ray_z[i] = ray_z[index];
+                }
+
+                project( block_depth, block_ray_x, block_ray_y, block_ray_z, color_x + begin, color_y + begin, nullptr, size );
+            }
+        }
+
+        void K4ACalibrationTable::project( const uint16_t* depth, const float* rx, const float* ry, const float* rz, float* color_x, float* color_y, float* color_z, size_t count ) const
+        {
+            const float tx = translation[0];
+            const float ty = translation[1];
+            const float tz = translation[2];
+            const float tangential = is_rational ? 1.0f : 2.0f;
+
+            // Local copies of parameters, outputs are float arrays that compiler can not prove to be distinct from members
+            const float cx = this->cx, cy = this->cy, fx = this->fx, fy = this->fy;
+            const float k1 = this->k1, k2 = this->k2, k3 = this->k3;
+            const float k4 = this->k4, k5 = this->k5, k6 = this->k6;
+            const float codx = this->codx, cody = this->cody, p1 = this->p1, p2 = this->p2;
+            const float max_radius_squared = this->max_radius_squared;
+
+            size_t i = 0;
+
+            #ifdef K4A_TABLE_SSE2
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one  = _mm_set1_ps( 1.0f );
+            const __m128 two  = _mm_set1_ps( 2.0f );
+            const __m128 invalid = _mm_set1_ps( -1.0f );
+            for( ; i + 4 <= count; i += 4 ){
+                const __m128i depth_u16 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( depth + i ) );
+                const __m128 d = _mm_cvtepi32_ps( _mm_unpacklo_epi16( depth_u16, _mm_setzero_si128() ) );
+                const __m128 ray_z_i = _mm_loadu_ps( rz + i );
+                const __m128 x = _mm_add_ps( _mm_mul_ps( d, _mm_loadu_ps( rx + i ) ), _mm_set1_ps( tx ) );
+                const __m128 y = _mm_add_ps( _mm_mul_ps( d, _mm_loadu_ps( ry + i ) ), _mm_set1_ps( ty ) );
+                const __m128 z = _mm_add_ps( _mm_mul_ps( d, ray_z_i ), _mm_set1_ps( tz ) );
+                const __m128 is_valid_depth = _mm_and_ps( _mm_and_ps( _mm_cmpgt_ps( d, zero ), _mm_cmpneq_ps( ray_z_i, zero ) ), _mm_cmpgt_ps( z, zero ) );
+
+                const __m128 inverse_z = _mm_div_ps( one, _mm_or_ps( _mm_and_ps( is_valid_depth, z ), _mm_andnot_ps( is_valid_depth, one ) ) );
+                const __m128 xp  = _mm_sub_ps( _mm_mul_ps( x, inverse_z ), _mm_set1_ps( codx ) );
+                const __m128 yp  = _mm_sub_ps( _mm_mul_ps( y, inverse_z ), _mm_set1_ps( cody ) );
+                const __m128 xp2 = _mm_mul_ps( xp, xp );
+                const __m128 yp2 = _mm_mul_ps( yp, yp );
+                const __m128 xyp = _mm_mul_ps( xp, yp );
+                const __m128 rs  = _mm_add_ps( xp2, yp2 );
+                const __m128 rss = _mm_mul_ps( rs, rs );
+                const __m128 rsc = _mm_mul_ps( rss, rs );
+                const __m128 a = _mm_add_ps( one, _mm_add_ps( _mm_mul_ps( _mm_set1_ps( k1 ), rs ), _mm_add_ps( _mm_mul_ps( _mm_set1_ps( k2 ), rss ), _mm_mul_ps( _mm_set1_ps( k3 ), rsc ) ) ) );
+                const __m128 b = _mm_add_ps( one, _mm_add_ps( _mm_mul_ps( _mm_set1_ps( k4 ), rs ), _mm_add_ps( _mm_mul_ps( _mm_set1_ps( k5 ), rss ), _mm_mul_ps( _mm_set1_ps( k6 ), rsc ) ) ) );
+                const __m128 is_nonzero_b = _mm_cmpneq_ps( b, zero );
+                const __m128 bi = _mm_div_ps( one, _mm_or_ps( _mm_and_ps( is_nonzero_b, b ), _mm_andnot_ps( is_nonzero_b, one ) ) );
+                const __m128 distortion = _mm_mul_ps( a, bi );
+                const __m128 tangential_xyp = _mm_mul_ps( _mm_set1_ps( tangential ), xyp );
+                const __m128 xp_d = _mm_add_ps( _mm_mul_ps( xp, distortion ), _mm_add_ps( _mm_mul_ps( _mm_add_ps( rs, _mm_mul_ps( two, xp2 ) ), _mm_set1_ps( p2 ) ), _mm_mul_ps( tangential_xyp, _mm_set1_ps( p1 ) ) ) );
+                const __m128 yp_d = _mm_add_ps( _mm_mul_ps( yp, distortion ), _mm_add_ps( _mm_mul_ps( _mm_add_ps( rs, _mm_mul_ps( two, yp2 ) ), _mm_set1_ps( p1 ) ), _mm_mul_ps( tangential_xyp, _mm_set1_ps( p2 ) ) ) );
+                const __m128 u = _mm_add_ps( _mm_mul_ps( _mm_add_ps( xp_d, _mm_set1_ps( codx ) ), _mm_set1_ps( fx ) ), _mm_set1_ps( cx ) );
+                const __m128 v = _mm_add_ps( _mm_mul_ps( _mm_add_ps( yp_d, _mm_set1_ps( cody ) ), _mm_set1_ps( fy ) ), _mm_set1_ps( cy ) );
+
+                const __m128 is_valid = _mm_and_ps( is_valid_depth, _mm_cmple_ps( rs, _mm_set1_ps( max_radius_squared ) ) );
+                _mm_storeu_ps( color_x + i, _mm_or_ps( _mm_and_ps( is_valid, u ), _mm_andnot_ps( is_valid, invalid ) ) );
+                _mm_storeu_ps( color_y + i, _mm_or_ps( _mm_and_ps( is_valid, v ), _mm_andnot_ps( is_valid, invalid ) ) );
+                if( color_z ){
+                    _mm_storeu_ps( color_z + i, z );
+                }
+            }
+            #endif
+
+            for( ; i < count; i++ ){
+                const float d = static_cast<float>( depth[i] );
+                const float x = d * rx[i] + tx;
+                const float y = d * ry[i] + ty;
+                const float z = d * rz[i] + tz;
+                const bool is_valid_depth = ( d > 0.0f ) & ( rz[i] != 0.0f ) & ( z > 0.0f );
+
+                const float inverse_z = 1.0f / ( is_valid_depth ? z : 1.0f );
+                const float xp  = x * inverse_z - codx;
+                const float yp  = y * inverse_z - cody;
+                const float xp2 = xp * xp;
+                const float yp2 = yp * yp;
+                const float xyp = xp * yp;
+                const float rs  = xp2 + yp2;
+                const float rss = rs * rs;
+                const float rsc = rss * rs;
+                const float a = 1.0f + k1 * rs + k2 * rss + k3 * rsc;
+                const float b = 1.0f + k4 * rs + k5 * rss + k6 * rsc;
+                const float bi = 1.0f / ( ( b != 0.0f ) ? b : 1.0f );
+                const float distortion = a * bi;
+                const float xp_d = xp * distortion + ( rs + 2.0f * xp2 ) * p2 + tangential * xyp * p1;
+                const float yp_d = yp * distortion + ( rs + 2.0f * yp2 ) * p1 + tangential * xyp * p2;
+                const float u = ( xp_d + codx ) * fx + cx;
+                const float v = ( yp_d + cody ) * fy + cy;
+
+                const bool is_valid = is_valid_depth & ( rs <= max_radius_squared );
+                color_x[i] = is_valid ? u : -1.0f;
+                color_y[i] = is_valid ? v : -1.0f;
+                if( color_z ){
+                    color_z[i] = z;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+
+namespace oni
+{
+    namespace driver
+    {
+        // Per-pixel tables derived once from k4a::calibration of the current mode.
+        // Depth pixel rays are stored already rotated into color camera, so mapping a depth pixel to color camera is
+        //   point = depth * ray + translation
+        // followed by projection with color camera intrinsics (K4A Brown-Conrady / Rational 6KT model).
+        class K4ACalibrationTable
+        {
+            public:
+                K4ACalibrationTable( const k4a::calibration& calibration );
+
+                ~K4ACalibrationTable();
+
+                inline bool is_valid() const { return valid; }
+
+                // Map depth pixels [begin, end) to color image coordinates and color camera depth.
+                // Invalid pixels (no depth, no ray or out of lens) get color_x < 0. Depth of color camera is not written when color_z is null.
+                void depth_to_color( const uint16_t* depth, float* color_x, float* color_y, float* color_z, size_t begin, size_t end ) const;
+
+                // Map list of depth pixels (x, y, depth) to color image coordinates.
+                // Invalid points (outside of depth image, no depth, no ray or out of lens) get color_x < 0.
+                void points_to_color( const int32_t* x, const int32_t* y, const uint16_t* depth, float* color_x, float* color_y, size_t count ) const;
+
+            protected:
+                K4ACalibrationTable( const K4ACalibrationTable& );
+                void operator=( const K4ACalibrationTable& );
+
+                void project( const uint16_t* depth, const float* rx, const float* ry, const float* rz, float* color_x, float* color_y, float* color_z, size_t count ) const;
+
+            public:
+                int32_t depth_width;
+                int32_t depth_height;
+                int32_t color_width;
+                int32_t color_height;
+
+                // Rays of depth pixels in color camera orientation at 1 mm depth, zero for pixels without ray
+                std::vector<float> ray_x;
+                std::vector<float> ray_y;
+                std::vector<float> ray_z;
+
+                // Rays of depth pixels in depth camera at 1 mm depth, zero for pixels without ray
+                std::vector<float> depth_ray_x;
+                std::vector<float> depth_ray_y;
+
+                // Half extent of depth pixel footprint in color image
+                std::vector<float> footprint_x;
+                std::vector<float> footprint_y;
+
+                float translation[3];
+
+            protected:
+                bool valid;
+                bool is_rational;
+                float cx, cy, fx, fy;
+                float k1, k2, k3, k4, k5, k6;
+                float codx, cody, p1, p2;
+                float max_radius_squared;
+        };
+    }
+}
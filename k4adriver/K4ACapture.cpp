@@ -1,18 +1,39 @@
 #include "K4AUtil.h"
 #include "K4ACapture.h"
 
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+
 namespace oni
 {
     namespace driver
     {
         K4ACapture::K4ACapture( class K4ADevice* k4a_device )
-            : k4a_device( k4a_device )
+            : k4a_device( k4a_device ),
+              is_register_depth( false ),
+              is_decode_color( false ),
+              color_width( 0 ),
+              color_height( 0 ),
+              color_consumers( 0 ),
+              depth_consumers( 0 ),
+              infrared_consumers( 0 ),
+              next_sync_group( 0 ),
+              capture_index( 0 ),
+              is_align_time_stamp( false ),
+              has_clock_offset( false ),
+              clock_offset( 0 ),
+              window_index( 0 ),
+              frame_period( 0 ),
+              captures( 0 ),
+              capture_timeouts( 0 ),
+              dropped_sync( 0 ),
+              dropped_registration( 0 ),
+              depth_filter( FILTER_POOL_SIZE )
         {
             K4ALogDebug( "K4ACapture::K4ACapture" );
 
-            device            = k4a_device->getDevice();
-            registration_mode = k4a_device->getRegistrationMode();
-            transformation    = k4a::transformation( k4a_device->getCalibration() );
+            source = k4a_device->getSource();
 
             start();
         }
@@ -28,11 +49,110 @@ namespace oni
         {
             K4ATraceFunc( "" );
 
+            // Calibration and registration depend on current mode of device
+            const k4a::calibration calibration = k4a_device->getCalibration();
+            registration_mode = k4a_device->getRegistrationMode();
+            transformations.clear();
+            registrations.clear();
+
+            const k4a_device_configuration_t& configuration = k4a_device->getDeviceConfiguration();
+            const std::chrono::microseconds subordinate_delay( ( configuration.wired_sync_mode == K4A_WIRED_SYNC_MODE_SUBORDINATE ) ? configuration.subordinate_delay_off_master_usec : 0 );
+            is_align_time_stamp = ( configuration.wired_sync_mode != K4A_WIRED_SYNC_MODE_STANDALONE );
+            color_delay         = subordinate_delay;
+            depth_delay         = subordinate_delay + std::chrono::microseconds( configuration.depth_delay_off_color_usec );
+            has_clock_offset    = false;
+            window_index        = 0;
+            window_offsets.clear();
+
+            // Gaps are counted from first capture after start, time stamps restart after mode change or seek
+            frame_period = std::chrono::microseconds( 1000000 / std::max( 1, k4a_device->getFps() ) );
+            capture_counters.reset_time_stamp();
+            color_counters.reset_time_stamp();
+            depth_counters.reset_time_stamp();
+            infrared_counters.reset_time_stamp();
+            depth_filter.reset();
+
+            {
+                std::lock_guard<std::mutex> lock( region_mutex );
+                color_width  = calibration.color_camera_calibration.resolution_width;
+                color_height = calibration.color_camera_calibration.resolution_height;
+                update_registration_region();
+            }
+
+            // Registration and decoding run on worker threads so that get_capture is never blocked by them
+            const int32_t width  = calibration.color_camera_calibration.resolution_width;
+            const int32_t height = calibration.color_camera_calibration.resolution_height;
+            size_t workers = 0;
+
+            is_register_depth = ( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR );
+            if( is_register_depth ){
+                workers = std::min<size_t>( MAX_REGISTRATION_WORKERS, std::max<size_t>( 1, std::thread::hardware_concurrency() / 2 ) );
+            }
+
+            // MJPG of RGB888 stream is decoded by pipeline, decoding of 2160p and 3072p takes longer than frame period on one core
+            is_decode_color = ( configuration.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG && k4a_device->getColorPixelFormat() == ONI_PIXEL_FORMAT_RGB888 );
+            decoders.clear();
+            if( is_decode_color ){
+                workers = std::max<size_t>( workers, std::min<size_t>( MAX_DECODE_WORKERS, std::max<size_t>( 2, std::thread::hardware_concurrency() ) - 1 ) );
+                for( size_t worker = 0; worker < workers; worker++ ){
+                    decoders.push_back( std::unique_ptr<K4AJpegDecoder>( new K4AJpegDecoder() ) );
+                }
+            }
+
+            // Registered depth and decoded color are held by running workers, queues of streams and conversion of streams.
+            // Pending jobs hold no image yet, so pools keep only that many buffers and grow on demand.
+            if( is_register_depth ){
+                depth_pool.configure( K4A_IMAGE_FORMAT_DEPTH16, width, height, width * static_cast<int32_t>( sizeof( uint16_t ) ), workers + POOL_SPARE );
+            }
+            else{
+                depth_pool.release();
+            }
+            if( is_decode_color ){
+                color_pool.configure( K4A_IMAGE_FORMAT_CUSTOM, width, height, width * 3, workers + POOL_SPARE );
+            }
+            else{
+                color_pool.release();
+            }
+
+            if( is_register_depth ){
+                for( size_t worker = 0; worker < workers; worker++ ){
+                    transformations.push_back( k4a::transformation( calibration ) );
+                }
+
+                if( k4a_device->getRegistrationEngine() == K4A_REGISTRATION_ENGINE_TABLE ){
+                    const std::shared_ptr<const K4ACalibrationTable> table = k4a_device->getCalibrationTable();
+                    if( table->is_valid() ){
+                        for( size_t worker = 0; worker < workers; worker++ ){
+                            registrations.push_back( std::unique_ptr<K4ARegistration>( new K4ARegistration( table ) ) );
+                        }
+                    }
+                    else{
+                        K4ATraceError( "calibration table is not available, fall back to k4a::transformation" );
+                    }
+                }
+            }
+
+            // Depth filter runs as first stage of pipeline, one worker is enough when nothing else is processed
+            if( workers > 0 || depth_filter.is_enabled() ){
+                start_pipeline( std::max<size_t>( workers, 1 ) );
+            }
+
             is_capture = true;
 
             thread = std::thread( &K4ACapture::capture_thread, this );
         }
 
+        void K4ACapture::start_pipeline( size_t workers )
+        {
+            K4ATraceFunc( "workers = %d", static_cast<int32_t>( workers ) );
+
+            pipeline.start( workers, MAX_REGISTRATION_PENDING,
+                            [this]( K4AFrameSet& frame_set ){ filter_depth( frame_set ); },
+                            [this]( K4AFrameSet& frame_set, size_t worker ){ process_frame_set( frame_set, worker ); },
+                            [this]( K4AFrameSet& frame_set ){ push_frame_set( frame_set ); },
+                            [this]( const K4AFrameSet& frame_set ){ count_dropped_registration( frame_set ); } );
+        }
+
         void K4ACapture::stop()
         {
             K4ATraceFunc( "" );
@@ -42,21 +162,293 @@ namespace oni
             if( thread.joinable() ){
                 thread.join();
             }
+
+            pipeline.stop();
+
+            // Frames of previous mode must not reach streams after mode was changed
+            std::lock_guard<std::mutex> lock( queue_mutex );
+            for( std::vector<K4AFrameQueue*>* queues : { &color_queues, &depth_queues, &infrared_queues } ){
+                for( K4AFrameQueue* queue : *queues ){
+                    queue->clear();
+                }
+            }
+        }
+
+        bool K4ACapture::seek( int32_t frame_index )
+        {
+            K4ATraceFunc( "frame index = %d", frame_index );
+
+            // Frames before seek must not reach streams, and frame index restarts from sought frame
+            stop();
+            const bool result = source->seek( frame_index );
+            if( result ){
+                capture_index = frame_index;
+            }
+            start();
+
+            return result;
+        }
+
+        void K4ACapture::subscribe( OniSensorType sensor_type, K4AFrameQueue* queue )
+        {
+            K4ATraceFunc( "sensor type = %d", sensor_type );
+
+            std::vector<K4AFrameQueue*>* queues = get_queues( sensor_type );
+            if( !queues ){
+                return;
+            }
+
+            queue->open();
+
+            if( sensor_type == ONI_SENSOR_DEPTH ){
+                OniCropping cropping = {};
+                set_cropping( sensor_type, queue, cropping, false );
+            }
+
+            std::lock_guard<std::mutex> lock( queue_mutex );
+            queues->push_back( queue );
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    color_consumers++;
+                    break;
+                case ONI_SENSOR_DEPTH:
+                    depth_consumers++;
+                    break;
+                default:
+                    infrared_consumers++;
+                    break;
+            }
+        }
+
+        void K4ACapture::unsubscribe( OniSensorType sensor_type, K4AFrameQueue* queue )
+        {
+            K4ATraceFunc( "sensor type = %d", sensor_type );
+
+            std::vector<K4AFrameQueue*>* queues = get_queues( sensor_type );
+            if( !queues ){
+                return;
+            }
+
+            // Close before lock, so that waiting consumer wakes up and capture thread that waits for space of this queue gives up
+            queue->close();
+
+            if( sensor_type == ONI_SENSOR_DEPTH ){
+                std::lock_guard<std::mutex> lock( region_mutex );
+                depth_croppings.erase( queue );
+                update_registration_region();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock( queue_mutex );
+                const std::vector<K4AFrameQueue*>::iterator it = std::find( queues->begin(), queues->end(), queue );
+                if( it == queues->end() ){
+                    return;
+                }
+                queues->erase( it );
+                switch( sensor_type ){
+                    case ONI_SENSOR_COLOR:
+                        color_consumers--;
+                        break;
+                    case ONI_SENSOR_DEPTH:
+                        depth_consumers--;
+                        break;
+                    default:
+                        infrared_consumers--;
+                        break;
+                }
+            }
+
+            // Push that chose this queue before it was removed finishes before queue may be reconfigured or destroyed, it gives up on closed queue at once
+            std::lock_guard<std::mutex> push_lock( push_mutex );
+        }
+
+        std::vector<K4AFrameQueue*>* K4ACapture::get_queues( OniSensorType sensor_type )
+        {
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    return &color_queues;
+                case ONI_SENSOR_DEPTH:
+                    return &depth_queues;
+                case ONI_SENSOR_IR:
+                    return &infrared_queues;
+                default:
+                    return nullptr;
+            }
+        }
+
+        int32_t K4ACapture::enable_frame_sync( const OniSensorType* sensor_types, K4AFrameQueue* const* queues, int count )
+        {
+            K4ATraceFunc( "count = %d", count );
+
+            SyncGroup group;
+            for( int i = 0; i < count; i++ ){
+                if( !get_queues( sensor_types[i] ) ){
+                    continue;
+                }
+                group.sensor_types.push_back( sensor_types[i] );
+                group.queues.push_back( queues[i] );
+            }
+
+            std::lock_guard<std::mutex> lock( queue_mutex );
+            const int32_t id = next_sync_group++;
+            sync_groups[id] = group;
+            return id;
+        }
+
+        void K4ACapture::disable_frame_sync( int32_t group )
+        {
+            K4ATraceFunc( "group = %d", group );
+
+            std::lock_guard<std::mutex> lock( queue_mutex );
+            sync_groups.erase( group );
+        }
+
+        void K4ACapture::remove_from_frame_sync( K4AFrameQueue* queue )
+        {
+            std::lock_guard<std::mutex> lock( queue_mutex );
+            for( std::pair<const int32_t, SyncGroup>& it : sync_groups ){
+                SyncGroup& group = it.second;
+                for( size_t index = group.queues.size(); index > 0; index-- ){
+                    if( group.queues[index - 1] == queue ){
+                        group.queues.erase( group.queues.begin() + ( index - 1 ) );
+                        group.sensor_types.erase( group.sensor_types.begin() + ( index - 1 ) );
+                    }
+                }
+            }
+        }
+
+        bool K4ACapture::start_recording( const std::string& path )
+        {
+            return recorder.start( path );
+        }
+
+        void K4ACapture::stop_recording()
+        {
+            recorder.stop();
+        }
+
+        bool K4ACapture::is_recording() const
+        {
+            return recorder.is_recording();
+        }
+
+        K4ARecordStatistics K4ACapture::get_record_statistics() const
+        {
+            return recorder.get_statistics();
+        }
+
+        K4ACaptureStatistics K4ACapture::get_capture_statistics() const
+        {
+            K4ACaptureStatistics statistics;
+            statistics.captures             = captures;
+            statistics.capture_timeouts     = capture_timeouts;
+            statistics.dropped_sync         = dropped_sync;
+            statistics.dropped_registration = dropped_registration;
+            statistics.time_stamp_gaps      = capture_counters.get_statistics().time_stamp_gaps;
+            return statistics;
+        }
+
+        K4AStreamStatistics K4ACapture::get_stream_statistics( OniSensorType sensor_type ) const
+        {
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    return color_counters.get_statistics();
+                case ONI_SENSOR_DEPTH:
+                    return depth_counters.get_statistics();
+                case ONI_SENSOR_IR:
+                    return infrared_counters.get_statistics();
+                default:
+                    return K4AStreamStatistics();
+            }
         }
 
-        bool K4ACapture::get_color_image( std::pair<std::vector<uint8_t>, std::chrono::microseconds>& color_data )
+        K4AStreamCounters& K4ACapture::get_counters( OniSensorType sensor_type )
         {
-            return color_queue.try_pop( color_data );
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    return color_counters;
+                case ONI_SENSOR_DEPTH:
+                    return depth_counters;
+                default:
+                    return infrared_counters;
+            }
         }
 
-        bool K4ACapture::get_depth_image( std::pair<std::vector<uint16_t>, std::chrono::microseconds>& depth_data )
+        void K4ACapture::set_cropping( OniSensorType sensor_type, K4AFrameQueue* queue, const OniCropping& cropping, bool is_mirror )
         {
-            return depth_queue.try_pop( depth_data );
+            if( sensor_type != ONI_SENSOR_DEPTH ){
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock( region_mutex );
+            DepthCropping& depth_cropping = depth_croppings[queue];
+            depth_cropping.cropping  = cropping;
+            depth_cropping.is_mirror = is_mirror;
+            update_registration_region();
         }
 
-        bool K4ACapture::get_infrared_image( std::pair<std::vector<uint16_t>, std::chrono::microseconds>& infrared_data )
+        void K4ACapture::update_registration_region()
         {
-            return infrared_queue.try_pop( infrared_data );
+            // Union of regions of depth streams, streams without cropping or with cropping out of color image need whole image
+            OniCropping region = {};
+            for( const std::pair<K4AFrameQueue* const, DepthCropping>& it : depth_croppings ){
+                OniCropping cropping = it.second.cropping;
+                if( it.second.is_mirror ){
+                    cropping.originX = color_width - cropping.originX - cropping.width;
+                }
+                const bool is_inside = cropping.enabled && cropping.originX >= 0 && cropping.originX + cropping.width <= color_width && cropping.originY + cropping.height <= color_height;
+                if( !is_inside ){
+                    region.enabled = FALSE;
+                    break;
+                }
+                if( !region.enabled ){
+                    region = cropping;
+                    continue;
+                }
+                const int32_t end_x = std::max( region.originX + region.width, cropping.originX + cropping.width );
+                const int32_t end_y = std::max( region.originY + region.height, cropping.originY + cropping.height );
+                region.originX = std::min( region.originX, cropping.originX );
+                region.originY = std::min( region.originY, cropping.originY );
+                region.width   = end_x - region.originX;
+                region.height  = end_y - region.originY;
+            }
+
+            if( !region.enabled ){
+                region.originX = 0;
+                region.originY = 0;
+                region.width   = color_width;
+                region.height  = color_height;
+            }
+            registration_region = region;
+        }
+
+        bool K4ACapture::set_depth_filter( const K4ADepthFilterSettings& settings )
+        {
+            return depth_filter.configure( settings );
+        }
+
+        K4ADepthFilterSettings K4ACapture::get_depth_filter() const
+        {
+            return depth_filter.get_settings();
+        }
+
+        void K4ACapture::filter_depth( K4AFrameSet& frame_set )
+        {
+            // Filtered depth replaces reference of frame set, raw image is still referenced by recorder
+            if( frame_set.depth.image && depth_filter.is_enabled() ){
+                frame_set.depth.image = depth_filter.process( frame_set.depth.image );
+            }
+        }
+
+        K4APoolStatistics K4ACapture::get_pool_statistics() const
+        {
+            const K4APoolStatistics depth_statistics = depth_pool.get_statistics();
+            const K4APoolStatistics color_statistics = color_pool.get_statistics();
+
+            K4APoolStatistics statistics;
+            statistics.hits   = depth_statistics.hits   + color_statistics.hits;
+            statistics.misses = depth_statistics.misses + color_statistics.misses;
+            return statistics;
         }
 
         void K4ACapture::capture_thread()
@@ -64,77 +456,378 @@ namespace oni
             K4ATraceFunc( "" );
 
             while( is_capture ){
-                bool result = device->get_capture( &capture, std::chrono::milliseconds( K4A_WAIT_INFINITE ) );
+                // Wait with timeout so that stop is not blocked by source that has no more captures
+                bool result = source->get_capture( &capture, std::chrono::milliseconds( CAPTURE_WAIT_TIME ) );
                 if( !result ){
+                    capture_timeouts++;
                     capture.reset();
                     continue;
                 }
 
+                const int32_t index = capture_index++;
+                const std::chrono::steady_clock::time_point capture_time = std::chrono::steady_clock::now();
+                captures++;
+
                 {
-                    if( color_queue.unsafe_size() > MAX_QUEUE_SIZE ){
-                        std::pair<std::vector<uint8_t>, std::chrono::microseconds> drop_data;
-                        color_queue.try_pop( drop_data );
-                        std::pair<std::vector<uint8_t>, std::chrono::microseconds>().swap( drop_data );
+                    k4a::image reference = capture.get_depth_image();
+                    if( !reference ){
+                        reference = capture.get_ir_image();
+                    }
+                    if( !reference ){
+                        reference = capture.get_color_image();
                     }
+                    if( reference ){
+                        capture_counters.count_time_stamp( reference.get_device_timestamp(), frame_period );
+                    }
+                }
 
-                    std::vector<uint8_t> buffer;
-                    std::chrono::microseconds time_stamp;
-                    k4a::image image = capture.get_color_image();
-                    if( image ){
-                        buffer.assign( image.get_buffer(), image.get_buffer() + image.get_size() );
-                        time_stamp = image.get_device_timestamp();
+                K4AFrameSet frame_set;
+
+                if( color_consumers > 0 ){
+                    frame_set.color.image = capture.get_color_image();
+                    if( frame_set.color.image ){
+                        frame_set.color.time_stamp = frame_set.color.image.get_device_timestamp();
+                        frame_set.color.index      = index;
+                        frame_set.color.stage_times.capture = capture_time;
+                        count_frame( color_counters, frame_set.color.image );
                     }
-                    image.reset();
+                }
 
-                    color_queue.push( std::make_pair( buffer, time_stamp ) );
+                if( depth_consumers > 0 ){
+                    frame_set.depth.image = capture.get_depth_image();
+                    if( frame_set.depth.image ){
+                        frame_set.depth.time_stamp = frame_set.depth.image.get_device_timestamp();
+                        frame_set.depth.index      = index;
+                        frame_set.depth.stage_times.capture = capture_time;
+                        count_frame( depth_counters, frame_set.depth.image );
+                    }
                 }
 
-                {
-                    if( depth_queue.unsafe_size() > MAX_QUEUE_SIZE ){
-                        std::pair<std::vector<uint16_t>, std::chrono::microseconds> drop_data;
-                        depth_queue.try_pop( drop_data );
-                        std::pair<std::vector<uint16_t>, std::chrono::microseconds>().swap( drop_data );
-                    }
-
-                    std::vector<uint16_t> buffer;
-                    std::chrono::microseconds time_stamp;
-                    k4a::image image = capture.get_depth_image();
-                    if( image ){
-                        if( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ){
-                            k4a::image transformed_image = transformation.depth_image_to_color_camera( image );
-                            buffer.assign( reinterpret_cast<uint16_t*>( transformed_image.get_buffer() ), reinterpret_cast<uint16_t*>( transformed_image.get_buffer() + transformed_image.get_size() ) );
-                            transformed_image.reset();
-                        }
-                        else{
-                            buffer.assign( reinterpret_cast<uint16_t*>( image.get_buffer() ), reinterpret_cast<uint16_t*>( image.get_buffer() + image.get_size() ) );
-                        }
-                        time_stamp = image.get_device_timestamp();
+                if( infrared_consumers > 0 ){
+                    frame_set.infrared.image = capture.get_ir_image();
+                    if( frame_set.infrared.image ){
+                        frame_set.infrared.time_stamp = frame_set.infrared.image.get_device_timestamp();
+                        frame_set.infrared.index      = index;
+                        frame_set.infrared.stage_times.capture = capture_time;
+                        count_frame( infrared_counters, frame_set.infrared.image );
                     }
-                    image.reset();
+                }
 
-                    depth_queue.push( std::make_pair( buffer, time_stamp ) );
+                // Devices in wired sync are triggered by one pulse of master, so their frames get same time stamp on host clock
+                if( is_align_time_stamp ){
+                    const k4a::image& reference = frame_set.depth.image    ? frame_set.depth.image
+                                                : frame_set.infrared.image ? frame_set.infrared.image
+                                                                           : frame_set.color.image;
+                    if( reference ){
+                        update_clock_offset( reference );
+                    }
+                    frame_set.color.time_stamp    += clock_offset - color_delay;
+                    frame_set.depth.time_stamp    += clock_offset - depth_delay;
+                    frame_set.infrared.time_stamp += clock_offset - depth_delay;
                 }
 
-                {
-                    if( infrared_queue.unsafe_size() > MAX_QUEUE_SIZE ){
-                        std::pair<std::vector<uint16_t>, std::chrono::microseconds> drop_data;
-                        infrared_queue.try_pop( drop_data );
-                        std::pair<std::vector<uint16_t>, std::chrono::microseconds>().swap( drop_data );
+                capture.reset();
+
+                // Recorder only takes references of images, frames are recorded as delivered by device before registration
+                if( recorder.is_recording() ){
+                    recorder.push( frame_set );
+                }
+
+                // Members of incomplete sync groups are dropped here, before any frame is filtered, registered or decoded
+                drop_incomplete_sync( frame_set );
+
+                // Filter enabled while capturing needs pipeline, only capture thread starts it until capture is stopped
+                if( !pipeline.is_running() && depth_filter.is_enabled() ){
+                    start_pipeline( 1 );
+                }
+
+                // Every frame set goes through pipeline while it runs, also those without work, so that no frame overtakes registered depth or decoded color
+                if( pipeline.is_running() ){
+                    pipeline.submit( std::move( frame_set ) );
+                    continue;
+                }
+
+                push_frame_set( frame_set );
+            }
+        }
+
+        void K4ACapture::update_clock_offset( const k4a::image& image )
+        {
+            // System time stamp includes latency of USB transfer, so the smallest difference over sliding window is closest to offset of device clock.
+            // Offset follows minimum of window with exponential smoothing, so drift of device clock is followed without steps of time stamps.
+            const std::chrono::microseconds offset = std::chrono::duration_cast<std::chrono::microseconds>( image.get_system_timestamp() ) - image.get_device_timestamp();
+            while( !window_offsets.empty() && window_offsets.back().second >= offset ){
+                window_offsets.pop_back();
+            }
+            window_offsets.emplace_back( window_index, offset );
+            while( window_offsets.front().first <= window_index - CLOCK_OFFSET_WINDOW ){
+                window_offsets.pop_front();
+            }
+            window_index++;
+
+            const std::chrono::microseconds window_offset = window_offsets.front().second;
+            if( !has_clock_offset || window_offset < clock_offset ){
+                // Smaller offset means less latency was measured, it is taken immediately
+                clock_offset     = window_offset;
+                has_clock_offset = true;
+            }
+            else{
+                clock_offset += ( window_offset - clock_offset ) / CLOCK_OFFSET_SMOOTHING;
+            }
+        }
+
+        void K4ACapture::process_frame_set( K4AFrameSet& frame_set, size_t worker )
+        {
+            // Frame sets without depth to register or color to decode pass through, they only keep their place in order
+            if( frame_set.color.image && is_decode_color ){
+                decode_color( frame_set.color, worker );
+            }
+
+            if( frame_set.depth.image && is_register_depth ){
+                register_depth( frame_set, worker );
+            }
+        }
+
+        void K4ACapture::decode_color( K4AFrame& frame, size_t worker )
+        {
+            // Frames that were not captured as MJPG are passed through
+            if( frame.image.get_format() != K4A_IMAGE_FORMAT_COLOR_MJPG ){
+                return;
+            }
+
+            // Decoded color is RGB888 in image of custom format, corrupt frame is dropped like SDK does
+            k4a::image decoded_image = color_pool.acquire();
+            if( !decoded_image || !decoders[worker]->decode( frame.image, decoded_image.get_buffer(), decoded_image.get_stride_bytes() ) ){
+                K4ATraceError( "failed to decode color frame %d", frame.index );
+                frame.image.reset();
+                return;
+            }
+
+            frame.image = std::move( decoded_image );
+        }
+
+        void K4ACapture::register_depth( K4AFrameSet& frame_set, size_t worker )
+        {
+            try{
+                k4a::image transformed_image = depth_pool.acquire();
+
+                bool is_registered = false;
+                if( transformed_image && !registrations.empty() ){
+                    OniCropping region;
+                    {
+                        std::lock_guard<std::mutex> lock( region_mutex );
+                        region = registration_region;
                     }
+                    is_registered = registrations[worker]->depth_image_to_color_camera( frame_set.depth.image, transformed_image, region.originX, region.originY, region.originX + region.width, region.originY + region.height );
+                    if( is_registered ){
+                        // Streams whose cropping changed while frame was registered check it against this region
+                        frame_set.depth.filled_region = region;
+                    }
+                }
 
-                    std::vector<uint16_t> buffer;
-                    std::chrono::microseconds time_stamp;
-                    k4a::image image = capture.get_ir_image();
-                    if( image ){
-                        buffer.assign( reinterpret_cast<uint16_t*>( image.get_buffer() ), reinterpret_cast<uint16_t*>( image.get_buffer() + image.get_size() ) );
-                        time_stamp = image.get_device_timestamp();
+                if( !is_registered ){
+                    const k4a::transformation& transformation = transformations[worker];
+                    if( transformed_image ){
+                        transformation.depth_image_to_color_camera( frame_set.depth.image, &transformed_image );
                     }
-                    image.reset();
+                    else{
+                        transformed_image = transformation.depth_image_to_color_camera( frame_set.depth.image );
+                    }
+                }
+
+                frame_set.depth.image = std::move( transformed_image );
+            }
+            catch( const k4a::error& error ){
+                K4ATraceError( "k4a::transformation::depth_image_to_color_camera failed - %s", error.what() );
+                frame_set.depth.image.reset();
+            }
+        }
 
-                    infrared_queue.push( std::make_pair( buffer, time_stamp ) );
+        void K4ACapture::count_frame( K4AStreamCounters& counters, const k4a::image& image )
+        {
+            counters.count_captured();
+            counters.count_time_stamp( image.get_device_timestamp(), frame_period );
+        }
+
+        void K4ACapture::count_dropped_registration( const K4AFrameSet& frame_set )
+        {
+            dropped_registration++;
+
+            if( frame_set.color.image ){
+                color_counters.count_dropped_registration();
+            }
+            if( frame_set.depth.image ){
+                depth_counters.count_dropped_registration();
+            }
+            if( frame_set.infrared.image ){
+                infrared_counters.count_dropped_registration();
+            }
+        }
+
+        bool K4ACapture::get_sync_members( const SyncGroup& group, K4AFrameSet& frame_set, std::vector<K4AFrameQueue*>& members, std::vector<OniSensorType>& member_sensors )
+        {
+            // Only streams that are started are members, stopped stream does not hold back the others
+            bool is_complete = true;
+            for( size_t index = 0; index < group.queues.size(); index++ ){
+                std::vector<K4AFrameQueue*>* queues = get_queues( group.sensor_types[index] );
+                if( std::find( queues->begin(), queues->end(), group.queues[index] ) == queues->end() ){
+                    continue;
+                }
+                members.push_back( group.queues[index] );
+                member_sensors.push_back( group.sensor_types[index] );
+                if( !get_frame( frame_set, group.sensor_types[index] ).image ){
+                    is_complete = false;
                 }
+            }
+            return is_complete;
+        }
 
-                capture.reset();
+        void K4ACapture::drop_incomplete_sync( K4AFrameSet& frame_set )
+        {
+            std::lock_guard<std::mutex> lock( queue_mutex );
+
+            std::set<K4AFrameQueue*> excluded_queues;
+            std::set<OniSensorType> dropped_sensors;
+            for( const std::pair<const int32_t, SyncGroup>& it : sync_groups ){
+                std::vector<K4AFrameQueue*> members;
+                std::vector<OniSensorType> member_sensors;
+                if( get_sync_members( it.second, frame_set, members, member_sensors ) ){
+                    continue;
+                }
+
+                excluded_queues.insert( members.begin(), members.end() );
+                for( OniSensorType sensor_type : member_sensors ){
+                    if( get_frame( frame_set, sensor_type ).image ){
+                        dropped_sensors.insert( sensor_type );
+                    }
+                }
+            }
+
+            if( excluded_queues.empty() ){
+                return;
+            }
+
+            dropped_sync++;
+            for( OniSensorType sensor_type : dropped_sensors ){
+                get_counters( sensor_type ).count_dropped_sync();
+
+                // Frame that no other stream takes is released, streams outside of group still get it from push_frame_set
+                std::vector<K4AFrameQueue*>* queues = get_queues( sensor_type );
+                if( std::all_of( queues->begin(), queues->end(), [&]( K4AFrameQueue* queue ){ return excluded_queues.count( queue ) > 0; } ) ){
+                    get_frame( frame_set, sensor_type ).image.reset();
+                }
+            }
+        }
+
+        void K4ACapture::push_frame_set( K4AFrameSet& frame_set )
+        {
+            // Queues are chosen under queue_mutex and pushed under push_mutex only, so that blocking queue that waits for its consumer
+            // does not hold back capture thread, subscriptions and sync groups
+            std::lock_guard<std::mutex> push_lock( push_mutex );
+
+            std::vector<K4AFrameQueue*> color_targets;
+            std::vector<K4AFrameQueue*> depth_targets;
+            std::vector<K4AFrameQueue*> infrared_targets;
+            std::map<K4AFrameQueue*, std::chrono::microseconds> sync_time_stamps;
+            {
+                std::lock_guard<std::mutex> lock( queue_mutex );
+
+                // Each group is checked on its own, members of incomplete group skip this frame set and other queues still get their frames.
+                // Incomplete groups were counted by drop_incomplete_sync, group only loses a member here when its frame failed to be registered or decoded.
+                std::set<K4AFrameQueue*> excluded_queues;
+                for( const std::pair<const int32_t, SyncGroup>& it : sync_groups ){
+                    std::vector<K4AFrameQueue*> members;
+                    std::vector<OniSensorType> member_sensors;
+                    const bool is_complete = get_sync_members( it.second, frame_set, members, member_sensors );
+
+                    if( members.empty() ){
+                        continue;
+                    }
+
+                    if( !is_complete ){
+                        excluded_queues.insert( members.begin(), members.end() );
+                        continue;
+                    }
+
+                    // Members of sync group are raised with one time stamp, depth and infrared are exposed together and color is aligned to them
+                    const std::chrono::microseconds time_stamp = frame_set.depth.image    ? frame_set.depth.time_stamp
+                                                               : frame_set.infrared.image ? frame_set.infrared.time_stamp
+                                                                                          : frame_set.color.time_stamp;
+                    for( K4AFrameQueue* queue : members ){
+                        sync_time_stamps[queue] = time_stamp;
+                    }
+
+                    drop_together( members );
+                }
+
+                const auto is_excluded = [&]( K4AFrameQueue* queue ){ return excluded_queues.count( queue ) > 0; };
+                std::remove_copy_if( color_queues.begin(), color_queues.end(), std::back_inserter( color_targets ), is_excluded );
+                std::remove_copy_if( depth_queues.begin(), depth_queues.end(), std::back_inserter( depth_targets ), is_excluded );
+                std::remove_copy_if( infrared_queues.begin(), infrared_queues.end(), std::back_inserter( infrared_targets ), is_excluded );
+            }
+
+            if( frame_set.color.image ){
+                push_frame( color_targets, frame_set.color, sync_time_stamps );
+            }
+
+            if( frame_set.depth.image ){
+                push_frame( depth_targets, frame_set.depth, sync_time_stamps );
+            }
+
+            if( frame_set.infrared.image ){
+                push_frame( infrared_targets, frame_set.infrared, sync_time_stamps );
+            }
+        }
+
+        void K4ACapture::push_frame( const std::vector<K4AFrameQueue*>& queues, K4AFrame& frame, const std::map<K4AFrameQueue*, std::chrono::microseconds>& sync_time_stamps )
+        {
+            for( size_t index = 0; index < queues.size(); index++ ){
+                // Streams of same sensor share image by reference, last one takes frame
+                K4AFrame queued_frame = ( index + 1 < queues.size() ) ? frame : std::move( frame );
+
+                std::map<K4AFrameQueue*, std::chrono::microseconds>::const_iterator time_stamp = sync_time_stamps.find( queues[index] );
+                if( time_stamp != sync_time_stamps.end() ){
+                    queued_frame.time_stamp = time_stamp->second;
+                }
+
+                // Blocking queue waits for its consumer, but never beyond stop of capture or close of queue
+                while( !queues[index]->push( queued_frame, std::chrono::milliseconds( CAPTURE_WAIT_TIME ) ) ){
+                    if( !is_capture || !queues[index]->is_opened() ){
+                        break;
+                    }
+                }
+            }
+        }
+
+        void K4ACapture::drop_together( const std::vector<K4AFrameQueue*>& queues )
+        {
+            // Full queue of member would drop its oldest frame on push, so frames of same capture are dropped from other members as well.
+            // Blocking queues wait for their consumer instead and never drop.
+            for( K4AFrameQueue* queue : queues ){
+                if( queue->get_policy() == K4A_QUEUE_POLICY_BLOCK ){
+                    continue;
+                }
+
+                int32_t index;
+                while( queue->is_full() && queue->drop_oldest( &index ) ){
+                    for( K4AFrameQueue* other : queues ){
+                        if( other != queue && other->get_policy() != K4A_QUEUE_POLICY_BLOCK ){
+                            other->drop_frame( index );
+                        }
+                    }
+                }
+            }
+        }
+
+        K4AFrame& K4ACapture::get_frame( K4AFrameSet& frame_set, OniSensorType sensor_type )
+        {
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    return frame_set.color;
+                case ONI_SENSOR_DEPTH:
+                    return frame_set.depth;
+                default:
+                    return frame_set.infrared;
             }
         }
     }
@@ -2,23 +2,36 @@
 
 #include <thread>
 #include <atomic>
-#include <utility>
-#include <vector>
 #include <chrono>
-
-#if __has_include(<concurrent_queue.h>)
-#include <concurrent_queue.h>
-#else
-#include <tbb/concurrent_queue.h>
-namespace concurrency = tbb;
-#endif
+#include <vector>
+#include <map>
+#include <deque>
+#include <set>
+#include <memory>
+#include <mutex>
 
 #include <k4a/k4a.hpp>
 #include <Driver/OniDriverAPI.h>
 
 #include "K4AStream.h"
-
-#define MAX_QUEUE_SIZE 3
+#include "K4AImagePool.h"
+#include "K4AFrameQueue.h"
+#include "K4APipeline.h"
+#include "K4ARegistration.h"
+#include "K4ADepthFilter.h"
+#include "K4AJpegDecoder.h"
+#include "K4ASource.h"
+#include "K4ARecorder.h"
+#include "K4AStatistics.h"
+
+#define MAX_REGISTRATION_WORKERS 4
+#define MAX_REGISTRATION_PENDING 8
+#define MAX_DECODE_WORKERS 6
+#define POOL_SPARE ( DEFAULT_QUEUE_SIZE + 1 )
+#define FILTER_POOL_SIZE ( MAX_REGISTRATION_PENDING + POOL_SPARE + 1 )
+#define CLOCK_OFFSET_WINDOW 300
+#define CLOCK_OFFSET_SMOOTHING 16
+#define CAPTURE_WAIT_TIME 100
 
 namespace oni
 {
@@ -31,33 +44,168 @@ namespace oni
 
                 ~K4ACapture();
 
-                bool get_color_image( std::pair<std::vector<uint8_t>, std::chrono::microseconds>& color_data );
+                K4APoolStatistics get_pool_statistics() const;
+
+                // Filter of depth is shared by all depth streams, it runs in capture thread before registration
+                bool set_depth_filter( const K4ADepthFilterSettings& settings );
+
+                K4ADepthFilterSettings get_depth_filter() const;
+
+                // Each stream owns its queue, so that streams of same sensor get every frame with their own policy
+                void subscribe( OniSensorType sensor_type, K4AFrameQueue* queue );
+
+                void unsubscribe( OniSensorType sensor_type, K4AFrameQueue* queue );
+
+                // Registration fills only union of cropping regions of subscribed depth streams, other sensors are ignored.
+                // Cropping is in mirrored image when is_mirror is true.
+                void set_cropping( OniSensorType sensor_type, K4AFrameQueue* queue, const OniCropping& cropping, bool is_mirror );
 
-                bool get_depth_image( std::pair<std::vector<uint16_t>, std::chrono::microseconds>& depth_data );
+                // Frames of capture reach queues of sync group only when every started member has a frame in the capture.
+                // Returns id of group that is passed to disable_frame_sync.
+                int32_t enable_frame_sync( const OniSensorType* sensor_types, K4AFrameQueue* const* queues, int count );
 
-                bool get_infrared_image( std::pair<std::vector<uint16_t>, std::chrono::microseconds>& infrared_data );
+                void disable_frame_sync( int32_t group );
+
+                // Queue is removed from sync groups before it is destroyed
+                void remove_from_frame_sync( K4AFrameQueue* queue );
 
                 void start();
 
                 void stop();
 
+                bool seek( int32_t frame_index );
+
+                bool start_recording( const std::string& path );
+
+                void stop_recording();
+
+                bool is_recording() const;
+
+                K4ARecordStatistics get_record_statistics() const;
+
+                K4ACaptureStatistics get_capture_statistics() const;
+
+                // Counters of sensor, fields of queue are filled by stream
+                K4AStreamStatistics get_stream_statistics( OniSensorType sensor_type ) const;
+
+                K4AStreamCounters& get_counters( OniSensorType sensor_type );
+
             protected:
                 K4ACapture( const K4ACapture& );
                 void operator=( const K4ACapture& );
 
+                struct SyncGroup
+                {
+                    std::vector<OniSensorType> sensor_types;
+                    std::vector<K4AFrameQueue*> queues;
+                };
+
             private:
                 void capture_thread();
 
+                void update_clock_offset( const k4a::image& image );
+
+                void start_pipeline( size_t workers );
+
+                // Temporal filter depends on previous depth, so it runs as ordered stage of pipeline
+                void filter_depth( K4AFrameSet& frame_set );
+
+                void process_frame_set( K4AFrameSet& frame_set, size_t worker );
+
+                void register_depth( K4AFrameSet& frame_set, size_t worker );
+
+                void decode_color( K4AFrame& frame, size_t worker );
+
+                void update_registration_region();
+
+                void drop_incomplete_sync( K4AFrameSet& frame_set );
+
+                void push_frame_set( K4AFrameSet& frame_set );
+
+                void push_frame( const std::vector<K4AFrameQueue*>& queues, K4AFrame& frame, const std::map<K4AFrameQueue*, std::chrono::microseconds>& sync_time_stamps );
+
+                void drop_together( const std::vector<K4AFrameQueue*>& queues );
+
+                K4AFrame& get_frame( K4AFrameSet& frame_set, OniSensorType sensor_type );
+
+                // Returns whether every member of group has frame in frame set, queue_mutex must be held
+                bool get_sync_members( const SyncGroup& group, K4AFrameSet& frame_set, std::vector<K4AFrameQueue*>& members, std::vector<OniSensorType>& member_sensors );
+
+                std::vector<K4AFrameQueue*>* get_queues( OniSensorType sensor_type );
+
+                void count_frame( K4AStreamCounters& counters, const k4a::image& image );
+
+                void count_dropped_registration( const K4AFrameSet& frame_set );
+
             protected:
                 class K4ADevice* k4a_device;
-                k4a::device* device;
+                K4ASource* source;
                 k4a::capture capture;
-                k4a::transformation transformation;
+                std::vector<k4a::transformation> transformations;
+                std::vector<std::unique_ptr<K4ARegistration>> registrations;
                 OniImageRegistrationMode registration_mode;
-
-                concurrency::concurrent_queue<std::pair<std::vector<uint8_t>, std::chrono::microseconds>> color_queue;
-                concurrency::concurrent_queue<std::pair<std::vector<uint16_t>, std::chrono::microseconds>> depth_queue;
-                concurrency::concurrent_queue<std::pair<std::vector<uint16_t>, std::chrono::microseconds>> infrared_queue;
+                std::vector<std::unique_ptr<K4AJpegDecoder>> decoders;
+                bool is_register_depth;
+                bool is_decode_color;
+
+                // Registration of depth and decoding of color share one pipeline, so that frames of all sensors stay in order
+                K4APipeline pipeline;
+
+                K4AImagePool depth_pool;
+                K4AImagePool color_pool;
+
+                K4ARecorder recorder;
+
+                // Lists of queues are guarded by queue_mutex, frames are pushed under push_mutex, so that unsubscribed queue is never touched again
+                std::mutex queue_mutex;
+                std::mutex push_mutex;
+                std::vector<K4AFrameQueue*> color_queues;
+                std::vector<K4AFrameQueue*> depth_queues;
+                std::vector<K4AFrameQueue*> infrared_queues;
+
+                // Region of color image that is registered, frames of registered depth are zero outside of it
+                std::mutex region_mutex;
+                struct DepthCropping
+                {
+                    OniCropping cropping;
+                    bool is_mirror;
+                };
+                std::map<K4AFrameQueue*, DepthCropping> depth_croppings;
+                OniCropping registration_region;
+                int32_t color_width;
+                int32_t color_height;
+
+                std::atomic_int color_consumers;
+                std::atomic_int depth_consumers;
+                std::atomic_int infrared_consumers;
+
+                // Sync groups are guarded by queue_mutex, groups are checked when frame set is captured and again when it is pushed
+                std::map<int32_t, SyncGroup> sync_groups;
+                int32_t next_sync_group;
+                int32_t capture_index;
+
+                // Time stamps of devices in wired sync are converted to host clock, and delays of sync are removed
+                bool is_align_time_stamp;
+                std::chrono::microseconds color_delay;
+                std::chrono::microseconds depth_delay;
+                bool has_clock_offset;
+                std::chrono::microseconds clock_offset;
+                // Minimum of offsets over last CLOCK_OFFSET_WINDOW captures, offsets are increasing from front and front is the minimum
+                std::deque<std::pair<int64_t, std::chrono::microseconds>> window_offsets;
+                int64_t window_index;
+
+                // Statistics, captures without frame of stream are counted as gaps of capture, not of stream
+                std::chrono::microseconds frame_period;
+                std::atomic<uint64_t> captures;
+                std::atomic<uint64_t> capture_timeouts;
+                std::atomic<uint64_t> dropped_sync;
+                std::atomic<uint64_t> dropped_registration;
+                K4AStreamCounters capture_counters;
+                K4AStreamCounters color_counters;
+                K4AStreamCounters depth_counters;
+                K4AStreamCounters infrared_counters;
+
+                K4ADepthFilter depth_filter;
 
                 std::thread thread;
                 std::atomic_bool is_capture;
@@ -0,0 +1,430 @@
+#include "K4AConvert.h"
+
+#include <cstring>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define K4A_CONVERT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined( K4A_CONVERT_X86 ) && !defined( _MSC_VER )
+#define K4A_TARGET( instruction_set ) __attribute__(( target( instruction_set ) ))
+#else
+#define K4A_TARGET( instruction_set )
+#endif
+
+// Minimum number of pixels to split the conversion across cores
+#define PARALLEL_MIN_PIXELS ( 1280 * 720 )
+// Number of pixels that are converted by one parallel task
+#define PARALLEL_BLOCK_PIXELS ( 256 * 1024 )
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            typedef void ( *convert_bgra_to_rgb_kernel )( const uint8_t* source, uint8_t* destination, size_t pixels );
+            typedef void ( *copy_mirror_kernel )( const uint16_t* source, uint16_t* destination, size_t pixels );
+            typedef void ( *copy_rgb888_mirror_kernel )( const uint8_t* source, uint8_t* destination, size_t pixels );
+
+            void convert_bgra_to_rgb_scalar( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                for( size_t i = 0; i < pixels; i++ ){
+                    destination[i * 3 + 0] = source[i * 4 + 2];
+                    destination[i * 3 + 1] = source[i * 4 + 1];
+                    destination[i * 3 + 2] = source[i * 4 + 0];
+                }
+            }
+
+            // Mirror kernels read source row from its end, so that pixel i of destination is pixel ( pixels - 1 - i ) of source
+            void convert_bgra_to_rgb_mirror_scalar( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                for( size_t i = 0; i < pixels; i++ ){
+                    const uint8_t* pixel = source + ( pixels - 1 - i ) * 4;
+                    destination[i * 3 + 0] = pixel[2];
+                    destination[i * 3 + 1] = pixel[1];
+                    destination[i * 3 + 2] = pixel[0];
+                }
+            }
+
+            void copy_mirror_scalar( const uint16_t* source, uint16_t* destination, size_t pixels )
+            {
+                for( size_t i = 0; i < pixels; i++ ){
+                    destination[i] = source[pixels - 1 - i];
+                }
+            }
+
+            void copy_rgb888_mirror_scalar( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                for( size_t i = 0; i < pixels; i++ ){
+                    const uint8_t* pixel = source + ( pixels - 1 - i ) * 3;
+                    destination[i * 3 + 0] = pixel[0];
+                    destination[i * 3 + 1] = pixel[1];
+                    destination[i * 3 + 2] = pixel[2];
+                }
+            }
+
+            #ifdef K4A_CONVERT_X86
+            K4A_TARGET( "ssse3" )
+            void convert_bgra_to_rgb_ssse3( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                // Pack 4 pixels to 12 bytes in lower part of register, then merge 16 pixels into 3 registers
+                const __m128i shuffle = _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+
+                size_t i = 0;
+                for( ; i + 16 <= pixels; i += 16 ){
+                    const __m128i a = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( source + i * 4 +  0 ) ), shuffle );
+                    const __m128i b = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( source + i * 4 + 16 ) ), shuffle );
+                    const __m128i c = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( source + i * 4 + 32 ) ), shuffle );
+                    const __m128i d = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( source + i * 4 + 48 ) ), shuffle );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 +  0 ), _mm_or_si128( a, _mm_slli_si128( b, 12 ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 16 ), _mm_or_si128( _mm_srli_si128( b, 4 ), _mm_slli_si128( c, 8 ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 32 ), _mm_or_si128( _mm_srli_si128( c, 8 ), _mm_slli_si128( d, 4 ) ) );
+                }
+
+                convert_bgra_to_rgb_scalar( source + i * 4, destination + i * 3, pixels - i );
+            }
+
+            K4A_TARGET( "avx2" )
+            void convert_bgra_to_rgb_avx2( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                // Pack 4 pixels to 12 bytes in each lane, then gather both lanes into lower 24 bytes
+                const __m256i shuffle = _mm256_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+                const __m256i permute = _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 );
+
+                size_t i = 0;
+                for( ; i + 8 <= pixels; i += 8 ){
+                    __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( source + i * 4 ) );
+                    v = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( v, shuffle ), permute );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 ), _mm256_castsi256_si128( v ) );
+                    _mm_storel_epi64( reinterpret_cast<__m128i*>( destination + i * 3 + 16 ), _mm256_extracti128_si256( v, 1 ) );
+                }
+
+                convert_bgra_to_rgb_scalar( source + i * 4, destination + i * 3, pixels - i );
+            }
+
+            K4A_TARGET( "ssse3" )
+            void convert_bgra_to_rgb_mirror_ssse3( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                // Same as forward kernel, but 4 pixels are also reversed by shuffle and registers are taken from the end
+                const __m128i shuffle = _mm_setr_epi8( 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0, -1, -1, -1, -1 );
+
+                size_t i = 0;
+                for( ; i + 16 <= pixels; i += 16 ){
+                    const uint8_t* block = source + ( pixels - i - 16 ) * 4;
+                    const __m128i a = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 48 ) ), shuffle );
+                    const __m128i b = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 32 ) ), shuffle );
+                    const __m128i c = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 16 ) ), shuffle );
+                    const __m128i d = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( block +  0 ) ), shuffle );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 +  0 ), _mm_or_si128( a, _mm_slli_si128( b, 12 ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 16 ), _mm_or_si128( _mm_srli_si128( b, 4 ), _mm_slli_si128( c, 8 ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 32 ), _mm_or_si128( _mm_srli_si128( c, 8 ), _mm_slli_si128( d, 4 ) ) );
+                }
+
+                convert_bgra_to_rgb_mirror_scalar( source, destination + i * 3, pixels - i );
+            }
+
+            K4A_TARGET( "avx2" )
+            void convert_bgra_to_rgb_mirror_avx2( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                // Reverse 8 pixels across lanes first, then pack them as forward kernel
+                const __m256i shuffle = _mm256_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+                const __m256i reverse = _mm256_setr_epi32( 7, 6, 5, 4, 3, 2, 1, 0 );
+                const __m256i permute = _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 );
+
+                size_t i = 0;
+                for( ; i + 8 <= pixels; i += 8 ){
+                    __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( source + ( pixels - i - 8 ) * 4 ) );
+                    v = _mm256_permutevar8x32_epi32( v, reverse );
+                    v = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( v, shuffle ), permute );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 ), _mm256_castsi256_si128( v ) );
+                    _mm_storel_epi64( reinterpret_cast<__m128i*>( destination + i * 3 + 16 ), _mm256_extracti128_si256( v, 1 ) );
+                }
+
+                convert_bgra_to_rgb_mirror_scalar( source, destination + i * 3, pixels - i );
+            }
+
+            K4A_TARGET( "ssse3" )
+            void copy_mirror_ssse3( const uint16_t* source, uint16_t* destination, size_t pixels )
+            {
+                const __m128i shuffle = _mm_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+                size_t i = 0;
+                for( ; i + 8 <= pixels; i += 8 ){
+                    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( source + pixels - i - 8 ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i ), _mm_shuffle_epi8( v, shuffle ) );
+                }
+
+                copy_mirror_scalar( source, destination + i, pixels - i );
+            }
+
+            K4A_TARGET( "avx2" )
+            void copy_mirror_avx2( const uint16_t* source, uint16_t* destination, size_t pixels )
+            {
+                // Reverse pixels in each lane, then swap lanes
+                const __m256i shuffle = _mm256_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+                                                          14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+                size_t i = 0;
+                for( ; i + 16 <= pixels; i += 16 ){
+                    const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( source + pixels - i - 16 ) );
+                    _mm256_storeu_si256( reinterpret_cast<__m256i*>( destination + i ), _mm256_permute4x64_epi64( _mm256_shuffle_epi8( v, shuffle ), _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+                }
+
+                copy_mirror_scalar( source, destination + i, pixels - i );
+            }
+
+            K4A_TARGET( "ssse3" )
+            void copy_rgb888_mirror_ssse3( const uint8_t* source, uint8_t* destination, size_t pixels )
+            {
+                // 16 pixels fill 3 registers, each register of destination gathers reversed pixels from two or three registers of source
+                const __m128i shuffle_0c = _mm_setr_epi8( 13, 14, 15, 10, 11, 12,  7,  8,  9,  4,  5,  6,  1,  2,  3, -1 );
+                const __m128i shuffle_0b = _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14 );
+                const __m128i shuffle_1c = _mm_setr_epi8( -1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+                const __m128i shuffle_1b = _mm_setr_epi8( 15, -1, 11, 12, 13,  8,  9, 10,  5,  6,  7,  2,  3,  4, -1,  0 );
+                const __m128i shuffle_1a = _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1 );
+                const __m128i shuffle_2b = _mm_setr_epi8(  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+                const __m128i shuffle_2a = _mm_setr_epi8( -1, 12, 13, 14,  9, 10, 11,  6,  7,  8,  3,  4,  5,  0,  1,  2 );
+
+                size_t i = 0;
+                for( ; i + 16 <= pixels; i += 16 ){
+                    const uint8_t* block = source + ( pixels - i - 16 ) * 3;
+                    const __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block +  0 ) );
+                    const __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 16 ) );
+                    const __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 32 ) );
+
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 +  0 ), _mm_or_si128( _mm_shuffle_epi8( c, shuffle_0c ), _mm_shuffle_epi8( b, shuffle_0b ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 16 ), _mm_or_si128( _mm_or_si128( _mm_shuffle_epi8( c, shuffle_1c ), _mm_shuffle_epi8( b, shuffle_1b ) ), _mm_shuffle_epi8( a, shuffle_1a ) ) );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( destination + i * 3 + 32 ), _mm_or_si128( _mm_shuffle_epi8( b, shuffle_2b ), _mm_shuffle_epi8( a, shuffle_2a ) ) );
+                }
+
+                copy_rgb888_mirror_scalar( source, destination + i * 3, pixels - i );
+            }
+
+            bool is_supported_ssse3()
+            {
+                #ifdef _MSC_VER
+                int32_t info[4];
+                __cpuid( info, 1 );
+                return ( info[2] & ( 1 << 9 ) ) != 0;
+                #else
+                return __builtin_cpu_supports( "ssse3" );
+                #endif
+            }
+
+            bool is_supported_avx2()
+            {
+                #ifdef _MSC_VER
+                int32_t info[4];
+                __cpuid( info, 0 );
+                if( info[0] < 7 ){
+                    return false;
+                }
+                __cpuid( info, 1 );
+                const bool os_avx = ( info[2] & ( 1 << 27 ) ) && ( info[2] & ( 1 << 28 ) ) && ( ( _xgetbv( 0 ) & 0x6 ) == 0x6 );
+                __cpuidex( info, 7, 0 );
+                return os_avx && ( info[1] & ( 1 << 5 ) ) != 0;
+                #else
+                return __builtin_cpu_supports( "avx2" );
+                #endif
+            }
+            #endif
+
+            convert_bgra_to_rgb_kernel select_convert_bgra_to_rgb()
+            {
+                #ifdef K4A_CONVERT_X86
+                if( is_supported_avx2() ){
+                    return convert_bgra_to_rgb_avx2;
+                }
+                if( is_supported_ssse3() ){
+                    return convert_bgra_to_rgb_ssse3;
+                }
+                #endif
+                return convert_bgra_to_rgb_scalar;
+            }
+
+            convert_bgra_to_rgb_kernel select_convert_bgra_to_rgb_mirror()
+            {
+                #ifdef K4A_CONVERT_X86
+                if( is_supported_avx2() ){
+                    return convert_bgra_to_rgb_mirror_avx2;
+                }
+                if( is_supported_ssse3() ){
+                    return convert_bgra_to_rgb_mirror_ssse3;
+                }
+                #endif
+                return convert_bgra_to_rgb_mirror_scalar;
+            }
+
+            copy_mirror_kernel select_copy_mirror()
+            {
+                #ifdef K4A_CONVERT_X86
+                if( is_supported_avx2() ){
+                    return copy_mirror_avx2;
+                }
+                if( is_supported_ssse3() ){
+                    return copy_mirror_ssse3;
+                }
+                #endif
+                return copy_mirror_scalar;
+            }
+
+            copy_rgb888_mirror_kernel select_copy_rgb888_mirror()
+            {
+                // 3 byte pixels cross lanes of AVX2, so SSSE3 kernel is used on AVX2 as well
+                #ifdef K4A_CONVERT_X86
+                if( is_supported_ssse3() ){
+                    return copy_rgb888_mirror_ssse3;
+                }
+                #endif
+                return copy_rgb888_mirror_scalar;
+            }
+        }
+
+        void convert_bgra_to_rgb( const uint8_t* source, uint8_t* destination, size_t pixels )
+        {
+            static const convert_bgra_to_rgb_kernel kernel = select_convert_bgra_to_rgb();
+            kernel( source, destination, pixels );
+        }
+
+        void convert_bgra_to_rgb_mirror( const uint8_t* source, uint8_t* destination, size_t pixels )
+        {
+            static const convert_bgra_to_rgb_kernel kernel = select_convert_bgra_to_rgb_mirror();
+            kernel( source, destination, pixels );
+        }
+
+        void convert_bgra_to_rgb( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror )
+        {
+            // Mirrored rows are converted one by one, because continuous rows would be reversed as a whole
+            const size_t pixels = static_cast<size_t>( width ) * height;
+            const bool is_continuous = !is_mirror && ( source_stride == width * 4 ) && ( destination_stride == width * 3 );
+            const convert_bgra_to_rgb_kernel row_kernel = is_mirror ? convert_bgra_to_rgb_mirror : static_cast<convert_bgra_to_rgb_kernel>( convert_bgra_to_rgb );
+
+            if( pixels < PARALLEL_MIN_PIXELS ){
+                if( is_continuous ){
+                    convert_bgra_to_rgb( source, destination, pixels );
+                    return;
+                }
+                for( int32_t y = 0; y < height; y++ ){
+                    row_kernel( source + y * source_stride, destination + y * destination_stride, width );
+                }
+                return;
+            }
+
+            const int32_t block_rows = ( width < PARALLEL_BLOCK_PIXELS ) ? ( PARALLEL_BLOCK_PIXELS / width ) : 1;
+            const int32_t blocks     = ( height + block_rows - 1 ) / block_rows;
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                const int32_t begin = block * block_rows;
+                const int32_t end   = ( begin + block_rows < height ) ? begin + block_rows : height;
+                if( is_continuous ){
+                    convert_bgra_to_rgb( source + begin * source_stride, destination + begin * destination_stride, static_cast<size_t>( width ) * ( end - begin ) );
+                    return;
+                }
+                for( int32_t y = begin; y < end; y++ ){
+                    row_kernel( source + y * source_stride, destination + y * destination_stride, width );
+                }
+            } );
+        }
+
+        void copy_mirror( const uint16_t* source, uint16_t* destination, size_t pixels )
+        {
+            static const copy_mirror_kernel kernel = select_copy_mirror();
+            kernel( source, destination, pixels );
+        }
+
+        void copy_gray16( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror )
+        {
+            const size_t row_size = static_cast<size_t>( width ) * sizeof( uint16_t );
+            if( !is_mirror ){
+                if( source_stride == destination_stride && static_cast<size_t>( source_stride ) == row_size ){
+                    memcpy( destination, source, row_size * height );
+                    return;
+                }
+                for( int32_t y = 0; y < height; y++ ){
+                    memcpy( destination + y * destination_stride, source + y * source_stride, row_size );
+                }
+                return;
+            }
+
+            const auto copy_rows = [&]( int32_t begin, int32_t end ){
+                for( int32_t y = begin; y < end; y++ ){
+                    copy_mirror( reinterpret_cast<const uint16_t*>( source + y * source_stride ), reinterpret_cast<uint16_t*>( destination + y * destination_stride ), width );
+                }
+            };
+
+            const size_t pixels = static_cast<size_t>( width ) * height;
+            if( pixels < PARALLEL_MIN_PIXELS ){
+                copy_rows( 0, height );
+                return;
+            }
+
+            const int32_t block_rows = ( width < PARALLEL_BLOCK_PIXELS ) ? ( PARALLEL_BLOCK_PIXELS / width ) : 1;
+            const int32_t blocks     = ( height + block_rows - 1 ) / block_rows;
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                const int32_t begin = block * block_rows;
+                const int32_t end   = ( begin + block_rows < height ) ? begin + block_rows : height;
+                copy_rows( begin, end );
+            } );
+        }
+
+        void copy_rgb888_mirror( const uint8_t* source, uint8_t* destination, size_t pixels )
+        {
+            static const copy_rgb888_mirror_kernel kernel = select_copy_rgb888_mirror();
+            kernel( source, destination, pixels );
+        }
+
+        void copy_rgb888( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror )
+        {
+            const size_t row_size = static_cast<size_t>( width ) * 3;
+            if( !is_mirror && source_stride == destination_stride && static_cast<size_t>( source_stride ) == row_size ){
+                memcpy( destination, source, row_size * height );
+                return;
+            }
+
+            // Rows of decoded color are large, so they are copied in parallel like conversion of BGRA32
+            const auto copy_rows = [&]( int32_t begin, int32_t end ){
+                for( int32_t y = begin; y < end; y++ ){
+                    const uint8_t* input = source + static_cast<size_t>( y ) * source_stride;
+                    uint8_t* output = destination + static_cast<size_t>( y ) * destination_stride;
+                    if( is_mirror ){
+                        copy_rgb888_mirror( input, output, width );
+                    }
+                    else{
+                        memcpy( output, input, row_size );
+                    }
+                }
+            };
+
+            const size_t pixels = static_cast<size_t>( width ) * height;
+            if( pixels < PARALLEL_MIN_PIXELS ){
+                copy_rows( 0, height );
+                return;
+            }
+
+            const int32_t block_rows = ( width < PARALLEL_BLOCK_PIXELS ) ? ( PARALLEL_BLOCK_PIXELS / width ) : 1;
+            const int32_t blocks     = ( height + block_rows - 1 ) / block_rows;
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                const int32_t begin = block * block_rows;
+                const int32_t end   = ( begin + block_rows < height ) ? begin + block_rows : height;
+                copy_rows( begin, end );
+            } );
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace oni
+{
+    namespace driver
+    {
+        // Convert BGRA32 pixels to RGB888 pixels.
+        // The kernel is selected at runtime from the instruction sets supported by CPU (AVX2, SSSE3 or scalar).
+        void convert_bgra_to_rgb( const uint8_t* source, uint8_t* destination, size_t pixels );
+
+        // Convert BGRA32 pixels to RGB888 pixels in reversed order, for mirrored rows.
+        void convert_bgra_to_rgb_mirror( const uint8_t* source, uint8_t* destination, size_t pixels );
+
+        // Convert BGRA32 image to RGB888 image, rows are mirrored in the same pass when is_mirror is true.
+        // Large images are split into row blocks and converted in parallel.
+        void convert_bgra_to_rgb( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror );
+
+        // Copy 16 bit pixels in reversed order, for mirrored rows of depth and infrared.
+        void copy_mirror( const uint16_t* source, uint16_t* destination, size_t pixels );
+
+        // Copy 16 bit image of depth or infrared, rows are mirrored in the same pass when is_mirror is true.
+        void copy_gray16( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror );
+
+        // Copy RGB888 pixels in reversed order, for mirrored rows of decoded color.
+        void copy_rgb888_mirror( const uint8_t* source, uint8_t* destination, size_t pixels );
+
+        // Copy RGB888 image that was decoded by driver, rows are mirrored in the same pass when is_mirror is true.
+        void copy_rgb888( const uint8_t* source, int32_t source_stride, uint8_t* destination, int32_t destination_stride, int32_t width, int32_t height, bool is_mirror );
+    }
+}
@@ -0,0 +1,417 @@
+#include "K4AUtil.h"
+#include "K4ADepthFilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+#if defined( _M_X64 ) || defined( __x86_64__ ) || defined( __SSE2__ )
+#define K4A_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+#define FILTER_BLOCK_ROWS 32
+#define FILTER_BLOCK_COLUMNS 64
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            inline uint16_t round_depth( float value )
+            {
+                return static_cast<uint16_t>( std::min( 65535.0f, std::nearbyint( value ) ) );
+            }
+
+            void to_float( const uint16_t* input, float* output, size_t begin, size_t end )
+            {
+                size_t i = begin;
+
+                #ifdef K4A_FILTER_SSE2
+                const __m128i zero = _mm_setzero_si128();
+                for( ; i + 8 <= end; i += 8 ){
+                    const __m128i depth = _mm_loadu_si128( reinterpret_cast<const __m128i*>( input + i ) );
+                    _mm_storeu_ps( output + i + 0, _mm_cvtepi32_ps( _mm_unpacklo_epi16( depth, zero ) ) );
+                    _mm_storeu_ps( output + i + 4, _mm_cvtepi32_ps( _mm_unpackhi_epi16( depth, zero ) ) );
+                }
+                #endif
+
+                for( ; i < end; i++ ){
+                    output[i] = static_cast<float>( input[i] );
+                }
+            }
+
+            void to_depth( const float* input, uint16_t* output, size_t begin, size_t end )
+            {
+                size_t i = begin;
+
+                #ifdef K4A_FILTER_SSE2
+                // Unsigned saturation of SSE2 is emulated by packing with bias of 32768
+                const __m128 maximum = _mm_set1_ps( 65535.0f );
+                const __m128i bias = _mm_set1_epi32( 32768 );
+                const __m128i sign = _mm_set1_epi16( static_cast<int16_t>( 0x8000 ) );
+                for( ; i + 8 <= end; i += 8 ){
+                    const __m128i low  = _mm_sub_epi32( _mm_cvtps_epi32( _mm_min_ps( _mm_loadu_ps( input + i + 0 ), maximum ) ), bias );
+                    const __m128i high = _mm_sub_epi32( _mm_cvtps_epi32( _mm_min_ps( _mm_loadu_ps( input + i + 4 ), maximum ) ), bias );
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( output + i ), _mm_xor_si128( _mm_packs_epi32( low, high ), sign ) );
+                }
+                #endif
+
+                for( ; i < end; i++ ){
+                    output[i] = round_depth( input[i] );
+                }
+            }
+
+            #ifdef K4A_FILTER_SSE2
+            inline __m128 select( __m128 mask, __m128 a, __m128 b )
+            {
+                return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+            }
+
+            inline __m128 absolute( __m128 value )
+            {
+                return _mm_andnot_ps( _mm_set1_ps( -0.0f ), value );
+            }
+            #endif
+        }
+
+        K4ADepthFilter::K4ADepthFilter( size_t pool_size )
+            : settings( get_default_settings() ),
+              is_enable( false ),
+              is_reset( false ),
+              pool_size( pool_size ),
+              width( 0 ),
+              height( 0 ),
+              has_history( false )
+        {
+            K4ALogDebug( "K4ADepthFilter::K4ADepthFilter" );
+        }
+
+        K4ADepthFilter::~K4ADepthFilter()
+        {
+            K4ALogDebug( "K4ADepthFilter::~K4ADepthFilter" );
+        }
+
+        K4ADepthFilterSettings K4ADepthFilter::get_default_settings()
+        {
+            K4ADepthFilterSettings settings;
+            settings.spatial_iterations   = 0;
+            settings.spatial_alpha        = 0.5f;
+            settings.spatial_delta        = 20;
+            settings.temporal             = 0;
+            settings.temporal_alpha       = 0.4f;
+            settings.temporal_delta       = 20;
+            settings.temporal_persistence = 3;
+            settings.hole_filling         = K4A_HOLE_FILLING_NONE;
+            return settings;
+        }
+
+        bool K4ADepthFilter::is_valid( const K4ADepthFilterSettings& settings )
+        {
+            return settings.spatial_iterations >= 0 && settings.spatial_iterations <= MAX_SPATIAL_ITERATIONS
+                && settings.spatial_alpha >= 0.25f && settings.spatial_alpha <= 1.0f
+                && settings.spatial_delta >= 1 && settings.spatial_delta <= 65535
+                && ( settings.temporal == 0 || settings.temporal == 1 )
+                && settings.temporal_alpha > 0.0f && settings.temporal_alpha <= 1.0f
+                && settings.temporal_delta >= 1 && settings.temporal_delta <= 65535
+                && settings.temporal_persistence >= 0 && settings.temporal_persistence <= TEMPORAL_HISTORY_FRAMES
+                && settings.hole_filling >= K4A_HOLE_FILLING_NONE && settings.hole_filling <= K4A_HOLE_FILLING_NEAREST_AROUND;
+        }
+
+        bool K4ADepthFilter::configure( const K4ADepthFilterSettings& settings )
+        {
+            if( !is_valid( settings ) ){
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock( mutex );
+            this->settings = settings;
+            is_enable = ( settings.spatial_iterations > 0 || settings.temporal != 0 || settings.hole_filling != K4A_HOLE_FILLING_NONE );
+            return true;
+        }
+
+        K4ADepthFilterSettings K4ADepthFilter::get_settings() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            return settings;
+        }
+
+        void K4ADepthFilter::reset()
+        {
+            is_reset = true;
+        }
+
+        k4a::image K4ADepthFilter::process( const k4a::image& depth )
+        {
+            K4ADepthFilterSettings current;
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                current = settings;
+            }
+
+            if( depth.get_format() != K4A_IMAGE_FORMAT_DEPTH16 ){
+                return depth;
+            }
+
+            const int32_t depth_width  = depth.get_width_pixels();
+            const int32_t depth_height = depth.get_height_pixels();
+            if( depth_width <= 0 || depth_height <= 0 ){
+                return depth;
+            }
+            if( depth_width != width || depth_height != height ){
+                width  = depth_width;
+                height = depth_height;
+                const size_t size = static_cast<size_t>( width ) * height;
+                frame.assign( size, 0.0f );
+                last.assign( size, 0.0f );
+                history.assign( size, 0 );
+                has_history = false;
+                pool.configure( K4A_IMAGE_FORMAT_DEPTH16, width, height, width * static_cast<int32_t>( sizeof( uint16_t ) ), pool_size );
+            }
+
+            // History starts again when temporal filter is enabled or stream of frames was restarted
+            if( is_reset.exchange( false ) || !current.temporal ){
+                has_history = false;
+            }
+            if( current.temporal && !has_history ){
+                std::fill( last.begin(), last.end(), 0.0f );
+                std::fill( history.begin(), history.end(), static_cast<uint8_t>( 0 ) );
+                has_history = true;
+            }
+
+            k4a::image filtered = pool.acquire();
+            if( !filtered || depth.get_stride_bytes() != width * static_cast<int32_t>( sizeof( uint16_t ) ) ){
+                K4ATraceError( "failed to acquire image of depth filter" );
+                return depth;
+            }
+
+            const uint16_t* input = reinterpret_cast<const uint16_t*>( depth.get_buffer() );
+            uint16_t* output = reinterpret_cast<uint16_t*>( filtered.get_buffer() );
+            const int32_t blocks = ( height + FILTER_BLOCK_ROWS - 1 ) / FILTER_BLOCK_ROWS;
+            const int32_t column_blocks = ( width + FILTER_BLOCK_COLUMNS - 1 ) / FILTER_BLOCK_COLUMNS;
+            const auto rows_of = [this]( int32_t block, size_t& begin, size_t& end ){
+                begin = static_cast<size_t>( block ) * FILTER_BLOCK_ROWS * width;
+                end   = static_cast<size_t>( std::min( ( block + 1 ) * FILTER_BLOCK_ROWS, height ) ) * width;
+            };
+
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                size_t begin, end;
+                rows_of( block, begin, end );
+                to_float( input, &frame[0], begin, end );
+            } );
+
+            // Horizontal and vertical passes alternate, like recursive domain transform filter
+            const float spatial_alpha = current.spatial_alpha;
+            const float spatial_delta = static_cast<float>( current.spatial_delta );
+            for( int32_t iteration = 0; iteration < current.spatial_iterations; iteration++ ){
+                concurrency::parallel_for( 0, height, [&]( int32_t y ){
+                    spatial_horizontal( &frame[static_cast<size_t>( y ) * width], spatial_alpha, spatial_delta );
+                } );
+                concurrency::parallel_for( 0, column_blocks, [&]( int32_t block ){
+                    spatial_vertical( block * FILTER_BLOCK_COLUMNS, std::min( ( block + 1 ) * FILTER_BLOCK_COLUMNS, width ), spatial_alpha, spatial_delta );
+                } );
+            }
+
+            if( current.temporal ){
+                concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                    size_t begin, end;
+                    rows_of( block, begin, end );
+                    temporal( begin, end, current.temporal_alpha, static_cast<float>( current.temporal_delta ), current.temporal_persistence );
+                } );
+            }
+
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                size_t begin, end;
+                rows_of( block, begin, end );
+                to_depth( &frame[0], output, begin, end );
+            } );
+
+            // Holes are filled from filtered depth, so that filled pixels are never sources of other holes except from left
+            if( current.hole_filling != K4A_HOLE_FILLING_NONE ){
+                concurrency::parallel_for( 0, height, [&]( int32_t y ){
+                    fill_holes( output, y, current.hole_filling );
+                } );
+            }
+
+            filtered.set_timestamp( depth.get_device_timestamp() );
+            return filtered;
+        }
+
+        void K4ADepthFilter::spatial_horizontal( float* row, float alpha, float delta ) const
+        {
+            // Recursive pass is sequential along the row, left to right and then right to left
+            float previous = row[0];
+            for( int32_t x = 1; x < width; x++ ){
+                float value = row[x];
+                if( value > 0.0f && previous > 0.0f && std::fabs( value - previous ) < delta ){
+                    value = alpha * value + ( 1.0f - alpha ) * previous;
+                    row[x] = value;
+                }
+                previous = value;
+            }
+
+            previous = row[width - 1];
+            for( int32_t x = width - 2; x >= 0; x-- ){
+                float value = row[x];
+                if( value > 0.0f && previous > 0.0f && std::fabs( value - previous ) < delta ){
+                    value = alpha * value + ( 1.0f - alpha ) * previous;
+                    row[x] = value;
+                }
+                previous = value;
+            }
+        }
+
+        void K4ADepthFilter::spatial_vertical( int32_t begin, int32_t end, float alpha, float delta )
+        {
+            // Recursive pass is sequential along the column, so pixels of one row are smoothed together with their upper (then lower) neighbors
+            const auto smooth = [&]( int32_t y, int32_t previous_y ){
+                float* row = &frame[static_cast<size_t>( y ) * width];
+                const float* previous_row = &frame[static_cast<size_t>( previous_y ) * width];
+
+                int32_t x = begin;
+
+                #ifdef K4A_FILTER_SSE2
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 weight = _mm_set1_ps( alpha );
+                const __m128 previous_weight = _mm_set1_ps( 1.0f - alpha );
+                const __m128 threshold = _mm_set1_ps( delta );
+                for( ; x + 4 <= end; x += 4 ){
+                    const __m128 value = _mm_loadu_ps( row + x );
+                    const __m128 previous = _mm_loadu_ps( previous_row + x );
+                    const __m128 valid = _mm_and_ps( _mm_cmpgt_ps( value, zero ), _mm_cmpgt_ps( previous, zero ) );
+                    const __m128 mask = _mm_and_ps( valid, _mm_cmplt_ps( absolute( _mm_sub_ps( value, previous ) ), threshold ) );
+                    const __m128 smoothed = _mm_add_ps( _mm_mul_ps( value, weight ), _mm_mul_ps( previous, previous_weight ) );
+                    _mm_storeu_ps( row + x, select( mask, smoothed, value ) );
+                }
+                #endif
+
+                for( ; x < end; x++ ){
+                    const float value = row[x];
+                    const float previous = previous_row[x];
+                    if( value > 0.0f && previous > 0.0f && std::fabs( value - previous ) < delta ){
+                        row[x] = alpha * value + ( 1.0f - alpha ) * previous;
+                    }
+                }
+            };
+
+            for( int32_t y = 1; y < height; y++ ){
+                smooth( y, y - 1 );
+            }
+            for( int32_t y = height - 2; y >= 0; y-- ){
+                smooth( y, y + 1 );
+            }
+        }
+
+        void K4ADepthFilter::temporal( size_t begin, size_t end, float alpha, float delta, int32_t persistence )
+        {
+            // Missing pixel keeps last value in history, and is filled from it when it was valid often enough in recent frames
+            const int32_t threshold = ( persistence > 0 ) ? persistence : TEMPORAL_HISTORY_FRAMES + 1;
+
+            size_t i = begin;
+
+            #ifdef K4A_FILTER_SSE2
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 weight = _mm_set1_ps( alpha );
+            const __m128 last_weight = _mm_set1_ps( 1.0f - alpha );
+            const __m128 limit = _mm_set1_ps( delta );
+            const __m128i one = _mm_set1_epi32( 1 );
+            const __m128i byte = _mm_set1_epi32( 0xFF );
+            const __m128i minimum_count = _mm_set1_epi32( threshold - 1 );
+            for( ; i + 4 <= end; i += 4 ){
+                const __m128 value = _mm_loadu_ps( &frame[i] );
+                const __m128 previous = _mm_loadu_ps( &last[i] );
+                const __m128 valid = _mm_cmpgt_ps( value, zero );
+                const __m128 previous_valid = _mm_cmpgt_ps( previous, zero );
+
+                // History bits of 4 pixels are widened to 32 bits, shifted and counted with SWAR popcount
+                int32_t packed;
+                std::memcpy( &packed, &history[i], sizeof( packed ) );
+                __m128i bits = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( packed ), _mm_setzero_si128() ), _mm_setzero_si128() );
+                bits = _mm_and_si128( _mm_or_si128( _mm_slli_epi32( bits, 1 ), _mm_and_si128( _mm_castps_si128( valid ), one ) ), byte );
+                __m128i count = _mm_sub_epi32( bits, _mm_and_si128( _mm_srli_epi32( bits, 1 ), _mm_set1_epi32( 0x55 ) ) );
+                count = _mm_add_epi32( _mm_and_si128( count, _mm_set1_epi32( 0x33 ) ), _mm_and_si128( _mm_srli_epi32( count, 2 ), _mm_set1_epi32( 0x33 ) ) );
+                count = _mm_and_si128( _mm_add_epi32( count, _mm_srli_epi32( count, 4 ) ), _mm_set1_epi32( 0x0F ) );
+                packed = _mm_cvtsi128_si32( _mm_packus_epi16( _mm_packs_epi32( bits, bits ), _mm_setzero_si128() ) );
+                std::memcpy( &history[i], &packed, sizeof( packed ) );
+
+                const __m128 is_near = _mm_and_ps( previous_valid, _mm_cmplt_ps( absolute( _mm_sub_ps( value, previous ) ), limit ) );
+                const __m128 averaged = select( is_near, _mm_add_ps( _mm_mul_ps( value, weight ), _mm_mul_ps( previous, last_weight ) ), value );
+                const __m128 persistent = _mm_castsi128_ps( _mm_cmpgt_epi32( count, minimum_count ) );
+                _mm_storeu_ps( &frame[i], select( valid, averaged, _mm_and_ps( persistent, previous ) ) );
+                _mm_storeu_ps( &last[i], select( valid, averaged, previous ) );
+            }
+            #endif
+
+            for( ; i < end; i++ ){
+                const float value = frame[i];
+                const float previous = last[i];
+                const bool valid = value > 0.0f;
+                const uint8_t bits = static_cast<uint8_t>( ( history[i] << 1 ) | ( valid ? 1 : 0 ) );
+                history[i] = bits;
+
+                if( valid ){
+                    const float averaged = ( previous > 0.0f && std::fabs( value - previous ) < delta ) ? alpha * value + ( 1.0f - alpha ) * previous : value;
+                    frame[i] = averaged;
+                    last[i]  = averaged;
+                }
+                else{
+                    int32_t count = 0;
+                    for( uint8_t b = bits; b; b &= static_cast<uint8_t>( b - 1 ) ){
+                        count++;
+                    }
+                    frame[i] = ( count >= threshold ) ? previous : 0.0f;
+                }
+            }
+        }
+
+        void K4ADepthFilter::fill_holes( uint16_t* output, int32_t y, int32_t hole_filling ) const
+        {
+            uint16_t* row = output + static_cast<size_t>( y ) * width;
+
+            if( hole_filling == K4A_HOLE_FILLING_FROM_LEFT ){
+                uint16_t left = 0;
+                for( int32_t x = 0; x < width; x++ ){
+                    if( row[x] ){
+                        left = row[x];
+                    }
+                    else{
+                        row[x] = left;
+                    }
+                }
+                return;
+            }
+
+            // Neighbors are read from float frame, because rows of output are filled in parallel
+            const bool is_farthest = ( hole_filling == K4A_HOLE_FILLING_FARTHEST_AROUND );
+            const int32_t top    = std::max( y - 1, 0 );
+            const int32_t bottom = std::min( y + 1, height - 1 );
+            for( int32_t x = 0; x < width; x++ ){
+                if( row[x] ){
+                    continue;
+                }
+
+                const int32_t left  = std::max( x - 1, 0 );
+                const int32_t right = std::min( x + 1, width - 1 );
+                float fill = 0.0f;
+                for( int32_t v = top; v <= bottom; v++ ){
+                    const float* neighbors = &frame[static_cast<size_t>( v ) * width];
+                    for( int32_t u = left; u <= right; u++ ){
+                        const float value = neighbors[u];
+                        if( value > 0.0f && ( fill == 0.0f || ( is_farthest ? value > fill : value < fill ) ) ){
+                            fill = value;
+                        }
+                    }
+                }
+                row[x] = round_depth( fill );
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+
+#include "K4AProperties.h"
+#include "K4AImagePool.h"
+
+#define MAX_SPATIAL_ITERATIONS 5
+#define TEMPORAL_HISTORY_FRAMES 8
+
+namespace oni
+{
+    namespace driver
+    {
+        // Depth filter chain of pipeline, spatial and temporal filters work on float copy of depth and write into pooled image.
+        // Input image is never modified, because recorder and other consumers may still hold its reference.
+        class K4ADepthFilter
+        {
+            public:
+                K4ADepthFilter( size_t pool_size );
+
+                ~K4ADepthFilter();
+
+                static K4ADepthFilterSettings get_default_settings();
+
+                static bool is_valid( const K4ADepthFilterSettings& settings );
+
+                // Settings are taken by next frame, any thread
+                bool configure( const K4ADepthFilterSettings& settings );
+
+                K4ADepthFilterSettings get_settings() const;
+
+                inline bool is_enabled() const { return is_enable; }
+
+                // Temporal history is dropped with next frame, when stream of frames is discontinuous
+                void reset();
+
+                // Ordered stage of pipeline only, one frame at a time in order of capture, returns input when the image could not be filtered
+                k4a::image process( const k4a::image& depth );
+
+            protected:
+                K4ADepthFilter( const K4ADepthFilter& );
+                void operator=( const K4ADepthFilter& );
+
+            private:
+                void spatial_horizontal( float* row, float alpha, float delta ) const;
+
+                void spatial_vertical( int32_t begin, int32_t end, float alpha, float delta );
+
+                void temporal( size_t begin, size_t end, float alpha, float delta, int32_t persistence );
+
+                void fill_holes( uint16_t* output, int32_t y, int32_t hole_filling ) const;
+
+            protected:
+                mutable std::mutex mutex;
+                K4ADepthFilterSettings settings;
+                std::atomic_bool is_enable;
+                std::atomic_bool is_reset;
+
+                // Ordered stage of pipeline only
+                size_t pool_size;
+                K4AImagePool pool;
+                int32_t width;
+                int32_t height;
+                bool has_history;
+                std::vector<float> frame;
+                std::vector<float> last;
+                std::vector<uint8_t> history; // bit i is set when pixel was valid i frames ago
+        };
+    }
+}
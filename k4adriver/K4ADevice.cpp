@@ -1,56 +1,212 @@
 #include "K4AUtil.h"
 #include "K4ADevice.h"
+#include "K4ADriver.h"
+#include "K4AJpegDecoder.h"
+
+#include <algorithm>
 
 namespace oni
 {
     namespace driver
     {
-        K4ADevice::K4ADevice( class K4ADriver* k4a_driver, k4a::device* device )
+        namespace
+        {
+            struct ColorMode
+            {
+                k4a_color_resolution_t resolution;
+                int32_t width;
+                int32_t height;
+            };
+
+            struct ColorFormat
+            {
+                int32_t pixel_format;
+                k4a_image_format_t format;
+            };
+
+            struct DepthMode
+            {
+                k4a_depth_mode_t mode;
+                int32_t width;
+                int32_t height;
+            };
+
+            const ColorMode color_modes[] = {
+                { K4A_COLOR_RESOLUTION_720P , 1280,  720 },
+                { K4A_COLOR_RESOLUTION_1080P, 1920, 1080 },
+                { K4A_COLOR_RESOLUTION_1440P, 2560, 1440 },
+                { K4A_COLOR_RESOLUTION_1536P, 2048, 1536 },
+                { K4A_COLOR_RESOLUTION_2160P, 3840, 2160 },
+                { K4A_COLOR_RESOLUTION_3072P, 4096, 3072 },
+            };
+
+            // RGB888 is converted from BGRA32 on host (or decoded from MJPG by decoder pool), the other formats are delivered as sent by source
+            const ColorFormat color_formats[] = {
+                { ONI_PIXEL_FORMAT_RGB888 , K4A_IMAGE_FORMAT_COLOR_BGRA32 },
+                { K4A_PIXEL_FORMAT_BGRA32 , K4A_IMAGE_FORMAT_COLOR_BGRA32 },
+                { ONI_PIXEL_FORMAT_YUYV   , K4A_IMAGE_FORMAT_COLOR_YUY2   },
+                { K4A_PIXEL_FORMAT_NV12   , K4A_IMAGE_FORMAT_COLOR_NV12   },
+                { ONI_PIXEL_FORMAT_JPEG   , K4A_IMAGE_FORMAT_COLOR_MJPG   },
+            };
+
+            const DepthMode depth_modes[] = {
+                { K4A_DEPTH_MODE_NFOV_2X2BINNED,  320,  288 },
+                { K4A_DEPTH_MODE_NFOV_UNBINNED ,  640,  576 },
+                { K4A_DEPTH_MODE_WFOV_2X2BINNED,  512,  512 },
+                { K4A_DEPTH_MODE_WFOV_UNBINNED , 1024, 1024 },
+                { K4A_DEPTH_MODE_PASSIVE_IR    , 1024, 1024 },
+            };
+
+            int32_t to_fps( k4a_fps_t fps )
+            {
+                switch( fps ){
+                    case K4A_FRAMES_PER_SECOND_5:
+                        return 5;
+                    case K4A_FRAMES_PER_SECOND_15:
+                        return 15;
+                    case K4A_FRAMES_PER_SECOND_30:
+                    default:
+                        return 30;
+                }
+            }
+
+            bool to_k4a_fps( int32_t fps, k4a_fps_t* k4a_fps )
+            {
+                switch( fps ){
+                    case 5:
+                        *k4a_fps = K4A_FRAMES_PER_SECOND_5;
+                        return true;
+                    case 15:
+                        *k4a_fps = K4A_FRAMES_PER_SECOND_15;
+                        return true;
+                    case 30:
+                        *k4a_fps = K4A_FRAMES_PER_SECOND_30;
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+
+            bool is_same_configuration( const k4a_device_configuration_t& configuration, const k4a_device_configuration_t& other )
+            {
+                return ( configuration.color_format == other.color_format
+                    && configuration.color_resolution == other.color_resolution
+                    && configuration.depth_mode == other.depth_mode
+                    && configuration.camera_fps == other.camera_fps
+                    && configuration.wired_sync_mode == other.wired_sync_mode
+                    && configuration.depth_delay_off_color_usec == other.depth_delay_off_color_usec
+                    && configuration.subordinate_delay_off_master_usec == other.subordinate_delay_off_master_usec );
+            }
+
+            // String property is copied with terminating null, buffer that can not hold whole string is an error
+            OniStatus get_string( const std::string& value, void* data, int* pDataSize )
+            {
+                const int n = snprintf( reinterpret_cast<char*>( data ), *pDataSize, "%s", value.c_str() );
+                if( n < 0 || n >= *pDataSize ){
+                    K4ATraceError( "buffer of %d bytes is too small for %d characters", *pDataSize, static_cast<int>( value.size() ) );
+                    return ONI_STATUS_ERROR;
+                }
+
+                *pDataSize = n + 1;
+                return ONI_STATUS_OK;
+            }
+        }
+
+        K4ADevice::K4ADevice( class K4ADriver* k4a_driver, K4ASource* source )
             : k4a_driver( k4a_driver ),
               k4a_capture( nullptr ),
-              device( device ),
+              source( source ),
+              calibration_generation( 0 ),
               device_configuration( K4A_DEVICE_CONFIG_INIT_DISABLE_ALL ),
-              registration_mode( ONI_IMAGE_REGISTRATION_OFF )
+              is_cameras_started( false ),
+              color_pixel_format( ONI_PIXEL_FORMAT_RGB888 ),
+              color_decoder( K4A_COLOR_DECODER_SDK ),
+              depth_filter_settings( K4ADepthFilter::get_default_settings() ),
+              registration_mode( ONI_IMAGE_REGISTRATION_OFF ),
+              registration_engine( K4A_REGISTRATION_ENGINE_SDK )
         {
             K4ALogDebug( "K4ADevice::K4ADevice" );
 
             device_configuration.color_format               = k4a_image_format_t::K4A_IMAGE_FORMAT_COLOR_BGRA32;
             device_configuration.color_resolution           = k4a_color_resolution_t::K4A_COLOR_RESOLUTION_720P;
             device_configuration.depth_mode                 = k4a_depth_mode_t::K4A_DEPTH_MODE_NFOV_UNBINNED;
+            device_configuration.camera_fps                 = k4a_fps_t::K4A_FRAMES_PER_SECOND_30;
             device_configuration.synchronized_images_only   = true;
             device_configuration.wired_sync_mode            = k4a_wired_sync_mode_t::K4A_WIRED_SYNC_MODE_STANDALONE;
 
-            calibration = device->get_calibration( device_configuration.depth_mode, device_configuration.color_resolution );
-
-            OniSensorInfo color_sensor;
-            color_sensor.pSupportedVideoModes                = new OniVideoMode[1];
-            color_sensor.sensorType                          = ONI_SENSOR_COLOR;
-            color_sensor.numSupportedVideoModes              = 1;
-            color_sensor.pSupportedVideoModes[0].pixelFormat = ONI_PIXEL_FORMAT_RGB888;
-            color_sensor.pSupportedVideoModes[0].fps         = 30;
-            color_sensor.pSupportedVideoModes[0].resolutionX = calibration.color_camera_calibration.resolution_width;
-            color_sensor.pSupportedVideoModes[0].resolutionY = calibration.color_camera_calibration.resolution_height;
-            sensors.push_back( color_sensor );
-
-            OniSensorInfo depth_sensor;
-            depth_sensor.pSupportedVideoModes                = new OniVideoMode[1];
-            depth_sensor.sensorType                          = ONI_SENSOR_DEPTH;
-            depth_sensor.numSupportedVideoModes              = 1;
-            depth_sensor.pSupportedVideoModes[0].pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
-            depth_sensor.pSupportedVideoModes[0].fps         = 30;
-            depth_sensor.pSupportedVideoModes[0].resolutionX = calibration.depth_camera_calibration.resolution_width;
-            depth_sensor.pSupportedVideoModes[0].resolutionY = calibration.depth_camera_calibration.resolution_height;
-            sensors.push_back( depth_sensor );
-
-            OniSensorInfo infrared_sensor;
-            infrared_sensor.pSupportedVideoModes                = new OniVideoMode[1];
-            infrared_sensor.sensorType                          = ONI_SENSOR_IR;
-            infrared_sensor.numSupportedVideoModes              = 1;
-            infrared_sensor.pSupportedVideoModes[0].pixelFormat = ONI_PIXEL_FORMAT_GRAY16;
-            infrared_sensor.pSupportedVideoModes[0].fps         = 30;
-            infrared_sensor.pSupportedVideoModes[0].resolutionX = calibration.depth_camera_calibration.resolution_width;
-            infrared_sensor.pSupportedVideoModes[0].resolutionY = calibration.depth_camera_calibration.resolution_height;
-            sensors.push_back( infrared_sensor );
+            // Recordings have fixed mode
+            this->source->get_default_configuration( device_configuration );
+
+            calibration = this->source->get_calibration( device_configuration.depth_mode, device_configuration.color_resolution );
+
+            for( const ColorFormat& color_format : color_formats ){
+                for( const ColorMode& color_mode : color_modes ){
+                    if( !this->source->is_color_format_supported( color_format.format, color_mode.resolution ) ){
+                        continue;
+                    }
+                    for( const k4a_fps_t fps : { K4A_FRAMES_PER_SECOND_5, K4A_FRAMES_PER_SECOND_15, K4A_FRAMES_PER_SECOND_30 } ){
+                        if( fps == K4A_FRAMES_PER_SECOND_30 && color_mode.resolution == K4A_COLOR_RESOLUTION_3072P ){
+                            continue;
+                        }
+                        if( !this->source->is_color_mode_supported( color_mode.resolution, fps ) ){
+                            continue;
+                        }
+                        OniVideoMode video_mode;
+                        video_mode.pixelFormat = static_cast<OniPixelFormat>( color_format.pixel_format );
+                        video_mode.fps         = to_fps( fps );
+                        video_mode.resolutionX = color_mode.width;
+                        video_mode.resolutionY = color_mode.height;
+                        color_video_modes.push_back( video_mode );
+                    }
+                }
+            }
+
+            for( const DepthMode& depth_mode : depth_modes ){
+                for( const k4a_fps_t fps : { K4A_FRAMES_PER_SECOND_5, K4A_FRAMES_PER_SECOND_15, K4A_FRAMES_PER_SECOND_30 } ){
+                    if( fps == K4A_FRAMES_PER_SECOND_30 && depth_mode.mode == K4A_DEPTH_MODE_WFOV_UNBINNED ){
+                        continue;
+                    }
+                    if( !this->source->is_depth_mode_supported( depth_mode.mode, fps ) ){
+                        continue;
+                    }
+                    OniVideoMode video_mode;
+                    video_mode.fps         = to_fps( fps );
+                    video_mode.resolutionX = depth_mode.width;
+                    video_mode.resolutionY = depth_mode.height;
+                    if( depth_mode.mode != K4A_DEPTH_MODE_PASSIVE_IR ){
+                        video_mode.pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
+                        depth_video_modes.push_back( video_mode );
+                        video_mode.pixelFormat = static_cast<OniPixelFormat>( K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT );
+                        point_cloud_video_modes.push_back( video_mode );
+                        video_mode.pixelFormat = static_cast<OniPixelFormat>( K4A_PIXEL_FORMAT_POINT_XYZ_INT16 );
+                        point_cloud_video_modes.push_back( video_mode );
+                    }
+                    // 1024x1024 infrared at 30 fps is only available in passive IR mode
+                    if( depth_mode.mode != K4A_DEPTH_MODE_PASSIVE_IR || fps == K4A_FRAMES_PER_SECOND_30 ){
+                        video_mode.pixelFormat = ONI_PIXEL_FORMAT_GRAY16;
+                        infrared_video_modes.push_back( video_mode );
+                    }
+                }
+            }
+
+            // Sensor without video mode, such as color of recording without color track, is not advertised
+            const std::pair<int32_t, std::vector<OniVideoMode>*> sensor_video_modes[] = {
+                { ONI_SENSOR_COLOR       , &color_video_modes       },
+                { ONI_SENSOR_DEPTH       , &depth_video_modes       },
+                { ONI_SENSOR_IR          , &infrared_video_modes    },
+                { K4A_SENSOR_POINT_CLOUD , &point_cloud_video_modes },
+            };
+            for( const std::pair<int32_t, std::vector<OniVideoMode>*>& sensor_video_mode : sensor_video_modes ){
+                if( sensor_video_mode.second->empty() ){
+                    continue;
+                }
+
+                OniSensorInfo sensor;
+                sensor.sensorType             = static_cast<OniSensorType>( sensor_video_mode.first );
+                sensor.numSupportedVideoModes = static_cast<int32_t>( sensor_video_mode.second->size() );
+                sensor.pSupportedVideoModes   = sensor_video_mode.second->data();
+                sensors.push_back( sensor );
+            }
         }
 
         K4ADevice::~K4ADevice()
@@ -61,16 +217,14 @@ namespace oni
                 delete k4a_capture;
             }
 
-            if( device ){
-                device->stop_cameras();
-            }
+            stop_cameras();
         }
 
         OniStatus K4ADevice::getSensorInfoList( OniSensorInfo** pSensorInfos, int* numSensors )
         {
             K4ATraceFunc( "" );
 
-            *pSensorInfos = &sensors[0];
+            *pSensorInfos = sensors.empty() ? nullptr : sensors.data();
             *numSensors   = static_cast<int32_t>( sensors.size() );
 
             return ONI_STATUS_OK;
@@ -80,21 +234,44 @@ namespace oni
         {
             K4ATraceFunc( "sensor type = %d", sensorType );
 
+            const bool is_advertised = std::any_of( sensors.begin(), sensors.end(), [sensorType]( const OniSensorInfo& sensor ){ return sensor.sensorType == sensorType; } );
+            if( !is_advertised ){
+                K4ATraceError( "sensor type %d has no video mode", sensorType );
+                return nullptr;
+            }
+
             if( !k4a_capture ){
-                device->start_cameras( &device_configuration );
+                try{
+                    start_cameras();
+                }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "k4a::device::start_cameras failed - %s", error.what() );
+                    return nullptr;
+                }
                 k4a_capture = new K4ACapture( this );
+                k4a_capture->set_depth_filter( depth_filter_settings );
             }
 
-            switch( sensorType ){
+            K4AStream* stream = nullptr;
+            switch( static_cast<int32_t>( sensorType ) ){
                 case ONI_SENSOR_COLOR:
-                    return new K4AColorStream( this );
+                    stream = new K4AColorStream( this );
+                    break;
                 case ONI_SENSOR_DEPTH:
-                    return new K4ADepthStream( this );
+                    stream = new K4ADepthStream( this );
+                    break;
                 case ONI_SENSOR_IR:
-                    return new K4AInfraredStream( this );
+                    stream = new K4AInfraredStream( this );
+                    break;
+                case K4A_SENSOR_POINT_CLOUD:
+                    stream = new K4APointCloudStream( this );
+                    break;
                 default:
                     return nullptr;
             }
+
+            streams.push_back( stream );
+            return stream;
         }
 
         void K4ADevice::destroyStream( StreamBase* pStream )
@@ -105,9 +282,284 @@ namespace oni
                 return;
             }
 
+            streams.erase( std::remove( streams.begin(), streams.end(), pStream ), streams.end() );
+
             delete pStream;
         }
 
+        OniStatus K4ADevice::setVideoMode( OniSensorType sensor_type, const OniVideoMode& video_mode )
+        {
+            K4ATraceFunc( "sensor type = %d, %dx%d @%d format=%d", sensor_type, video_mode.resolutionX, video_mode.resolutionY, video_mode.fps, static_cast<int>( video_mode.pixelFormat ) );
+
+            k4a_device_configuration_t configuration = device_configuration;
+            if( !to_k4a_fps( video_mode.fps, &configuration.camera_fps ) ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            bool is_found = false;
+            int32_t pixel_format = color_pixel_format;
+            switch( sensor_type ){
+                case ONI_SENSOR_COLOR:
+                    pixel_format = static_cast<int32_t>( video_mode.pixelFormat );
+                    for( const ColorMode& color_mode : color_modes ){
+                        if( color_mode.width == video_mode.resolutionX && color_mode.height == video_mode.resolutionY ){
+                            configuration.color_resolution = color_mode.resolution;
+                            configuration.color_format     = get_color_format( pixel_format, color_mode.resolution );
+                            is_found = source->is_color_format_supported( configuration.color_format, configuration.color_resolution );
+                            break;
+                        }
+                    }
+                    break;
+                case ONI_SENSOR_DEPTH:
+                    if( video_mode.pixelFormat != ONI_PIXEL_FORMAT_DEPTH_1_MM ){
+                        return ONI_STATUS_NOT_SUPPORTED;
+                    }
+                    // Registered depth has resolution of color camera, only frame rate can be changed
+                    if( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR
+                        && video_mode.resolutionX == calibration.color_camera_calibration.resolution_width
+                        && video_mode.resolutionY == calibration.color_camera_calibration.resolution_height ){
+                        is_found = true;
+                        break;
+                    }
+                    for( const DepthMode& depth_mode : depth_modes ){
+                        if( depth_mode.mode != K4A_DEPTH_MODE_PASSIVE_IR && depth_mode.width == video_mode.resolutionX && depth_mode.height == video_mode.resolutionY ){
+                            configuration.depth_mode = depth_mode.mode;
+                            is_found = true;
+                            break;
+                        }
+                    }
+                    break;
+                case ONI_SENSOR_IR:
+                    if( video_mode.pixelFormat != ONI_PIXEL_FORMAT_GRAY16 ){
+                        return ONI_STATUS_NOT_SUPPORTED;
+                    }
+                    for( const DepthMode& depth_mode : depth_modes ){
+                        if( depth_mode.width == video_mode.resolutionX && depth_mode.height == video_mode.resolutionY ){
+                            // Prefer mode that keeps depth available, 1024x1024 at 30 fps falls to passive IR
+                            if( depth_mode.mode == K4A_DEPTH_MODE_WFOV_UNBINNED && configuration.camera_fps == K4A_FRAMES_PER_SECOND_30 ){
+                                continue;
+                            }
+                            configuration.depth_mode = depth_mode.mode;
+                            is_found = true;
+                            break;
+                        }
+                    }
+                    // Passive IR has no depth, so it is not chosen under running depth or point cloud stream
+                    if( is_found && configuration.depth_mode == K4A_DEPTH_MODE_PASSIVE_IR ){
+                        const bool has_depth_stream = std::any_of( streams.begin(), streams.end(), []( const K4AStream* stream ){ return stream->getSensorType() == ONI_SENSOR_DEPTH; } );
+                        if( has_depth_stream ){
+                            K4ATraceError( "passive IR mode is not available while depth stream exists" );
+                            return ONI_STATUS_NOT_SUPPORTED;
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            if( !is_found ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            // Keep the other sensor in its mode, 30 fps is not supported by 3072p color and WFOV unbinned depth
+            if( configuration.camera_fps == K4A_FRAMES_PER_SECOND_30
+                && ( configuration.color_resolution == K4A_COLOR_RESOLUTION_3072P || configuration.depth_mode == K4A_DEPTH_MODE_WFOV_UNBINNED ) ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            // Modes are checked before cameras are stopped, recordings only deliver mode they were recorded in
+            if( !source->is_color_mode_supported( configuration.color_resolution, configuration.camera_fps )
+                || !source->is_depth_mode_supported( configuration.depth_mode, configuration.camera_fps ) ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            // Pixel formats may share configuration of device (RGB888 and BGRA32, or RGB888 of decoder pool and JPEG),
+            // so streams and capture are updated even if device is not restarted
+            const int32_t previous_pixel_format = color_pixel_format;
+            const bool is_same = is_same_configuration( configuration, device_configuration );
+            color_pixel_format = pixel_format;
+            const OniStatus status = reconfigure( configuration );
+            if( status != ONI_STATUS_OK ){
+                color_pixel_format = previous_pixel_format;
+            }
+            else if( color_pixel_format != previous_pixel_format ){
+                if( is_same && k4a_capture ){
+                    k4a_capture->stop();
+                    k4a_capture->start();
+                }
+                for( K4AStream* stream : streams ){
+                    stream->update_video_mode();
+                }
+            }
+            return status;
+        }
+
+        k4a_image_format_t K4ADevice::get_color_format( int32_t pixel_format, k4a_color_resolution_t color_resolution ) const
+        {
+            // RGB888 of decoder pool is decoded from MJPG, if source is able to deliver it
+            if( pixel_format == ONI_PIXEL_FORMAT_RGB888 && color_decoder == K4A_COLOR_DECODER_POOL && source->is_color_format_supported( K4A_IMAGE_FORMAT_COLOR_MJPG, color_resolution ) ){
+                return K4A_IMAGE_FORMAT_COLOR_MJPG;
+            }
+
+            for( const ColorFormat& color_format : color_formats ){
+                if( color_format.pixel_format == pixel_format ){
+                    return color_format.format;
+                }
+            }
+            return K4A_IMAGE_FORMAT_CUSTOM;
+        }
+
+        int32_t K4ADevice::getFps() const
+        {
+            return to_fps( device_configuration.camera_fps );
+        }
+
+        std::shared_ptr<const K4ACalibrationTable> K4ADevice::getCalibrationTable()
+        {
+            // Tables are built once per mode on first use
+            k4a::calibration table_calibration;
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock( calibration_table_mutex );
+                if( calibration_table ){
+                    return calibration_table;
+                }
+                table_calibration = calibration;
+                generation        = calibration_generation;
+            }
+
+            std::shared_ptr<const K4ACalibrationTable> built_table = std::make_shared<K4ACalibrationTable>( table_calibration );
+
+            std::lock_guard<std::mutex> lock( calibration_table_mutex );
+            if( generation != calibration_generation ){
+                return built_table;
+            }
+            if( !calibration_table ){
+                calibration_table = built_table;
+            }
+            return calibration_table;
+        }
+
+        std::shared_ptr<const K4APointCloudTable> K4ADevice::getPointCloudTable( k4a_calibration_type_t camera )
+        {
+            // Table of color camera is only built when point cloud is registered to color
+            std::shared_ptr<const K4APointCloudTable>& table = ( camera == K4A_CALIBRATION_TYPE_COLOR ) ? color_point_cloud_table : depth_point_cloud_table;
+            k4a::calibration table_calibration;
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock( calibration_table_mutex );
+                if( table ){
+                    return table;
+                }
+                table_calibration = calibration;
+                generation        = calibration_generation;
+            }
+
+            // Rays of color camera take a while, so table is built without holding lock that per-frame callers take
+            std::shared_ptr<const K4APointCloudTable> built_table = std::make_shared<K4APointCloudTable>( table_calibration, camera );
+
+            std::lock_guard<std::mutex> lock( calibration_table_mutex );
+            if( generation != calibration_generation ){
+                return built_table;
+            }
+            if( !table ){
+                table = built_table;
+            }
+            return table;
+        }
+
+        void K4ADevice::start_cameras()
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( cameras_mutex );
+            if( is_cameras_started ){
+                return;
+            }
+
+            // Subordinates must be waiting for sync pulse before master starts to emit it
+            if( device_configuration.wired_sync_mode == K4A_WIRED_SYNC_MODE_MASTER ){
+                k4a_driver->start_subordinates( this );
+            }
+
+            k4a_device_configuration_t configuration = device_configuration;
+            if( configuration.wired_sync_mode != K4A_WIRED_SYNC_MODE_SUBORDINATE ){
+                configuration.subordinate_delay_off_master_usec = 0;
+            }
+            source->start_cameras( configuration );
+            is_cameras_started = true;
+        }
+
+        void K4ADevice::stop_cameras()
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( cameras_mutex );
+            if( !is_cameras_started ){
+                return;
+            }
+
+            source->stop_cameras();
+            is_cameras_started = false;
+        }
+
+        OniStatus K4ADevice::reconfigure( const k4a_device_configuration_t& configuration )
+        {
+            K4ATraceFunc( "" );
+
+            if( is_same_configuration( configuration, device_configuration ) ){
+                return ONI_STATUS_OK;
+            }
+
+            const k4a_device_configuration_t previous_configuration = device_configuration;
+
+            // Cameras that were started without stream (subordinates started by master) are restarted too
+            const bool is_restart = is_cameras_started;
+            if( k4a_capture ){
+                k4a_capture->stop();
+            }
+            stop_cameras();
+
+            OniStatus status = ONI_STATUS_OK;
+            k4a::calibration mode_calibration;
+            try{
+                device_configuration = configuration;
+                mode_calibration = source->get_calibration( device_configuration.depth_mode, device_configuration.color_resolution );
+                if( is_restart ){
+                    start_cameras();
+                }
+            }
+            catch( const k4a::error& error ){
+                K4ATraceError( "reconfigure failed - %s", error.what() );
+                device_configuration = previous_configuration;
+                mode_calibration = source->get_calibration( device_configuration.depth_mode, device_configuration.color_resolution );
+                if( is_restart ){
+                    start_cameras();
+                }
+                status = ONI_STATUS_ERROR;
+            }
+
+            {
+                // Tables are built from copy of calibration on other threads, so it is replaced under lock
+                std::lock_guard<std::mutex> lock( calibration_table_mutex );
+                calibration = mode_calibration;
+                calibration_table.reset();
+                depth_point_cloud_table.reset();
+                color_point_cloud_table.reset();
+                calibration_generation++;
+            }
+
+            if( k4a_capture ){
+                k4a_capture->start();
+            }
+
+            for( K4AStream* stream : streams ){
+                stream->update_video_mode();
+            }
+
+            return status;
+        }
+
         OniStatus K4ADevice::setProperty( int propertyId, const void* data, int dataSize )
         {
             K4ATraceFunc( "K4ADevice::setProperty : %d", propertyId );
@@ -117,18 +569,165 @@ namespace oni
                 case ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION:
                     if( data && ( dataSize == sizeof( OniImageRegistrationMode ) ) )
                     {
-                        registration_mode = *reinterpret_cast<OniImageRegistrationMode*>( const_cast<void*>( data ) );
-                        K4ALogDebug( "set registration mode: %d", registration_mode );
+                        const OniImageRegistrationMode mode = *reinterpret_cast<const OniImageRegistrationMode*>( data );
+                        if( mode != ONI_IMAGE_REGISTRATION_OFF && mode != ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ){
+                            return ONI_STATUS_BAD_PARAMETER;
+                        }
+                        K4ALogDebug( "set registration mode: %d", mode );
+                        if( mode != registration_mode ){
+                            // Resolution of depth changes, so streams report new mode before registered frames reach them
+                            if( k4a_capture ){
+                                k4a_capture->stop();
+                            }
+                            registration_mode = mode;
+                            for( K4AStream* stream : streams ){
+                                stream->update_video_mode();
+                            }
+                            if( k4a_capture ){
+                                k4a_capture->start();
+                            }
+                        }
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_REGISTRATION_ENGINE:
+                    if( data && ( dataSize == sizeof( K4ARegistrationEngine ) ) ){
+                        const K4ARegistrationEngine engine = *reinterpret_cast<const K4ARegistrationEngine*>( data );
+                        if( engine != K4A_REGISTRATION_ENGINE_SDK && engine != K4A_REGISTRATION_ENGINE_TABLE ){
+                            return ONI_STATUS_BAD_PARAMETER;
+                        }
+                        K4ALogDebug( "set registration engine: %d", engine );
+                        if( engine != registration_engine ){
+                            registration_engine = engine;
+                            if( k4a_capture ){
+                                k4a_capture->stop();
+                                k4a_capture->start();
+                            }
+                        }
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_COLOR_DECODER:
+                    if( data && ( dataSize == sizeof( K4AColorDecoder ) ) ){
+                        const K4AColorDecoder decoder = *reinterpret_cast<const K4AColorDecoder*>( data );
+                        if( decoder != K4A_COLOR_DECODER_SDK && decoder != K4A_COLOR_DECODER_POOL ){
+                            return ONI_STATUS_BAD_PARAMETER;
+                        }
+                        if( decoder == K4A_COLOR_DECODER_POOL && !K4AJpegDecoder::is_available() ){
+                            return ONI_STATUS_NOT_SUPPORTED;
+                        }
+                        K4ALogDebug( "set color decoder: %d", decoder );
+                        const K4AColorDecoder previous_decoder = color_decoder;
+                        color_decoder = decoder;
+                        k4a_device_configuration_t configuration = device_configuration;
+                        configuration.color_format = get_color_format( color_pixel_format, configuration.color_resolution );
+                        const OniStatus status = reconfigure( configuration );
+                        if( status != ONI_STATUS_OK ){
+                            color_decoder = previous_decoder;
+                        }
+                        return status;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_DEPTH_FILTER:
+                    if( data && ( dataSize == sizeof( K4ADepthFilterSettings ) ) ){
+                        const K4ADepthFilterSettings settings = *reinterpret_cast<const K4ADepthFilterSettings*>( data );
+                        if( !K4ADepthFilter::is_valid( settings ) ){
+                            return ONI_STATUS_BAD_PARAMETER;
+                        }
+                        depth_filter_settings = settings;
+                        if( k4a_capture ){
+                            k4a_capture->set_depth_filter( settings );
+                        }
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_WIRED_SYNC_MODE:
+                    if( data && ( dataSize == sizeof( int32_t ) ) ){
+                        const k4a_wired_sync_mode_t mode = static_cast<k4a_wired_sync_mode_t>( *reinterpret_cast<const int32_t*>( data ) );
+                        switch( mode ){
+                            case K4A_WIRED_SYNC_MODE_STANDALONE:
+                                break;
+                            case K4A_WIRED_SYNC_MODE_MASTER:
+                                if( !source->is_sync_out_connected() ){
+                                    K4ATraceError( "sync out jack is not connected" );
+                                    return ONI_STATUS_ERROR;
+                                }
+                                break;
+                            case K4A_WIRED_SYNC_MODE_SUBORDINATE:
+                                if( !source->is_sync_in_connected() ){
+                                    K4ATraceError( "sync in jack is not connected" );
+                                    return ONI_STATUS_ERROR;
+                                }
+                                break;
+                            default:
+                                return ONI_STATUS_BAD_PARAMETER;
+                        }
+                        K4ALogDebug( "set wired sync mode: %d", mode );
+                        k4a_device_configuration_t configuration = device_configuration;
+                        configuration.wired_sync_mode = mode;
+                        return reconfigure( configuration );
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_LOG_LEVEL:
+                    if( data && ( dataSize == sizeof( int32_t ) ) ){
+                        // Level is shared by all devices of driver
+                        K4ALogger::set_level( *reinterpret_cast<const int32_t*>( data ) );
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_DEPTH_DELAY_OFF_COLOR_USEC:
+                    if( data && ( dataSize == sizeof( int32_t ) ) ){
+                        const int32_t delay = *reinterpret_cast<const int32_t*>( data );
+                        K4ALogDebug( "set depth delay off color: %d usec", delay );
+                        k4a_device_configuration_t configuration = device_configuration;
+                        configuration.depth_delay_off_color_usec = delay;
+                        return reconfigure( configuration );
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_SUBORDINATE_DELAY_OFF_MASTER_USEC:
+                    if( data && ( dataSize == sizeof( uint32_t ) ) ){
+                        const uint32_t delay = *reinterpret_cast<const uint32_t*>( data );
+                        K4ALogDebug( "set subordinate delay off master: %u usec", delay );
+                        k4a_device_configuration_t configuration = device_configuration;
+                        configuration.subordinate_delay_off_master_usec = delay;
+                        return reconfigure( configuration );
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_RECORD_PATH:
+                    if( data && dataSize > 0 ){
+                        record_path.assign( reinterpret_cast<const char*>( data ), strnlen( reinterpret_cast<const char*>( data ), dataSize ) );
+                        K4ALogDebug( "set record path: %s", record_path.c_str() );
                         return ONI_STATUS_OK;
                     }
                     break;
+                case K4A_DEVICE_PROPERTY_RECORDING:
+                    if( data && ( dataSize == sizeof( OniBool ) ) ){
+                        const bool is_recording = ( *reinterpret_cast<const OniBool*>( data ) != FALSE );
+                        if( !k4a_capture ){
+                            K4ATraceError( "recording needs at least one stream" );
+                            return ONI_STATUS_ERROR;
+                        }
+                        if( !is_recording ){
+                            k4a_capture->stop_recording();
+                            return ONI_STATUS_OK;
+                        }
+                        if( record_path.empty() ){
+                            K4ATraceError( "record path is not set" );
+                            return ONI_STATUS_ERROR;
+                        }
+                        return k4a_capture->start_recording( record_path ) ? ONI_STATUS_OK : ONI_STATUS_ERROR;
+                    }
+                    break;
                 case ONI_DEVICE_PROPERTY_PLAYBACK_SPEED:
                     if( data && ( dataSize == sizeof( float ) ) ){
+                        // Speed <= 0 plays recording as fast as possible
+                        source->set_speed( *reinterpret_cast<const float*>( data ) );
                         return ONI_STATUS_OK;
                     }
                     break;
                 case ONI_DEVICE_PROPERTY_PLAYBACK_REPEAT_ENABLED:
                     if( data && ( dataSize == sizeof( OniBool ) ) ){
+                        source->set_repeat( *reinterpret_cast<const OniBool*>( data ) != FALSE );
                         return ONI_STATUS_OK;
                     }
                     break;
@@ -146,10 +745,7 @@ namespace oni
             switch( propertyId ){
                 case ONI_DEVICE_PROPERTY_SERIAL_NUMBER:
                     if( data && pDataSize && *pDataSize > 0 ){
-                        const std::string serial_number = device->get_serialnum();
-                        const int32_t n = snprintf( reinterpret_cast<char*>( data ), *pDataSize - 1, "%s", serial_number.c_str() );
-                        *pDataSize = n + 1;
-                        return ONI_STATUS_OK;
+                        return get_string( source->get_serialnum(), data, pDataSize );
                     }
                     break;
                 case ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION:
@@ -160,13 +756,97 @@ namespace oni
                     break;
                 case ONI_DEVICE_PROPERTY_PLAYBACK_SPEED:
                     if( data && pDataSize && *pDataSize == sizeof( float ) ){
-                        *reinterpret_cast<float*>( data ) = 0.0f;
+                        *reinterpret_cast<float*>( data ) = source->get_speed();
                         return ONI_STATUS_OK;
                     }
                     break;
                 case ONI_DEVICE_PROPERTY_PLAYBACK_REPEAT_ENABLED:
                     if( data && pDataSize && *pDataSize == sizeof( OniBool ) ){
-                        *reinterpret_cast<OniBool*>( data ) = TRUE;
+                        // Live device reports repeat for compatibility with previous versions
+                        *reinterpret_cast<OniBool*>( data ) = ( !source->is_playback() || source->get_repeat() ) ? TRUE : FALSE;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_REGISTRATION_ENGINE:
+                    if( data && pDataSize && *pDataSize == sizeof( K4ARegistrationEngine ) ){
+                        *reinterpret_cast<K4ARegistrationEngine*>( data ) = registration_engine;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_COLOR_DECODER:
+                    if( data && pDataSize && *pDataSize == sizeof( K4AColorDecoder ) ){
+                        *reinterpret_cast<K4AColorDecoder*>( data ) = color_decoder;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_DEPTH_FILTER:
+                    if( data && pDataSize && *pDataSize == sizeof( K4ADepthFilterSettings ) ){
+                        *reinterpret_cast<K4ADepthFilterSettings*>( data ) = depth_filter_settings;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_WIRED_SYNC_MODE:
+                    if( data && pDataSize && *pDataSize == sizeof( int32_t ) ){
+                        *reinterpret_cast<int32_t*>( data ) = static_cast<int32_t>( device_configuration.wired_sync_mode );
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_LOG_LEVEL:
+                    if( data && pDataSize && *pDataSize == sizeof( int32_t ) ){
+                        *reinterpret_cast<int32_t*>( data ) = K4ALogger::get_level();
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_DEPTH_DELAY_OFF_COLOR_USEC:
+                    if( data && pDataSize && *pDataSize == sizeof( int32_t ) ){
+                        *reinterpret_cast<int32_t*>( data ) = device_configuration.depth_delay_off_color_usec;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_SUBORDINATE_DELAY_OFF_MASTER_USEC:
+                    if( data && pDataSize && *pDataSize == sizeof( uint32_t ) ){
+                        *reinterpret_cast<uint32_t*>( data ) = device_configuration.subordinate_delay_off_master_usec;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_RECORD_PATH:
+                    if( data && pDataSize && *pDataSize > 0 ){
+                        return get_string( record_path, data, pDataSize );
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_RECORDING:
+                    if( data && pDataSize && *pDataSize == sizeof( OniBool ) ){
+                        *reinterpret_cast<OniBool*>( data ) = ( k4a_capture && k4a_capture->is_recording() ) ? TRUE : FALSE;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_RECORD_STATISTICS:
+                    if( data && pDataSize && *pDataSize == sizeof( K4ARecordStatistics ) ){
+                        K4ARecordStatistics statistics = {};
+                        if( k4a_capture ){
+                            statistics = k4a_capture->get_record_statistics();
+                        }
+                        *reinterpret_cast<K4ARecordStatistics*>( data ) = statistics;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_CAPTURE_STATISTICS:
+                    if( data && pDataSize && *pDataSize == sizeof( K4ACaptureStatistics ) ){
+                        K4ACaptureStatistics statistics = {};
+                        if( k4a_capture ){
+                            statistics = k4a_capture->get_capture_statistics();
+                        }
+                        *reinterpret_cast<K4ACaptureStatistics*>( data ) = statistics;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_DEVICE_PROPERTY_POOL_STATISTICS:
+                    if( data && pDataSize && *pDataSize == sizeof( K4APoolStatistics ) ){
+                        K4APoolStatistics statistics = {};
+                        if( k4a_capture ){
+                            statistics = k4a_capture->get_pool_statistics();
+                        }
+                        *reinterpret_cast<K4APoolStatistics*>( data ) = statistics;
                         return ONI_STATUS_OK;
                     }
                     break;
@@ -198,10 +878,58 @@ namespace oni
                 case ONI_DEVICE_PROPERTY_PLAYBACK_SPEED:
                 case ONI_DEVICE_PROPERTY_PLAYBACK_REPEAT_ENABLED:
                 case XN_MODULE_PROPERTY_AHB:
+                case K4A_DEVICE_PROPERTY_POOL_STATISTICS:
+                case K4A_DEVICE_PROPERTY_REGISTRATION_ENGINE:
+                case K4A_DEVICE_PROPERTY_WIRED_SYNC_MODE:
+                case K4A_DEVICE_PROPERTY_DEPTH_DELAY_OFF_COLOR_USEC:
+                case K4A_DEVICE_PROPERTY_SUBORDINATE_DELAY_OFF_MASTER_USEC:
+                case K4A_DEVICE_PROPERTY_RECORD_PATH:
+                case K4A_DEVICE_PROPERTY_RECORDING:
+                case K4A_DEVICE_PROPERTY_RECORD_STATISTICS:
+                case K4A_DEVICE_PROPERTY_CAPTURE_STATISTICS:
+                case K4A_DEVICE_PROPERTY_LOG_LEVEL:
+                case K4A_DEVICE_PROPERTY_COLOR_DECODER:
+                case K4A_DEVICE_PROPERTY_DEPTH_FILTER:
                     return TRUE;
                 default:
                     return FALSE;
             }
         }
+
+        OniStatus K4ADevice::invoke( int commandId, void* data, int dataSize )
+        {
+            K4ALogDebug( "K4ADevice::invoke : %d", commandId );
+
+            switch( commandId ){
+                case ONI_DEVICE_COMMAND_SEEK:
+                    if( data && ( dataSize == sizeof( OniSeek ) ) ){
+                        if( !source->is_playback() ){
+                            return ONI_STATUS_NOT_SUPPORTED;
+                        }
+                        const OniSeek* seek = reinterpret_cast<const OniSeek*>( data );
+                        if( !k4a_capture ){
+                            return source->seek( seek->frameIndex ) ? ONI_STATUS_OK : ONI_STATUS_ERROR;
+                        }
+                        return k4a_capture->seek( seek->frameIndex ) ? ONI_STATUS_OK : ONI_STATUS_ERROR;
+                    }
+                    return ONI_STATUS_BAD_PARAMETER;
+                default:
+                    break;
+            }
+
+            return ONI_STATUS_NOT_IMPLEMENTED;
+        }
+
+        OniBool K4ADevice::isCommandSupported( int commandId )
+        {
+            K4ALogDebug( "K4ADevice::isCommandSupported : %d", commandId );
+
+            switch( commandId ){
+                case ONI_DEVICE_COMMAND_SEEK:
+                    return source->is_playback() ? TRUE : FALSE;
+                default:
+                    return FALSE;
+            }
+        }
     }
 }
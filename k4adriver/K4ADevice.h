@@ -1,10 +1,18 @@
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include <k4a/k4a.hpp>
 #include <Driver/OniDriverAPI.h>
 
 #include "K4ACapture.h"
 #include "K4AStream.h"
+#include "K4AProperties.h"
+#include "K4ACalibrationTable.h"
+#include "K4APointCloudTable.h"
+#include "K4ASource.h"
 
 namespace oni
 {
@@ -13,7 +21,7 @@ namespace oni
         class K4ADevice : public DeviceBase
         {
             public:
-                K4ADevice( class K4ADriver* k4a_driver, k4a::device* device );
+                K4ADevice( class K4ADriver* k4a_driver, K4ASource* source );
 
                 virtual ~K4ADevice();
 
@@ -29,28 +37,69 @@ namespace oni
 
                 virtual OniBool isPropertySupported( int propertyId );
 
-                virtual OniBool isImageRegistrationModeSupported( OniImageRegistrationMode mode ){ return ( mode == registration_mode ); };
+                virtual OniStatus invoke( int commandId, void* data, int dataSize );
+
+                virtual OniBool isCommandSupported( int commandId );
+
+                virtual OniBool isImageRegistrationModeSupported( OniImageRegistrationMode mode ){ return ( mode == ONI_IMAGE_REGISTRATION_OFF || mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ); };
+
+                OniStatus setVideoMode( OniSensorType sensor_type, const OniVideoMode& video_mode );
+
+                int32_t getFps() const;
+
+                std::shared_ptr<const K4ACalibrationTable> getCalibrationTable();
+
+                std::shared_ptr<const K4APointCloudTable> getPointCloudTable( k4a_calibration_type_t camera );
+
+                void start_cameras();
+
+                void stop_cameras();
 
                 inline class K4ADriver*  getDriver()     { return k4a_driver;  }
                 inline class K4ACapture* getCapture()    { return k4a_capture; }
-                inline k4a::device*      getDevice()     { return device;      }
-                inline k4a::calibration  getCalibration(){ return calibration; }
+                inline K4ASource*        getSource()     { return source.get(); }
+                inline const k4a::calibration& getCalibration() const { return calibration; }
                 inline OniImageRegistrationMode getRegistrationMode() const { return registration_mode; }
+                inline K4ARegistrationEngine getRegistrationEngine() const { return registration_engine; }
+                inline const k4a_device_configuration_t& getDeviceConfiguration() const { return device_configuration; }
+                inline int32_t getColorPixelFormat() const { return color_pixel_format; }
+                inline K4AColorDecoder getColorDecoder() const { return color_decoder; }
 
             protected:
                 K4ADevice( const K4ADevice& );
                 void operator=( const K4ADevice& );
 
+                OniStatus reconfigure( const k4a_device_configuration_t& configuration );
+
+                k4a_image_format_t get_color_format( int32_t pixel_format, k4a_color_resolution_t color_resolution ) const;
+
             protected:
                 class K4ACapture* k4a_capture;
                 class K4ADriver* k4a_driver;
 
-                k4a::device* device;
+                std::unique_ptr<K4ASource> source;
                 k4a::calibration calibration;
+                std::shared_ptr<const K4ACalibrationTable> calibration_table;
+                std::shared_ptr<const K4APointCloudTable> depth_point_cloud_table;
+                std::shared_ptr<const K4APointCloudTable> color_point_cloud_table;
+                std::mutex calibration_table_mutex;
+                uint64_t calibration_generation; // incremented when tables are reset, table built from older calibration is not kept
                 k4a_device_configuration_t device_configuration;
+                bool is_cameras_started;
+                std::mutex cameras_mutex;
+                int32_t color_pixel_format;
+                K4AColorDecoder color_decoder;
+                K4ADepthFilterSettings depth_filter_settings; // applied to capture when it is created
 
                 std::vector<OniSensorInfo> sensors;
+                std::vector<OniVideoMode> color_video_modes;
+                std::vector<OniVideoMode> depth_video_modes;
+                std::vector<OniVideoMode> infrared_video_modes;
+                std::vector<OniVideoMode> point_cloud_video_modes;
+                std::vector<class K4AStream*> streams;
                 OniImageRegistrationMode registration_mode;
+                K4ARegistrationEngine registration_engine;
+                std::string record_path;
         };
     }
 }
@@ -0,0 +1,69 @@
+#include "K4AUtil.h"
+#include "K4ADeviceSource.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        K4ADeviceSource::K4ADeviceSource( k4a::device* device )
+            : device( device )
+        {
+            K4ALogDebug( "K4ADeviceSource::K4ADeviceSource" );
+        }
+
+        K4ADeviceSource::~K4ADeviceSource()
+        {
+            K4ALogDebug( "K4ADeviceSource::~K4ADeviceSource" );
+        }
+
+        std::string K4ADeviceSource::get_serialnum() const
+        {
+            return device->get_serialnum();
+        }
+
+        k4a::calibration K4ADeviceSource::get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const
+        {
+            return device->get_calibration( depth_mode, color_resolution );
+        }
+
+        bool K4ADeviceSource::is_color_format_supported( k4a_image_format_t color_format, k4a_color_resolution_t color_resolution ) const
+        {
+            // Device sends NV12 and YUY2 only at 720p, BGRA32 of higher resolutions is decoded from MJPG by SDK
+            switch( color_format ){
+                case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+                case K4A_IMAGE_FORMAT_COLOR_MJPG:
+                    return true;
+                case K4A_IMAGE_FORMAT_COLOR_NV12:
+                case K4A_IMAGE_FORMAT_COLOR_YUY2:
+                    return ( color_resolution == K4A_COLOR_RESOLUTION_720P );
+                default:
+                    return false;
+            }
+        }
+
+        void K4ADeviceSource::start_cameras( const k4a_device_configuration_t& configuration )
+        {
+            device->start_cameras( &configuration );
+        }
+
+        void K4ADeviceSource::stop_cameras()
+        {
+            device->stop_cameras();
+        }
+
+        bool K4ADeviceSource::get_capture( k4a::capture* capture, std::chrono::milliseconds timeout )
+        {
+            return device->get_capture( capture, timeout );
+        }
+
+        bool K4ADeviceSource::is_sync_in_connected() const
+        {
+            return device->is_sync_in_connected();
+        }
+
+        bool K4ADeviceSource::is_sync_out_connected() const
+        {
+            return device->is_sync_out_connected();
+        }
+    }
+}
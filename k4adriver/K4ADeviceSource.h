@@ -0,0 +1,43 @@
+#pragma once
+
+#include <k4a/k4a.hpp>
+
+#include "K4ASource.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Live Azure Kinect device, k4a::device is owned by K4ADriver
+        class K4ADeviceSource : public K4ASource
+        {
+            public:
+                K4ADeviceSource( k4a::device* device );
+
+                virtual ~K4ADeviceSource();
+
+                virtual std::string get_serialnum() const;
+
+                virtual k4a::calibration get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const;
+
+                virtual bool is_color_format_supported( k4a_image_format_t color_format, k4a_color_resolution_t color_resolution ) const;
+
+                virtual void start_cameras( const k4a_device_configuration_t& configuration );
+
+                virtual void stop_cameras();
+
+                virtual bool get_capture( k4a::capture* capture, std::chrono::milliseconds timeout );
+
+                virtual bool is_sync_in_connected() const;
+
+                virtual bool is_sync_out_connected() const;
+
+            protected:
+                K4ADeviceSource( const K4ADeviceSource& );
+                void operator=( const K4ADeviceSource& );
+
+            protected:
+                k4a::device* device;
+        };
+    }
+}
@@ -1,8 +1,15 @@
 #include "K4AUtil.h"
 #include "K4ADriver.h"
+#include "K4ADeviceSource.h"
+#include "K4APlaybackSource.h"
+#include "K4ASyntheticSource.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <vector>
 
 namespace oni
 {
@@ -18,6 +25,9 @@ namespace oni
         {
             K4ALogDebug( "K4ADriver::~K4ADriver" );
             shutdown();
+
+            // Writer thread must be joined before driver is unloaded
+            K4ALogger::shutdown();
         }
 
         OniStatus K4ADriver::initialize( DeviceConnectedCallback connectedCallback, DeviceDisconnectedCallback disconnectedCallback, DeviceStateChangedCallback deviceStateChangedCallback, void* pCookie )
@@ -30,20 +40,55 @@ namespace oni
                 return result;
             }
 
-            const int32_t device_count = k4a::device::get_installed_count();
+            const uint32_t device_count = k4a::device::get_installed_count();
             if( device_count == 0 ){
-                K4ATraceError( "k4a::device::get_installed_count failed" );
-                return ONI_STATUS_NO_DEVICE;
+                K4ALogDebug( "k4a::device::get_installed_count returned no device" );
+            }
+
+            // Each device is published with its serial number as URI, so URI does not change with order of enumeration
+            for( uint32_t index = 0; index < device_count; index++ ){
+                std::string serial_number;
+                try{
+                    k4a::device device = k4a::device::open( index );
+                    serial_number = device.get_serialnum();
+                }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "k4a::device::open failed - %s", error.what() );
+                    continue;
+                }
+
+                serial_numbers.push_back( serial_number );
+
+                OniDeviceInfo info;
+                strncpy_s( info.uri   , sizeof( info.uri    ), serial_number.c_str(), sizeof( info.uri    ) - 1 );
+                strncpy_s( info.name  , sizeof( info.name   ), "PS1080"             , sizeof( info.name   ) - 1 );
+                strncpy_s( info.vendor, sizeof( info.vendor ), "PrimeSense"         , sizeof( info.vendor ) - 1 );
+                info.usbVendorId  = 7463;
+                info.usbProductId = 1537;
+                deviceConnected( &info );
+                deviceStateChanged( &info, 0 );
             }
 
-            OniDeviceInfo info;
-            strncpy_s( info.uri   , sizeof( info.uri    ), "0"         , sizeof( info.uri    ) - 1 );
-            strncpy_s( info.name  , sizeof( info.name   ), "PS1080"    , sizeof( info.name   ) - 1 );
-            strncpy_s( info.vendor, sizeof( info.vendor ), "PrimeSense", sizeof( info.vendor ) - 1 );
-            info.usbVendorId  = 7463;
-            info.usbProductId = 1537;
-            deviceConnected( &info );
-            deviceStateChanged( &info, 0 );
+            // Synthetic devices are published as synthetic://0, synthetic://1, ... for operation without hardware
+            const char* synthetic_devices = std::getenv( "K4A_SYNTHETIC_DEVICES" );
+            const long synthetic_count = synthetic_devices ? std::strtol( synthetic_devices, nullptr, 10 ) : 0;
+            for( long id = 0; id < synthetic_count; id++ ){
+                const std::string uri = "synthetic://" + std::to_string( id );
+
+                OniDeviceInfo info;
+                strncpy_s( info.uri   , sizeof( info.uri    ), uri.c_str() , sizeof( info.uri    ) - 1 );
+                strncpy_s( info.name  , sizeof( info.name   ), "PS1080"    , sizeof( info.name   ) - 1 );
+                strncpy_s( info.vendor, sizeof( info.vendor ), "PrimeSense", sizeof( info.vendor ) - 1 );
+                info.usbVendorId  = 7463;
+                info.usbProductId = 1537;
+                deviceConnected( &info );
+                deviceStateChanged( &info, 0 );
+            }
+
+            if( serial_numbers.empty() && synthetic_count <= 0 ){
+                K4ATraceError( "no device is found" );
+                return ONI_STATUS_NO_DEVICE;
+            }
 
             K4ALogDebug( "K4ADriver INITIALIZED" );
             return ONI_STATUS_OK;
@@ -53,35 +98,137 @@ namespace oni
         {
             K4ATraceFunc( "" );
 
-            if( device ){
-                device.close();
+            std::lock_guard<std::mutex> lock( devices_mutex );
+            for( auto& device : devices ){
+                if( device.second ){
+                    device.second.close();
+                }
             }
+            devices.clear();
+            device_serial_numbers.clear();
         }
 
         DeviceBase* K4ADriver::deviceOpen( const char* uri, const char* mode )
         {
             K4ATraceFunc( "uri = %s, mode = %s", uri, mode );
 
-            try{
-                if( !device ){
-                    const int32_t index = std::isdigit( *uri ) ? std::stoi( uri ) : K4A_DEVICE_DEFAULT;
-                    device = k4a::device::open( index );
+            std::lock_guard<std::mutex> lock( devices_mutex );
+
+            if( K4APlaybackSource::is_recording( uri ) ){
+                K4ADevice* k4a_device = nullptr;
+                try{
+                    k4a_device = new K4ADevice( this, new K4APlaybackSource( uri ) );
+                }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "k4a::playback::open failed - %s", error.what() );
+                    return nullptr;
+                }
+                opened_devices.push_back( k4a_device );
+                return k4a_device;
+            }
+
+            if( K4ASyntheticSource::is_synthetic( uri ) ){
+                const char* calibration_path = std::getenv( "K4A_SYNTHETIC_CALIBRATION" );
+                const int32_t id = static_cast<int32_t>( std::strtol( uri + std::strlen( "synthetic://" ), nullptr, 10 ) );
+                K4ADevice* k4a_device = nullptr;
+                try{
+                    k4a_device = new K4ADevice( this, new K4ASyntheticSource( id, calibration_path ? calibration_path : "" ) );
                 }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "calibration of synthetic device is invalid - %s", error.what() );
+                    return nullptr;
+                }
+                opened_devices.push_back( k4a_device );
+                return k4a_device;
             }
-            catch( const k4a::error & error ){
-                K4ATraceError( "k4a::device::open failed - %s", error.what() );
+
+            const std::string serial_number = find_serial_number( uri );
+            if( serial_number.empty() ){
+                K4ATraceError( "device %s is not found", uri );
+                return nullptr;
+            }
+
+            // Two K4ADevices on one k4a::device would start and stop cameras of each other
+            if( devices.count( serial_number ) ){
+                K4ATraceError( "device %s is already opened", serial_number.c_str() );
                 return nullptr;
             }
 
-            return new K4ADevice( this, &device );
+            // Index of device may have changed since initialize, so open device whose serial number matches
+            k4a::device device;
+            const uint32_t device_count = k4a::device::get_installed_count();
+            for( uint32_t index = 0; index < device_count && !device; index++ ){
+                try{
+                    k4a::device candidate = k4a::device::open( index );
+                    if( candidate.get_serialnum() == serial_number ){
+                        device = std::move( candidate );
+                    }
+                }
+                catch( const k4a::error& error ){
+                    K4ALogDebug( "k4a::device::open( %u ) failed - %s", index, error.what() );
+                }
+            }
+
+            if( !device ){
+                K4ATraceError( "k4a::device::open failed - %s", serial_number.c_str() );
+                return nullptr;
+            }
+
+            // Elements of std::map are not moved by insertion, so source keeps pointer to device
+            k4a::device& opened_device = devices[serial_number];
+            opened_device = std::move( device );
+
+            K4ADevice* k4a_device = new K4ADevice( this, new K4ADeviceSource( &opened_device ) );
+            device_serial_numbers[k4a_device] = serial_number;
+            opened_devices.push_back( k4a_device );
+            return k4a_device;
         }
 
         void K4ADriver::deviceClose( DeviceBase* pDevice )
         {
             K4ATraceFunc( "" );
 
-            if( pDevice ){
-                delete pDevice;
+            if( !pDevice ){
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock( devices_mutex );
+                opened_devices.erase( std::remove( opened_devices.begin(), opened_devices.end(), pDevice ), opened_devices.end() );
+            }
+
+            // K4ADevice stops cameras through its source, so k4a::device is closed after it is deleted
+            K4ADevice* k4a_device = static_cast<K4ADevice*>( pDevice );
+            delete k4a_device;
+
+            std::lock_guard<std::mutex> lock( devices_mutex );
+            std::map<K4ADevice*, std::string>::iterator serial_number = device_serial_numbers.find( k4a_device );
+            if( serial_number != device_serial_numbers.end() ){
+                std::map<std::string, k4a::device>::iterator device = devices.find( serial_number->second );
+                if( device != devices.end() ){
+                    device->second.close();
+                    devices.erase( device );
+                }
+                device_serial_numbers.erase( serial_number );
+            }
+        }
+
+        void K4ADriver::start_subordinates( K4ADevice* master )
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( devices_mutex );
+            for( K4ADevice* k4a_device : opened_devices ){
+                if( k4a_device == master || k4a_device->getDeviceConfiguration().wired_sync_mode != K4A_WIRED_SYNC_MODE_SUBORDINATE ){
+                    continue;
+                }
+
+                try{
+                    k4a_device->start_cameras();
+                }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "k4a::device::start_cameras of subordinate failed - %s", error.what() );
+                }
             }
         }
 
@@ -89,21 +236,100 @@ namespace oni
         {
             K4ATraceFunc( "uri = %s", uri );
 
-            return ONI_STATUS_OK;
+            // Recording is published as device when OpenNI asks for its path
+            if( K4APlaybackSource::is_recording( uri ) ){
+                try{
+                    k4a::playback playback = k4a::playback::open( uri );
+                }
+                catch( const k4a::error& error ){
+                    K4ATraceError( "k4a::playback::open failed - %s", error.what() );
+                    return ONI_STATUS_ERROR;
+                }
+
+                OniDeviceInfo info;
+                strncpy_s( info.uri   , sizeof( info.uri    ), uri         , sizeof( info.uri    ) - 1 );
+                strncpy_s( info.name  , sizeof( info.name   ), "PS1080"    , sizeof( info.name   ) - 1 );
+                strncpy_s( info.vendor, sizeof( info.vendor ), "PrimeSense", sizeof( info.vendor ) - 1 );
+                info.usbVendorId  = 7463;
+                info.usbProductId = 1537;
+                deviceConnected( &info );
+                deviceStateChanged( &info, 0 );
+                return ONI_STATUS_OK;
+            }
+
+            if( K4ASyntheticSource::is_synthetic( uri ) ){
+                return ONI_STATUS_OK;
+            }
+
+            std::lock_guard<std::mutex> lock( devices_mutex );
+            return find_serial_number( uri ).empty() ? ONI_STATUS_ERROR : ONI_STATUS_OK;
+        }
+
+        std::string K4ADriver::find_serial_number( const char* uri )
+        {
+            if( !uri || !*uri ){
+                return serial_numbers.empty() ? std::string() : serial_numbers[0];
+            }
+
+            if( std::find( serial_numbers.begin(), serial_numbers.end(), uri ) != serial_numbers.end() ){
+                return uri;
+            }
+
+            // Numeric URI is index of device for compatibility with previous versions that published "0"
+            bool is_index = true;
+            for( const char* c = uri; *c; c++ ){
+                is_index &= ( std::isdigit( static_cast<unsigned char>( *c ) ) != 0 );
+            }
+            if( is_index ){
+                const size_t index = static_cast<size_t>( std::strtoul( uri, nullptr, 10 ) );
+                if( index < serial_numbers.size() ){
+                    return serial_numbers[index];
+                }
+            }
+
+            return std::string();
         }
 
         void* K4ADriver::enableFrameSync( StreamBase** pStreams, int streamCount )
         {
-            K4ATraceFunc( "" );
+            K4ATraceFunc( "stream count = %d", streamCount );
 
-            return nullptr;
+            if( !pStreams || streamCount <= 0 ){
+                return nullptr;
+            }
+
+            // All streams of sync group come from one k4a::capture, so they must belong to one device
+            K4ADevice* k4a_device = nullptr;
+            std::vector<OniSensorType> sensor_types;
+            std::vector<K4AFrameQueue*> queues;
+            for( int i = 0; i < streamCount; i++ ){
+                K4AStream* stream = static_cast<K4AStream*>( pStreams[i] );
+                if( k4a_device && stream->getDevice() != k4a_device ){
+                    K4ATraceError( "streams of different devices can not be synchronized" );
+                    return nullptr;
+                }
+                k4a_device = stream->getDevice();
+                sensor_types.push_back( stream->getSensorType() );
+                queues.push_back( stream->getQueue() );
+            }
+
+            K4AFrameSyncGroup* group = new K4AFrameSyncGroup;
+            group->k4a_device = k4a_device;
+            group->id         = k4a_device->getCapture()->enable_frame_sync( sensor_types.data(), queues.data(), streamCount );
+            return group;
         }
 
         void K4ADriver::disableFrameSync( void* frameSyncGroup )
         {
             K4ATraceFunc( "" );
 
-            return;
+            K4AFrameSyncGroup* group = reinterpret_cast<K4AFrameSyncGroup*>( frameSyncGroup );
+            if( !group ){
+                return;
+            }
+
+            group->k4a_device->getCapture()->disable_frame_sync( group->id );
+            delete group;
         }
     }
 }
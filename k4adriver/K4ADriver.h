@@ -1,5 +1,10 @@
 #pragma once
 
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <k4a/k4a.hpp>
 #include <Driver/OniDriverAPI.h>
 
@@ -9,6 +14,13 @@ namespace oni
 {
     namespace driver
     {
+        // Handle of frame sync group that is passed to OpenNI
+        struct K4AFrameSyncGroup
+        {
+            class K4ADevice* k4a_device;
+            int32_t id;
+        };
+
         class K4ADriver : public DriverBase
         {
             public:
@@ -30,12 +42,23 @@ namespace oni
 
                 virtual void disableFrameSync( void* frameSyncGroup );
 
+                void start_subordinates( class K4ADevice* master );
+
             protected:
                 K4ADriver( const K4ADriver& );
                 void operator=( const K4ADriver& );
 
+            private:
+                std::string find_serial_number( const char* uri );
+
             protected:
-                k4a::device device;
+                // Devices are identified by serial number, index of k4a::device::open may change when devices are plugged
+                std::vector<std::string> serial_numbers;
+                // Device is opened by one K4ADevice at a time, and is closed when that K4ADevice is closed
+                std::map<std::string, k4a::device> devices;
+                std::map<class K4ADevice*, std::string> device_serial_numbers;
+                std::vector<class K4ADevice*> opened_devices;
+                std::mutex devices_mutex;
         };
     }
 }
@@ -0,0 +1,243 @@
+#include "K4AUtil.h"
+#include "K4AFrameQueue.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace oni
+{
+    namespace driver
+    {
+        K4AFrameQueue::K4AFrameQueue( size_t capacity, K4AQueuePolicy policy )
+            : capacity( 0 ),
+              slot_count( 0 ),
+              policy( policy ),
+              enqueue_position( 0 ),
+              dequeue_position( 0 ),
+              is_open( false ),
+              dropped( 0 ),
+              waiting_consumers( 0 ),
+              waiting_producers( 0 )
+        {
+            configure( capacity, policy );
+        }
+
+        K4AFrameQueue::~K4AFrameQueue()
+        {
+            close();
+        }
+
+        void K4AFrameQueue::configure( size_t capacity, K4AQueuePolicy policy )
+        {
+            // Latest only is drop oldest with one slot, so consumer never sees a frame that has a newer one behind it
+            this->policy   = policy;
+            this->capacity = ( policy == K4A_QUEUE_POLICY_LATEST_ONLY ) ? 1 : std::min<size_t>( std::max<size_t>( capacity, 1 ), MAX_QUEUE_SIZE );
+
+            // Sequence of freed slot would equal sequence of filled slot in ring of one slot, so ring has at least two slots
+            slot_count = std::max<size_t>( this->capacity, 2 );
+            slots.reset( new Slot[slot_count] );
+            for( size_t index = 0; index < slot_count; index++ ){
+                slots[index].sequence.store( index, std::memory_order_relaxed );
+            }
+            enqueue_position = 0;
+            dequeue_position = 0;
+        }
+
+        bool K4AFrameQueue::push( K4AFrame& frame, std::chrono::milliseconds timeout )
+        {
+            frame.stage_times.queue = std::chrono::steady_clock::now();
+            const std::chrono::steady_clock::time_point deadline = frame.stage_times.queue + timeout;
+
+            while( is_open ){
+                if( try_push( frame ) ){
+                    notify_consumer();
+                    return true;
+                }
+
+                if( policy == K4A_QUEUE_POLICY_BLOCK ){
+                    waiting_producers++;
+                    bool has_waited;
+                    {
+                        std::unique_lock<std::mutex> lock( mutex );
+                        has_waited = not_full.wait_until( lock, deadline, [this]{ return has_space() || !is_open; } );
+                    }
+                    waiting_producers--;
+
+                    if( !has_waited ){
+                        return false;
+                    }
+                }
+                else{
+                    // Slot can still be read by consumer that has already claimed it, then there is nothing to drop yet
+                    K4AFrame oldest;
+                    if( try_pop( oldest ) ){
+                        dropped++;
+                    }
+                    else{
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        bool K4AFrameQueue::try_push( K4AFrame& frame )
+        {
+            size_t position = enqueue_position.load( std::memory_order_relaxed );
+            while( true ){
+                Slot& slot = slots[position % slot_count];
+                const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>( slot.sequence.load( std::memory_order_acquire ) - position );
+                if( difference == 0 ){
+                    if( position - dequeue_position.load( std::memory_order_acquire ) >= capacity ){
+                        return false;
+                    }
+                    if( enqueue_position.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ){
+                        slot.frame = std::move( frame );
+                        slot.sequence.store( position + 1, std::memory_order_release );
+                        return true;
+                    }
+                }
+                else if( difference < 0 ){
+                    return false;
+                }
+                else{
+                    position = enqueue_position.load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+        bool K4AFrameQueue::try_pop( K4AFrame& frame )
+        {
+            size_t position = dequeue_position.load( std::memory_order_relaxed );
+            while( true ){
+                Slot& slot = slots[position % slot_count];
+                const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>( slot.sequence.load( std::memory_order_acquire ) - ( position + 1 ) );
+                if( difference == 0 ){
+                    if( dequeue_position.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ){
+                        frame = std::move( slot.frame );
+                        slot.sequence.store( position + slot_count, std::memory_order_release );
+                        return true;
+                    }
+                }
+                else if( difference < 0 ){
+                    return false;
+                }
+                else{
+                    position = dequeue_position.load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+        bool K4AFrameQueue::drop_oldest( int32_t* index )
+        {
+            K4AFrame frame;
+            if( !try_pop( frame ) ){
+                return false;
+            }
+
+            dropped++;
+            *index = frame.index;
+            return true;
+        }
+
+        bool K4AFrameQueue::drop_frame( int32_t index )
+        {
+            // Only producer writes slots, so index of filled slot can be read before it is claimed
+            size_t position = dequeue_position.load( std::memory_order_relaxed );
+            Slot& slot = slots[position % slot_count];
+            if( slot.sequence.load( std::memory_order_acquire ) != position + 1 || slot.frame.index != index ){
+                return false;
+            }
+            if( !dequeue_position.compare_exchange_strong( position, position + 1, std::memory_order_relaxed ) ){
+                return false;
+            }
+
+            K4AFrame frame = std::move( slot.frame );
+            slot.sequence.store( position + slot_count, std::memory_order_release );
+            dropped++;
+            return true;
+        }
+
+        bool K4AFrameQueue::wait_pop( K4AFrame& frame, std::chrono::milliseconds timeout )
+        {
+            if( !try_pop( frame ) ){
+                // Waiting count is published before the frame is checked under mutex, so producer either sees it or consumer sees the frame
+                waiting_consumers++;
+                {
+                    std::unique_lock<std::mutex> lock( mutex );
+                    not_empty.wait_for( lock, timeout, [this]{ return has_frame() || !is_open; } );
+                }
+                waiting_consumers--;
+
+                if( !try_pop( frame ) ){
+                    return false;
+                }
+            }
+
+            notify_producer();
+            return true;
+        }
+
+        void K4AFrameQueue::open()
+        {
+            is_open = true;
+        }
+
+        void K4AFrameQueue::close()
+        {
+            is_open = false;
+            clear();
+
+            std::lock_guard<std::mutex> lock( mutex );
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+        void K4AFrameQueue::clear()
+        {
+            K4AFrame frame;
+            while( try_pop( frame ) ){
+            }
+
+            notify_producer();
+        }
+
+        size_t K4AFrameQueue::size() const
+        {
+            const size_t dequeue = dequeue_position.load();
+            const size_t enqueue = enqueue_position.load();
+            return ( enqueue > dequeue ) ? std::min( enqueue - dequeue, capacity ) : 0;
+        }
+
+        bool K4AFrameQueue::has_frame() const
+        {
+            const size_t position = dequeue_position.load();
+            return slots[position % slot_count].sequence.load( std::memory_order_acquire ) == position + 1;
+        }
+
+        bool K4AFrameQueue::has_space() const
+        {
+            const size_t position = enqueue_position.load();
+            return position - dequeue_position.load() < capacity && slots[position % slot_count].sequence.load( std::memory_order_acquire ) == position;
+        }
+
+        void K4AFrameQueue::notify_consumer()
+        {
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            if( waiting_consumers > 0 ){
+                std::lock_guard<std::mutex> lock( mutex );
+                not_empty.notify_one();
+            }
+        }
+
+        void K4AFrameQueue::notify_producer()
+        {
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            if( waiting_producers > 0 ){
+                std::lock_guard<std::mutex> lock( mutex );
+                not_full.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <k4a/k4a.hpp>
+#include <Driver/OniDriverAPI.h>
+
+#include "K4AProperties.h"
+
+#define DEFAULT_QUEUE_SIZE 3
+#define MAX_QUEUE_SIZE 64
+
+namespace oni
+{
+    namespace driver
+    {
+        // Host times of stages that frame passed through in driver, used for measuring latency
+        struct K4AStageTimes
+        {
+            std::chrono::steady_clock::time_point capture; // k4a::capture was returned by source
+            std::chrono::steady_clock::time_point queue;   // frame was pushed into queue of stream
+            std::chrono::steady_clock::time_point dequeue; // frame was popped by stream thread
+            std::chrono::steady_clock::time_point convert; // frame was converted into OniFrame
+        };
+
+        struct K4AFrame
+        {
+            k4a::image image;
+            std::chrono::microseconds time_stamp;
+            int32_t index; // index of k4a::capture that frame was extracted from, shared by all sensors of the capture
+            K4AStageTimes stage_times;
+            OniCropping filled_region = OniCropping(); // region that registration filled, whole image when it is not enabled
+        };
+
+        // Frames of all sensors that were extracted from one k4a::capture
+        struct K4AFrameSet
+        {
+            K4AFrame color;
+            K4AFrame depth;
+            K4AFrame infrared;
+        };
+
+        // Bounded frame queue between capture thread (producer) and stream thread (consumer).
+        // Slots are preallocated and frames are passed without locks, the producer also pops when it drops the oldest frame.
+        // Mutex is taken only to sleep and to wake up the other side, when consumer waits for frame or producer waits for space.
+        class K4AFrameQueue
+        {
+            public:
+                K4AFrameQueue( size_t capacity, K4AQueuePolicy policy );
+
+                ~K4AFrameQueue();
+
+                // Reallocates slots, must not be called while producer or consumer uses the queue
+                void configure( size_t capacity, K4AQueuePolicy policy );
+
+                // Returns false when queue is closed, or blocking queue stayed full until timeout, frame is kept then
+                bool push( K4AFrame& frame, std::chrono::milliseconds timeout );
+
+                bool try_pop( K4AFrame& frame );
+
+                bool wait_pop( K4AFrame& frame, std::chrono::milliseconds timeout );
+
+                // Producer side drops, counted as dropped frames. Frame that consumer has already claimed is not dropped.
+                bool drop_oldest( int32_t* index );
+
+                bool drop_frame( int32_t index );
+
+                void open();
+
+                void close();
+
+                void clear();
+
+                size_t size() const;
+
+                inline bool is_opened() const { return is_open; }
+
+                inline bool is_full() const { return !has_space(); }
+
+                inline size_t get_capacity() const { return capacity; }
+
+                inline K4AQueuePolicy get_policy() const { return policy; }
+
+                inline uint64_t get_dropped() const { return dropped.load(); }
+
+            protected:
+                K4AFrameQueue( const K4AFrameQueue& );
+                void operator=( const K4AFrameQueue& );
+
+                bool try_push( K4AFrame& frame );
+
+                bool has_frame() const;
+
+                bool has_space() const;
+
+                void notify_consumer();
+
+                void notify_producer();
+
+            protected:
+                // Sequence of slot tells whether it is free for producer ( == position ) or filled for consumer ( == position + 1 )
+                struct Slot
+                {
+                    std::atomic<size_t> sequence;
+                    K4AFrame frame;
+                };
+
+                std::unique_ptr<Slot[]> slots;
+                size_t capacity;
+                size_t slot_count;
+                K4AQueuePolicy policy;
+                std::atomic<size_t> enqueue_position;
+                std::atomic<size_t> dequeue_position;
+
+                std::atomic_bool is_open;
+                std::atomic<uint64_t> dropped;
+
+                std::atomic_int waiting_consumers;
+                std::atomic_int waiting_producers;
+                std::mutex mutex;
+                std::condition_variable not_empty;
+                std::condition_variable not_full;
+        };
+    }
+}
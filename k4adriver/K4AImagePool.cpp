@@ -0,0 +1,139 @@
+#include "K4AUtil.h"
+#include "K4AImagePool.h"
+
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace oni
+{
+    namespace driver
+    {
+        K4AImagePool::K4AImagePool()
+            : storage( std::make_shared<Storage>() ),
+              format( K4A_IMAGE_FORMAT_CUSTOM ),
+              width( 0 ),
+              height( 0 ),
+              stride( 0 ),
+              hits( 0 ),
+              misses( 0 )
+        {
+            storage->generation = 0;
+            storage->capacity   = 0;
+        }
+
+        K4AImagePool::~K4AImagePool()
+        {
+            release();
+        }
+
+        void K4AImagePool::configure( k4a_image_format_t format, int32_t width, int32_t height, int32_t stride, size_t capacity )
+        {
+            release();
+
+            this->format = format;
+            this->width  = width;
+            this->height = height;
+            this->stride = stride;
+
+            // Nothing is allocated up front, pool grows to number of buffers that are in flight at once
+            std::lock_guard<std::mutex> lock( storage->mutex );
+            storage->capacity = capacity;
+        }
+
+        void K4AImagePool::release()
+        {
+            // Buffers still referenced by images are freed by release_buffer() because their generation no longer matches.
+            std::lock_guard<std::mutex> lock( storage->mutex );
+            for( Block* block : storage->blocks ){
+                free_block( block );
+            }
+            storage->blocks.clear();
+            storage->capacity = 0;
+            storage->generation++;
+        }
+
+        k4a::image K4AImagePool::acquire()
+        {
+            const size_t size = static_cast<size_t>( stride ) * height;
+
+            Block* block = nullptr;
+            bool hit = false;
+            {
+                std::lock_guard<std::mutex> lock( storage->mutex );
+                if( !storage->blocks.empty() ){
+                    block = storage->blocks.back();
+                    storage->blocks.pop_back();
+                    hit = true;
+                }
+                else{
+                    block = allocate_block( storage, size );
+                }
+            }
+
+            if( hit ){
+                hits++;
+            }
+            else{
+                misses++;
+            }
+
+            if( !block->buffer ){
+                free_block( block );
+                return k4a::image();
+            }
+
+            return k4a::image::create_from_buffer( format, width, height, stride, block->buffer, size, &K4AImagePool::release_buffer, block );
+        }
+
+        K4APoolStatistics K4AImagePool::get_statistics() const
+        {
+            K4APoolStatistics statistics;
+            statistics.hits   = hits.load();
+            statistics.misses = misses.load();
+            return statistics;
+        }
+
+        K4AImagePool::Block* K4AImagePool::allocate_block( const std::shared_ptr<Storage>& storage, size_t size )
+        {
+            const size_t aligned_size = ( size + CACHE_LINE_SIZE - 1 ) & ~static_cast<size_t>( CACHE_LINE_SIZE - 1 );
+
+            Block* block = new Block();
+            block->storage    = storage;
+            block->generation = storage->generation;
+            #ifdef _WIN32
+            block->buffer = reinterpret_cast<uint8_t*>( _aligned_malloc( aligned_size, CACHE_LINE_SIZE ) );
+            #else
+            void* buffer = nullptr;
+            block->buffer = ( posix_memalign( &buffer, CACHE_LINE_SIZE, aligned_size ) == 0 ) ? reinterpret_cast<uint8_t*>( buffer ) : nullptr;
+            #endif
+            return block;
+        }
+
+        void K4AImagePool::free_block( Block* block )
+        {
+            #ifdef _WIN32
+            _aligned_free( block->buffer );
+            #else
+            free( block->buffer );
+            #endif
+            delete block;
+        }
+
+        void K4AImagePool::release_buffer( void*, void* context )
+        {
+            Block* block = reinterpret_cast<Block*>( context );
+            std::shared_ptr<Storage> storage = block->storage;
+
+            std::lock_guard<std::mutex> lock( storage->mutex );
+            if( block->generation == storage->generation && storage->blocks.size() < storage->capacity ){
+                storage->blocks.push_back( block );
+                return;
+            }
+
+            free_block( block );
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+
+#include "K4AProperties.h"
+
+#define CACHE_LINE_SIZE 64
+
+namespace oni
+{
+    namespace driver
+    {
+        // Pool of cache-line aligned buffers handed out as k4a::image.
+        // Buffers are allocated on demand, and the buffer returns to the pool when the last reference of the image is released.
+        // Pool keeps up to capacity buffers, buffers beyond it are freed.
+        class K4AImagePool
+        {
+            public:
+                K4AImagePool();
+
+                ~K4AImagePool();
+
+                void configure( k4a_image_format_t format, int32_t width, int32_t height, int32_t stride, size_t capacity );
+
+                void release();
+
+                k4a::image acquire();
+
+                K4APoolStatistics get_statistics() const;
+
+            protected:
+                K4AImagePool( const K4AImagePool& );
+                void operator=( const K4AImagePool& );
+
+            private:
+                struct Storage;
+
+                struct Block
+                {
+                    std::shared_ptr<Storage> storage;
+                    uint64_t generation;
+                    uint8_t* buffer;
+                };
+
+                struct Storage
+                {
+                    std::mutex mutex;
+                    std::vector<Block*> blocks;
+                    uint64_t generation;
+                    size_t capacity;
+                };
+
+                static Block* allocate_block( const std::shared_ptr<Storage>& storage, size_t size );
+
+                static void free_block( Block* block );
+
+                static void release_buffer( void* buffer, void* context );
+
+            protected:
+                std::shared_ptr<Storage> storage;
+
+                k4a_image_format_t format;
+                int32_t width;
+                int32_t height;
+                int32_t stride;
+
+                std::atomic<uint64_t> hits;
+                std::atomic<uint64_t> misses;
+        };
+    }
+}
@@ -0,0 +1,134 @@
+#include "K4AUtil.h"
+#include "K4AJpegDecoder.h"
+
+#ifdef K4A_WITH_JPEG
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+// Number of rows that are requested from libjpeg at once
+#define DECODE_BATCH_ROWS 16
+
+namespace oni
+{
+    namespace driver
+    {
+#ifdef K4A_WITH_JPEG
+        namespace
+        {
+            struct ErrorManager
+            {
+                jpeg_error_mgr manager;
+                std::jmp_buf jump;
+            };
+
+            // libjpeg exits process on error by default, error returns to decode instead
+            void error_exit( j_common_ptr info )
+            {
+                std::longjmp( reinterpret_cast<ErrorManager*>( info->err )->jump, 1 );
+            }
+
+            void output_message( j_common_ptr info )
+            {
+                char message[JMSG_LENGTH_MAX];
+                ( *info->err->format_message )( info, message );
+                K4ALogDebug( "libjpeg: %s", message );
+            }
+        }
+
+        struct K4AJpegDecoder::Context
+        {
+            jpeg_decompress_struct info;
+            ErrorManager error;
+        };
+
+        K4AJpegDecoder::K4AJpegDecoder()
+            : context( new Context() )
+        {
+            K4ALogDebug( "K4AJpegDecoder::K4AJpegDecoder" );
+
+            context->info.err = jpeg_std_error( &context->error.manager );
+            context->error.manager.error_exit     = &error_exit;
+            context->error.manager.output_message = &output_message;
+            jpeg_create_decompress( &context->info );
+        }
+
+        K4AJpegDecoder::~K4AJpegDecoder()
+        {
+            K4ALogDebug( "K4AJpegDecoder::~K4AJpegDecoder" );
+
+            jpeg_destroy_decompress( &context->info );
+        }
+
+        bool K4AJpegDecoder::is_available()
+        {
+            return true;
+        }
+
+        bool K4AJpegDecoder::decode( const k4a::image& image, uint8_t* destination, int32_t stride )
+        {
+            jpeg_decompress_struct& info = context->info;
+            if( setjmp( context->error.jump ) ){
+                jpeg_abort_decompress( &info );
+                return false;
+            }
+
+            jpeg_mem_src( &info, const_cast<uint8_t*>( image.get_buffer() ), static_cast<unsigned long>( image.get_size() ) );
+            if( jpeg_read_header( &info, TRUE ) != JPEG_HEADER_OK ){
+                jpeg_abort_decompress( &info );
+                return false;
+            }
+
+            // Fast DCT and upsampling, like TJFLAG_FASTDCT and TJFLAG_FASTUPSAMPLE of TurboJPEG
+            info.out_color_space     = JCS_RGB;
+            info.dct_method          = JDCT_IFAST;
+            info.do_fancy_upsampling = FALSE;
+
+            jpeg_start_decompress( &info );
+            if( static_cast<int32_t>( info.output_width ) != image.get_width_pixels() || static_cast<int32_t>( info.output_height ) != image.get_height_pixels() || info.output_components != 3 ){
+                jpeg_abort_decompress( &info );
+                return false;
+            }
+
+            JSAMPROW rows[DECODE_BATCH_ROWS];
+            while( info.output_scanline < info.output_height ){
+                const JDIMENSION count = std::min<JDIMENSION>( DECODE_BATCH_ROWS, info.output_height - info.output_scanline );
+                for( JDIMENSION row = 0; row < count; row++ ){
+                    rows[row] = destination + static_cast<size_t>( info.output_scanline + row ) * stride;
+                }
+                jpeg_read_scanlines( &info, rows, count );
+            }
+
+            jpeg_finish_decompress( &info );
+            return true;
+        }
+#else
+        struct K4AJpegDecoder::Context
+        {
+        };
+
+        K4AJpegDecoder::K4AJpegDecoder()
+            : context( new Context() )
+        {
+            K4ALogDebug( "K4AJpegDecoder::K4AJpegDecoder" );
+        }
+
+        K4AJpegDecoder::~K4AJpegDecoder()
+        {
+            K4ALogDebug( "K4AJpegDecoder::~K4AJpegDecoder" );
+        }
+
+        bool K4AJpegDecoder::is_available()
+        {
+            return false;
+        }
+
+        bool K4AJpegDecoder::decode( const k4a::image&, uint8_t*, int32_t )
+        {
+            return false;
+        }
+#endif
+    }
+}
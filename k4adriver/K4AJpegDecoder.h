@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <k4a/k4a.hpp>
+
+namespace oni
+{
+    namespace driver
+    {
+        // Decoder of MJPG color image that writes RGB888 directly, without intermediate BGRA32 of SDK.
+        // One decoder is not thread safe, each worker of decode pool owns its decoder.
+        // Decoding is only available when driver is built with libjpeg-turbo (K4A_WITH_JPEG).
+        class K4AJpegDecoder
+        {
+            public:
+                K4AJpegDecoder();
+
+                ~K4AJpegDecoder();
+
+                static bool is_available();
+
+                // Returns false when image is corrupt or its size is not size of image
+                bool decode( const k4a::image& image, uint8_t* destination, int32_t stride );
+
+            protected:
+                K4AJpegDecoder( const K4AJpegDecoder& );
+                void operator=( const K4AJpegDecoder& );
+
+            private:
+                struct Context;
+
+            protected:
+                std::unique_ptr<Context> context;
+        };
+    }
+}
@@ -0,0 +1,184 @@
+#include "K4ALogger.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            int32_t read_environment_level()
+            {
+                const char* value = std::getenv( "K4ADRIVER_LOG_LEVEL" );
+                if( !value || !*value ){
+                    return K4A_LOG_LEVEL_ERROR;
+                }
+
+                if( std::isdigit( static_cast<unsigned char>( *value ) ) ){
+                    return std::atoi( value );
+                }
+
+                std::string name( value );
+                for( char& character : name ){
+                    character = static_cast<char>( std::tolower( static_cast<unsigned char>( character ) ) );
+                }
+                if( name == "none" ){
+                    return K4A_LOG_LEVEL_NONE;
+                }
+                if( name == "debug" ){
+                    return K4A_LOG_LEVEL_DEBUG;
+                }
+                if( name == "trace" ){
+                    return K4A_LOG_LEVEL_TRACE;
+                }
+                return K4A_LOG_LEVEL_ERROR;
+            }
+        }
+
+        std::atomic<int32_t> K4ALogger::runtime_level( read_environment_level() );
+
+        K4ALogger::K4ALogger()
+            : enqueue_position( 0 ),
+              dequeue_position( 0 ),
+              dropped( 0 ),
+              is_running( false )
+        {
+            for( uint32_t index = 0; index < LOG_RING_SIZE; index++ ){
+                slots[index].sequence.store( index, std::memory_order_relaxed );
+            }
+        }
+
+        K4ALogger::~K4ALogger()
+        {
+            shutdown();
+        }
+
+        K4ALogger& K4ALogger::instance()
+        {
+            static K4ALogger logger;
+            return logger;
+        }
+
+        void K4ALogger::set_level( int32_t level )
+        {
+            runtime_level = level;
+        }
+
+        int32_t K4ALogger::get_level()
+        {
+            return runtime_level;
+        }
+
+        void K4ALogger::write( const char* format, ... )
+        {
+            K4ALogger& logger = instance();
+            if( !logger.is_running ){
+                logger.start();
+            }
+
+            // Claim a free slot, message is dropped instead of waiting when writer falls behind
+            uint32_t position = logger.enqueue_position.load( std::memory_order_relaxed );
+            Slot* slot = nullptr;
+            while( true ){
+                slot = &logger.slots[position % LOG_RING_SIZE];
+                const int32_t difference = static_cast<int32_t>( slot->sequence.load( std::memory_order_acquire ) - position );
+                if( difference == 0 ){
+                    if( logger.enqueue_position.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ){
+                        break;
+                    }
+                }
+                else if( difference < 0 ){
+                    logger.dropped++;
+                    return;
+                }
+                else{
+                    position = logger.enqueue_position.load( std::memory_order_relaxed );
+                }
+            }
+
+            va_list arguments;
+            va_start( arguments, format );
+            const int length = std::vsnprintf( slot->message, LOG_MESSAGE_SIZE, format, arguments );
+            va_end( arguments );
+
+            // Truncated message still ends line
+            if( length >= LOG_MESSAGE_SIZE ){
+                slot->message[LOG_MESSAGE_SIZE - 2] = '\n';
+            }
+
+            slot->sequence.store( position + 1, std::memory_order_release );
+        }
+
+        void K4ALogger::shutdown()
+        {
+            K4ALogger& logger = instance();
+
+            std::lock_guard<std::mutex> lock( logger.thread_mutex );
+            logger.is_running = false;
+            if( logger.thread.joinable() ){
+                logger.thread.join();
+            }
+        }
+
+        void K4ALogger::start()
+        {
+            std::lock_guard<std::mutex> lock( thread_mutex );
+            if( is_running ){
+                return;
+            }
+
+            is_running = true;
+            thread = std::thread( &K4ALogger::writer_thread, this );
+        }
+
+        void K4ALogger::writer_thread()
+        {
+            // Producers never signal writer, so that enabled log costs no system call on caller
+            while( is_running ){
+                if( !write_pending() ){
+                    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+                }
+            }
+
+            while( write_pending() ){
+            }
+            std::fflush( stdout );
+        }
+
+        bool K4ALogger::write_pending()
+        {
+            bool is_written = false;
+
+            while( true ){
+                Slot& slot = slots[dequeue_position % LOG_RING_SIZE];
+                if( slot.sequence.load( std::memory_order_acquire ) != dequeue_position + 1 ){
+                    break;
+                }
+
+                std::fputs( slot.message, stdout );
+                slot.sequence.store( dequeue_position + LOG_RING_SIZE, std::memory_order_release );
+                dequeue_position++;
+                is_written = true;
+            }
+
+            const uint64_t dropped_messages = dropped.exchange( 0 );
+            if( dropped_messages > 0 ){
+                std::printf( "[K4A] %llu log messages were dropped\n", static_cast<unsigned long long>( dropped_messages ) );
+                is_written = true;
+            }
+
+            if( is_written ){
+                std::fflush( stdout );
+            }
+
+            return is_written;
+        }
+    }
+}
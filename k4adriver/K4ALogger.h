@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Levels of log, also values of K4A_DEVICE_PROPERTY_LOG_LEVEL
+#define K4A_LOG_LEVEL_NONE  0
+#define K4A_LOG_LEVEL_ERROR 1
+#define K4A_LOG_LEVEL_DEBUG 2
+#define K4A_LOG_LEVEL_TRACE 3
+
+// Messages above this level are removed at compile time
+#ifndef K4A_LOG_LEVEL
+#define K4A_LOG_LEVEL K4A_LOG_LEVEL_TRACE
+#endif
+
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 256
+
+namespace oni
+{
+    namespace driver
+    {
+        // Leveled logger of driver.
+        // Disabled level costs one relaxed load. Enabled message is formatted into a slot of lock-free ring by caller,
+        // and written to stdout by writer thread, so caller never waits for console. Messages are dropped and counted when ring is full.
+        // Level at start is read from environment variable K4ADRIVER_LOG_LEVEL ( none, error, debug, trace or number ), default is error.
+        class K4ALogger
+        {
+            public:
+                static inline bool is_enabled( int32_t level ) { return level <= runtime_level.load( std::memory_order_relaxed ); }
+
+                static void set_level( int32_t level );
+
+                static int32_t get_level();
+
+                static void write( const char* format, ... );
+
+                // Writes pending messages and stops writer thread, writer thread starts again with next message
+                static void shutdown();
+
+            private:
+                K4ALogger();
+
+                ~K4ALogger();
+
+                K4ALogger( const K4ALogger& );
+                void operator=( const K4ALogger& );
+
+                static K4ALogger& instance();
+
+                void start();
+
+                void writer_thread();
+
+                bool write_pending();
+
+            private:
+                static std::atomic<int32_t> runtime_level;
+
+                // Bounded MPSC ring, sequence of slot tells whether it is free for producer or filled for writer
+                struct Slot
+                {
+                    std::atomic<uint32_t> sequence;
+                    char message[LOG_MESSAGE_SIZE];
+                };
+
+                Slot slots[LOG_RING_SIZE];
+                std::atomic<uint32_t> enqueue_position;
+                uint32_t dequeue_position;
+                std::atomic<uint64_t> dropped;
+
+                std::mutex thread_mutex;
+                std::thread thread;
+                std::atomic_bool is_running;
+        };
+    }
+}
@@ -0,0 +1,180 @@
+#include "K4AUtil.h"
+#include "K4APipeline.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        K4APipeline::K4APipeline()
+            : max_pending( 0 ),
+              is_emitting( false ),
+              is_stopping( false ),
+              claimed_jobs( 0 ),
+              prepared_jobs( 0 ),
+              dropped( 0 )
+        {
+        }
+
+        K4APipeline::~K4APipeline()
+        {
+            stop();
+        }
+
+        void K4APipeline::start( size_t workers, size_t max_pending, Prepare prepare, Process process, Emit emit, Drop drop )
+        {
+            K4ATraceFunc( "workers = %d", static_cast<int32_t>( workers ) );
+
+            stop();
+
+            this->prepare     = prepare;
+            this->process     = process;
+            this->emit        = emit;
+            this->drop        = drop;
+            this->max_pending = max_pending;
+            is_stopping       = false;
+            claimed_jobs      = 0;
+            prepared_jobs     = 0;
+
+            for( size_t worker = 0; worker < workers; worker++ ){
+                threads.push_back( std::thread( &K4APipeline::worker_thread, this, worker ) );
+            }
+        }
+
+        void K4APipeline::stop()
+        {
+            if( threads.empty() ){
+                return;
+            }
+
+            K4ATraceFunc( "" );
+
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                is_stopping = true;
+            }
+            condition.notify_all();
+            prepared.notify_all();
+
+            for( std::thread& thread : threads ){
+                thread.join();
+            }
+            threads.clear();
+
+            jobs.clear();
+            is_emitting = false;
+        }
+
+        bool K4APipeline::submit( K4AFrameSet&& frame_set )
+        {
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+
+                // Drop oldest frame set that is not processed yet, it keeps its slot until it reaches front so that the order is preserved
+                size_t active = 0;
+                for( const Job& job : jobs ){
+                    if( job.state != JOB_DROPPED ){
+                        active++;
+                    }
+                }
+
+                if( active >= max_pending ){
+                    dropped++;
+
+                    Job* pending_job = nullptr;
+                    for( Job& job : jobs ){
+                        if( job.state == JOB_PENDING ){
+                            pending_job = &job;
+                            break;
+                        }
+                    }
+
+                    if( !pending_job ){
+                        drop( frame_set );
+                        return false;
+                    }
+
+                    drop( pending_job->frame_set );
+                    pending_job->state     = JOB_DROPPED;
+                    pending_job->frame_set = K4AFrameSet();
+                }
+
+                Job job;
+                job.frame_set = std::move( frame_set );
+                job.state     = JOB_PENDING;
+                jobs.push_back( std::move( job ) );
+            }
+
+            condition.notify_one();
+            return true;
+        }
+
+        void K4APipeline::worker_thread( size_t worker )
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+
+            while( true ){
+                Job* pending_job = nullptr;
+                condition.wait( lock, [&]{
+                    if( is_stopping ){
+                        return true;
+                    }
+                    for( Job& job : jobs ){
+                        if( job.state == JOB_PENDING ){
+                            pending_job = &job;
+                            return true;
+                        }
+                    }
+                    return false;
+                } );
+
+                if( is_stopping ){
+                    return;
+                }
+
+                // References to elements of std::deque stay valid while other elements are pushed to back or popped from front
+                pending_job->state = JOB_RUNNING;
+                const uint64_t ticket = claimed_jobs++;
+
+                if( prepare ){
+                    prepared.wait( lock, [&]{ return is_stopping || prepared_jobs == ticket; } );
+                    if( is_stopping ){
+                        return;
+                    }
+                    lock.unlock();
+                    prepare( pending_job->frame_set );
+                    lock.lock();
+                    prepared_jobs++;
+                    prepared.notify_all();
+                }
+
+                lock.unlock();
+                process( pending_job->frame_set, worker );
+                lock.lock();
+                pending_job->state = JOB_DONE;
+
+                emit_done_jobs( lock );
+            }
+        }
+
+        void K4APipeline::emit_done_jobs( std::unique_lock<std::mutex>& lock )
+        {
+            // Only one worker emits at a time, other workers just finish their job and the emitting worker picks it up
+            if( is_emitting ){
+                return;
+            }
+
+            is_emitting = true;
+            while( !jobs.empty() && !is_stopping && ( jobs.front().state == JOB_DONE || jobs.front().state == JOB_DROPPED ) ){
+                Job job = std::move( jobs.front() );
+                jobs.pop_front();
+
+                if( job.state == JOB_DONE ){
+                    lock.unlock();
+                    emit( job.frame_set );
+                    lock.lock();
+                }
+            }
+            is_emitting = false;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "K4AFrameQueue.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Ordered worker pool for per-frame processing that is too expensive for capture thread.
+        // Frame sets are prepared one at a time in the order they were submitted, then processed in parallel and emitted in the order they were submitted.
+        class K4APipeline
+        {
+            public:
+                typedef std::function<void( K4AFrameSet& frame_set )> Prepare; // stage that depends on previous frame sets, such as temporal filter
+                typedef std::function<void( K4AFrameSet& frame_set, size_t worker )> Process;
+                typedef std::function<void( K4AFrameSet& frame_set )> Emit;
+                typedef std::function<void( const K4AFrameSet& frame_set )> Drop; // called with lock held, must not block
+
+                K4APipeline();
+
+                ~K4APipeline();
+
+                void start( size_t workers, size_t max_pending, Prepare prepare, Process process, Emit emit, Drop drop );
+
+                void stop();
+
+                bool submit( K4AFrameSet&& frame_set );
+
+                inline bool is_running() const { return !threads.empty(); }
+
+                inline uint64_t get_dropped() const { return dropped.load(); }
+
+            protected:
+                K4APipeline( const K4APipeline& );
+                void operator=( const K4APipeline& );
+
+            private:
+                enum JobState
+                {
+                    JOB_PENDING,
+                    JOB_RUNNING,
+                    JOB_DONE,
+                    JOB_DROPPED
+                };
+
+                struct Job
+                {
+                    K4AFrameSet frame_set;
+                    JobState state;
+                };
+
+                void worker_thread( size_t worker );
+
+                void emit_done_jobs( std::unique_lock<std::mutex>& lock );
+
+            protected:
+                Prepare prepare;
+                Process process;
+                Emit emit;
+                Drop drop;
+                size_t max_pending;
+
+                std::mutex mutex;
+                std::condition_variable condition;
+                std::deque<Job> jobs;
+                bool is_emitting;
+                bool is_stopping;
+
+                // Jobs are claimed in order of submission, and each one is prepared after preparation of previously claimed job
+                std::condition_variable prepared;
+                uint64_t claimed_jobs;
+                uint64_t prepared_jobs;
+
+                std::vector<std::thread> threads;
+                std::atomic<uint64_t> dropped;
+        };
+    }
+}
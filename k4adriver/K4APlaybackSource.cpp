@@ -0,0 +1,251 @@
+#include "K4AUtil.h"
+#include "K4APlaybackSource.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace oni
+{
+    namespace driver
+    {
+        K4APlaybackSource::K4APlaybackSource( const std::string& path )
+            : is_started( false ),
+              speed( 1.0f ),
+              repeat( true ),
+              pending_time_stamp( 0 ),
+              has_origin( false ),
+              origin_time_stamp( 0 )
+        {
+            K4ALogDebug( "K4APlaybackSource::K4APlaybackSource" );
+
+            playback = k4a::playback::open( path.c_str() );
+            record_configuration = playback.get_record_configuration();
+            calibration = playback.get_calibration();
+
+            // Streams expect same color format as live device
+            if( record_configuration.color_track_enabled && record_configuration.color_format != K4A_IMAGE_FORMAT_COLOR_BGRA32 ){
+                playback.set_color_conversion( K4A_IMAGE_FORMAT_COLOR_BGRA32 );
+            }
+
+            if( !playback.get_tag( "K4A_DEVICE_SERIAL_NUMBER", &serial_number ) ){
+                serial_number = path;
+            }
+        }
+
+        K4APlaybackSource::~K4APlaybackSource()
+        {
+            K4ALogDebug( "K4APlaybackSource::~K4APlaybackSource" );
+
+            stop_cameras();
+        }
+
+        bool K4APlaybackSource::is_recording( const char* uri )
+        {
+            if( !uri ){
+                return false;
+            }
+
+            std::string extension( uri );
+            const size_t position = extension.find_last_of( '.' );
+            if( position == std::string::npos ){
+                return false;
+            }
+
+            extension = extension.substr( position );
+            std::transform( extension.begin(), extension.end(), extension.begin(), []( char c ){ return static_cast<char>( std::tolower( static_cast<unsigned char>( c ) ) ); } );
+            return ( extension == ".mkv" );
+        }
+
+        std::string K4APlaybackSource::get_serialnum() const
+        {
+            return serial_number;
+        }
+
+        k4a::calibration K4APlaybackSource::get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const
+        {
+            if( depth_mode != record_configuration.depth_mode || color_resolution != record_configuration.color_resolution ){
+                throw k4a::error( "mode is not available in recording" );
+            }
+
+            return calibration;
+        }
+
+        bool K4APlaybackSource::is_color_mode_supported( k4a_color_resolution_t color_resolution, k4a_fps_t fps ) const
+        {
+            return ( color_resolution == record_configuration.color_resolution && fps == record_configuration.camera_fps );
+        }
+
+        bool K4APlaybackSource::is_depth_mode_supported( k4a_depth_mode_t depth_mode, k4a_fps_t fps ) const
+        {
+            return ( depth_mode == record_configuration.depth_mode && fps == record_configuration.camera_fps );
+        }
+
+        void K4APlaybackSource::get_default_configuration( k4a_device_configuration_t& configuration ) const
+        {
+            configuration.color_format     = K4A_IMAGE_FORMAT_COLOR_BGRA32;
+            configuration.color_resolution = record_configuration.color_resolution;
+            configuration.depth_mode       = record_configuration.depth_mode;
+            configuration.camera_fps       = record_configuration.camera_fps;
+        }
+
+        void K4APlaybackSource::start_cameras( const k4a_device_configuration_t& configuration )
+        {
+            K4ATraceFunc( "" );
+
+            if( configuration.color_resolution != record_configuration.color_resolution
+                || configuration.depth_mode != record_configuration.depth_mode
+                || configuration.camera_fps != record_configuration.camera_fps ){
+                throw k4a::error( "mode is not available in recording" );
+            }
+
+            std::lock_guard<std::mutex> lock( mutex );
+            is_started = true;
+            has_origin = false;
+            condition.notify_all();
+        }
+
+        void K4APlaybackSource::stop_cameras()
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            is_started = false;
+            condition.notify_all();
+        }
+
+        bool K4APlaybackSource::get_capture( k4a::capture* capture, std::chrono::milliseconds timeout )
+        {
+            const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + ( ( timeout.count() < 0 ) ? std::chrono::milliseconds( std::chrono::hours( 24 ) ) : timeout );
+
+            std::unique_lock<std::mutex> lock( mutex );
+            while( std::chrono::steady_clock::now() < deadline ){
+                // Nothing to release while stopped or at end of recording without repeat, wait for start or seek
+                if( !is_started || ( !pending_capture && !read_next_capture() ) ){
+                    condition.wait_until( lock, deadline );
+                    continue;
+                }
+
+                if( !has_origin ){
+                    origin_time       = std::chrono::steady_clock::now();
+                    origin_time_stamp = pending_time_stamp;
+                    has_origin        = true;
+                }
+
+                std::chrono::steady_clock::time_point release_time = origin_time;
+                if( speed > 0.0f ){
+                    const std::chrono::duration<double, std::micro> elapsed( static_cast<double>( ( pending_time_stamp - origin_time_stamp ).count() ) / speed );
+                    release_time += std::chrono::duration_cast<std::chrono::steady_clock::duration>( elapsed );
+                }
+
+                if( std::chrono::steady_clock::now() >= release_time ){
+                    *capture = std::move( pending_capture );
+                    pending_capture.reset();
+                    return true;
+                }
+
+                condition.wait_until( lock, std::min( release_time, deadline ) );
+            }
+
+            return false;
+        }
+
+        bool K4APlaybackSource::read_next_capture()
+        {
+            try{
+                if( !playback.get_next_capture( &pending_capture ) ){
+                    if( !repeat ){
+                        return false;
+                    }
+
+                    // Loop back to beginning, time stamps restart from beginning too
+                    playback.seek_timestamp( std::chrono::microseconds( 0 ), K4A_PLAYBACK_SEEK_BEGIN );
+                    has_origin = false;
+                    if( !playback.get_next_capture( &pending_capture ) ){
+                        return false;
+                    }
+                }
+            }
+            catch( const k4a::error& error ){
+                K4ATraceError( "k4a::playback::get_next_capture failed - %s", error.what() );
+                pending_capture.reset();
+                return false;
+            }
+
+            k4a::image image = pending_capture.get_depth_image();
+            if( !image ){
+                image = pending_capture.get_color_image();
+            }
+            if( !image ){
+                image = pending_capture.get_ir_image();
+            }
+            pending_time_stamp = image ? image.get_device_timestamp() : pending_time_stamp;
+
+            return true;
+        }
+
+        void K4APlaybackSource::set_speed( float speed )
+        {
+            K4ATraceFunc( "speed = %f", speed );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            this->speed = speed;
+            has_origin  = false;
+            condition.notify_all();
+        }
+
+        float K4APlaybackSource::get_speed() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            return speed;
+        }
+
+        void K4APlaybackSource::set_repeat( bool repeat )
+        {
+            K4ATraceFunc( "repeat = %d", repeat );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            this->repeat = repeat;
+            condition.notify_all();
+        }
+
+        bool K4APlaybackSource::get_repeat() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            return repeat;
+        }
+
+        bool K4APlaybackSource::seek( int32_t frame_index )
+        {
+            K4ATraceFunc( "frame index = %d", frame_index );
+
+            int32_t fps;
+            switch( record_configuration.camera_fps ){
+                case K4A_FRAMES_PER_SECOND_5:
+                    fps = 5;
+                    break;
+                case K4A_FRAMES_PER_SECOND_15:
+                    fps = 15;
+                    break;
+                case K4A_FRAMES_PER_SECOND_30:
+                default:
+                    fps = 30;
+                    break;
+            }
+
+            std::lock_guard<std::mutex> lock( mutex );
+            try{
+                const std::chrono::microseconds offset( static_cast<int64_t>( std::max( frame_index, 0 ) ) * 1000000 / fps );
+                playback.seek_timestamp( offset, K4A_PLAYBACK_SEEK_BEGIN );
+            }
+            catch( const k4a::error& error ){
+                K4ATraceError( "k4a::playback::seek_timestamp failed - %s", error.what() );
+                return false;
+            }
+
+            pending_capture.reset();
+            has_origin = false;
+            condition.notify_all();
+            return true;
+        }
+    }
+}
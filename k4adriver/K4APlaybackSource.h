@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include <k4a/k4a.hpp>
+#include <k4arecord/playback.hpp>
+
+#include "K4ASource.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Recording of k4arecorder (.mkv) that is played as device.
+        // Captures are released at time stamps of recording scaled by speed, speed <= 0 releases them as fast as possible.
+        class K4APlaybackSource : public K4ASource
+        {
+            public:
+                K4APlaybackSource( const std::string& path );
+
+                virtual ~K4APlaybackSource();
+
+                static bool is_recording( const char* uri );
+
+                virtual std::string get_serialnum() const;
+
+                virtual k4a::calibration get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const;
+
+                virtual bool is_color_mode_supported( k4a_color_resolution_t color_resolution, k4a_fps_t fps ) const;
+
+                virtual bool is_depth_mode_supported( k4a_depth_mode_t depth_mode, k4a_fps_t fps ) const;
+
+                virtual void get_default_configuration( k4a_device_configuration_t& configuration ) const;
+
+                virtual void start_cameras( const k4a_device_configuration_t& configuration );
+
+                virtual void stop_cameras();
+
+                virtual bool get_capture( k4a::capture* capture, std::chrono::milliseconds timeout );
+
+                virtual bool is_playback() const { return true; }
+
+                virtual void set_speed( float speed );
+
+                virtual float get_speed() const;
+
+                virtual void set_repeat( bool repeat );
+
+                virtual bool get_repeat() const;
+
+                virtual bool seek( int32_t frame_index );
+
+            protected:
+                K4APlaybackSource( const K4APlaybackSource& );
+                void operator=( const K4APlaybackSource& );
+
+            private:
+                bool read_next_capture();
+
+            protected:
+                k4a::playback playback;
+                k4a_record_configuration_t record_configuration;
+                k4a::calibration calibration;
+                std::string serial_number;
+
+                mutable std::mutex mutex;
+                std::condition_variable condition;
+                bool is_started;
+                float speed;
+                bool repeat;
+
+                // Capture that was read from recording but is not released yet
+                k4a::capture pending_capture;
+                std::chrono::microseconds pending_time_stamp;
+
+                // Wall clock time and recording time stamp that release times are measured from
+                bool has_origin;
+                std::chrono::steady_clock::time_point origin_time;
+                std::chrono::microseconds origin_time_stamp;
+        };
+    }
+}
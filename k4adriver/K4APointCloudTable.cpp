@@ -0,0 +1,138 @@
+#include "K4AUtil.h"
+#include "K4APointCloudTable.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+#if defined( _M_X64 ) || defined( __x86_64__ ) || defined( __SSE2__ )
+#define K4A_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace oni
+{
+    namespace driver
+    {
+        K4APointCloudTable::K4APointCloudTable( const k4a::calibration& calibration, k4a_calibration_type_t camera )
+            : camera( camera )
+        {
+            K4ALogDebug( "K4APointCloudTable::K4APointCloudTable" );
+
+            const k4a_calibration_camera_t& camera_calibration = ( camera == K4A_CALIBRATION_TYPE_COLOR ) ? calibration.color_camera_calibration : calibration.depth_camera_calibration;
+            width  = camera_calibration.resolution_width;
+            height = camera_calibration.resolution_height;
+
+            const size_t size = static_cast<size_t>( width ) * height;
+            ray_x.assign( size, 0.0f );
+            ray_y.assign( size, 0.0f );
+            ray_z.assign( size, 0.0f );
+
+            // Table of color camera has up to 12M pixels, rows are unprojected in parallel
+            concurrency::parallel_for( 0, height, [&]( int32_t y ){
+                for( int32_t x = 0; x < width; x++ ){
+                    k4a_float2_t point2d;
+                    point2d.xy.x = static_cast<float>( x );
+                    point2d.xy.y = static_cast<float>( y );
+                    k4a_float3_t ray;
+                    if( !calibration.convert_2d_to_3d( point2d, 1.0f, camera, camera, &ray ) ){
+                        continue;
+                    }
+
+                    const size_t index = static_cast<size_t>( y ) * width + x;
+                    ray_x[index] = ray.xyz.x;
+                    ray_y[index] = ray.xyz.y;
+                    ray_z[index] = 1.0f;
+                }
+            } );
+        }
+
+        K4APointCloudTable::~K4APointCloudTable()
+        {
+            K4ALogDebug( "K4APointCloudTable::~K4APointCloudTable" );
+        }
+
+        void K4APointCloudTable::unproject( const uint16_t* depth, K4APointXYZFloat* points, size_t begin, size_t end ) const
+        {
+            const float* rx = &ray_x[0];
+            const float* ry = &ray_y[0];
+            const float* rz = &ray_z[0];
+            float* output = reinterpret_cast<float*>( points );
+
+            size_t i = begin;
+            size_t j = 0;
+
+            #ifdef K4A_TABLE_SSE2
+            for( ; i + 4 <= end; i += 4, j += 4 ){
+                const __m128i depth_u16 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( depth + i ) );
+                const __m128 d = _mm_cvtepi32_ps( _mm_unpacklo_epi16( depth_u16, _mm_setzero_si128() ) );
+                const __m128 x = _mm_mul_ps( d, _mm_loadu_ps( rx + i ) );
+                const __m128 y = _mm_mul_ps( d, _mm_loadu_ps( ry + i ) );
+                const __m128 z = _mm_mul_ps( d, _mm_loadu_ps( rz + i ) );
+
+                // Interleave x, y and z of 4 points into 3 vectors
+                const __m128 xy_low  = _mm_unpacklo_ps( x, y );
+                const __m128 xy_high = _mm_unpackhi_ps( x, y );
+                const __m128 z0z0x1x1 = _mm_shuffle_ps( z, xy_low, _MM_SHUFFLE( 2, 2, 0, 0 ) );
+                const __m128 y1y1z1z1 = _mm_shuffle_ps( xy_low, z, _MM_SHUFFLE( 1, 1, 3, 3 ) );
+                const __m128 z2z2x3x3 = _mm_shuffle_ps( z, xy_high, _MM_SHUFFLE( 2, 2, 2, 2 ) );
+                const __m128 y3y3z3z3 = _mm_shuffle_ps( xy_high, z, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+                _mm_storeu_ps( output + j * 3 + 0, _mm_shuffle_ps( xy_low  , z0z0x1x1, _MM_SHUFFLE( 2, 0, 1, 0 ) ) );
+                _mm_storeu_ps( output + j * 3 + 4, _mm_shuffle_ps( y1y1z1z1, xy_high , _MM_SHUFFLE( 1, 0, 2, 0 ) ) );
+                _mm_storeu_ps( output + j * 3 + 8, _mm_shuffle_ps( z2z2x3x3, y3y3z3z3, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+            }
+            #endif
+
+            for( ; i < end; i++, j++ ){
+                const float d = static_cast<float>( depth[i] );
+                points[j].x = d * rx[i];
+                points[j].y = d * ry[i];
+                points[j].z = d * rz[i];
+            }
+        }
+
+        void K4APointCloudTable::unproject( const uint16_t* depth, K4APointXYZInt16* points, size_t begin, size_t end ) const
+        {
+            const float* rx = &ray_x[0];
+            const float* ry = &ray_y[0];
+            const float* rz = &ray_z[0];
+
+            size_t i = begin;
+            size_t j = 0;
+
+            #ifdef K4A_TABLE_SSE2
+            for( ; i + 4 <= end; i += 4, j += 4 ){
+                const __m128i depth_u16 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( depth + i ) );
+                const __m128 d = _mm_cvtepi32_ps( _mm_unpacklo_epi16( depth_u16, _mm_setzero_si128() ) );
+                const __m128i x = _mm_cvtps_epi32( _mm_mul_ps( d, _mm_loadu_ps( rx + i ) ) );
+                const __m128i y = _mm_cvtps_epi32( _mm_mul_ps( d, _mm_loadu_ps( ry + i ) ) );
+                const __m128i z = _mm_cvtps_epi32( _mm_mul_ps( d, _mm_loadu_ps( rz + i ) ) );
+
+                // Saturated to int16, then scattered into points
+                int16_t xy[8];
+                int16_t zz[8];
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( xy ), _mm_packs_epi32( x, y ) );
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( zz ), _mm_packs_epi32( z, z ) );
+                for( size_t k = 0; k < 4; k++ ){
+                    points[j + k].x = xy[k];
+                    points[j + k].y = xy[k + 4];
+                    points[j + k].z = zz[k];
+                }
+            }
+            #endif
+
+            for( ; i < end; i++, j++ ){
+                const float d = static_cast<float>( depth[i] );
+                points[j].x = static_cast<int16_t>( std::max( -32768.0f, std::min( 32767.0f, std::nearbyint( d * rx[i] ) ) ) );
+                points[j].y = static_cast<int16_t>( std::max( -32768.0f, std::min( 32767.0f, std::nearbyint( d * ry[i] ) ) ) );
+                points[j].z = static_cast<int16_t>( std::min( 32767.0f, d * rz[i] ) );
+            }
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+
+#include "K4AProperties.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Per-pixel rays of one camera derived once from k4a::calibration of the current mode.
+        // Point of pixel is
+        //   point = depth * ray
+        // where depth is depth image of the camera (registered depth for color camera).
+        class K4APointCloudTable
+        {
+            public:
+                K4APointCloudTable( const k4a::calibration& calibration, k4a_calibration_type_t camera );
+
+                ~K4APointCloudTable();
+
+                inline k4a_calibration_type_t get_camera() const { return camera; }
+                inline int32_t get_width() const { return width; }
+                inline int32_t get_height() const { return height; }
+
+                // Unproject depth pixels [begin, end) of organized point cloud, points receives end - begin points
+                void unproject( const uint16_t* depth, K4APointXYZFloat* points, size_t begin, size_t end ) const;
+
+                void unproject( const uint16_t* depth, K4APointXYZInt16* points, size_t begin, size_t end ) const;
+
+            protected:
+                K4APointCloudTable( const K4APointCloudTable& );
+                void operator=( const K4APointCloudTable& );
+
+            protected:
+                k4a_calibration_type_t camera;
+                int32_t width;
+                int32_t height;
+
+                // Rays at 1 mm depth, ray_z is 1 for pixels with ray and 0 for pixels out of lens
+                std::vector<float> ray_x;
+                std::vector<float> ray_y;
+                std::vector<float> ray_z;
+        };
+    }
+}
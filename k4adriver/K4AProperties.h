@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+
+// Custom Properties of K4ADriver
+// These identifiers are placed in a range that is not used by OpenNI2 or PS1080 properties.
+enum
+{
+    K4A_DEVICE_PROPERTY_POOL_STATISTICS                   = 0x1080F001, // K4APoolStatistics (get)
+    K4A_DEVICE_PROPERTY_REGISTRATION_ENGINE               = 0x1080F002, // K4ARegistrationEngine (get/set)
+    K4A_DEVICE_PROPERTY_WIRED_SYNC_MODE                   = 0x1080F003, // int32_t, k4a_wired_sync_mode_t (get/set)
+    K4A_DEVICE_PROPERTY_DEPTH_DELAY_OFF_COLOR_USEC        = 0x1080F004, // int32_t (get/set)
+    K4A_DEVICE_PROPERTY_SUBORDINATE_DELAY_OFF_MASTER_USEC = 0x1080F005, // uint32_t, only applied in subordinate mode (get/set)
+    K4A_DEVICE_PROPERTY_RECORD_PATH                       = 0x1080F006, // char[], path of recording file (get/set)
+    K4A_DEVICE_PROPERTY_RECORDING                         = 0x1080F007, // OniBool, start/stop recording to K4A_DEVICE_PROPERTY_RECORD_PATH (get/set)
+    K4A_DEVICE_PROPERTY_RECORD_STATISTICS                 = 0x1080F008, // K4ARecordStatistics (get)
+    K4A_DEVICE_PROPERTY_CAPTURE_STATISTICS                = 0x1080F009, // K4ACaptureStatistics (get)
+    K4A_DEVICE_PROPERTY_LOG_LEVEL                         = 0x1080F00A, // int32_t, 0 none / 1 error / 2 debug / 3 trace, shared by all devices (get/set)
+    K4A_DEVICE_PROPERTY_DEPTH_FILTER                      = 0x1080F00B, // K4ADepthFilterSettings, applied to depth of all depth and point cloud streams of device (get/set)
+    K4A_DEVICE_PROPERTY_COLOR_DECODER                     = 0x1080F00C, // K4AColorDecoder, restarts cameras (get/set)
+};
+
+// Custom Properties of K4ADriver (stream)
+enum
+{
+    K4A_STREAM_PROPERTY_STATISTICS   = 0x1080F201, // K4AStreamStatistics (get)
+    K4A_STREAM_PROPERTY_QUEUE_POLICY = 0x1080F202, // K4AQueuePolicy, restarts running stream (get/set)
+    K4A_STREAM_PROPERTY_QUEUE_DEPTH  = 0x1080F203, // int32_t, 1 to 64 frames, restarts running stream (get/set)
+};
+
+// Custom Commands of K4ADriver (depth stream)
+enum
+{
+    K4A_STREAM_COMMAND_DEPTH_IMAGE_TO_COLOR_COORDINATES  = 0x1080F101, // K4ADepthImageToColorCoordinates
+    K4A_STREAM_COMMAND_DEPTH_POINTS_TO_COLOR_COORDINATES = 0x1080F102, // K4ADepthPointsToColorCoordinates
+};
+
+// Custom Sensor of K4ADriver
+// Organized point cloud computed from depth, in color camera when image registration is depth to color.
+enum
+{
+    K4A_SENSOR_POINT_CLOUD = 0x1080F301,
+};
+
+// Custom Pixel Formats of K4ADriver (point cloud sensor)
+enum
+{
+    K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT = 0x1080F401, // K4APointXYZFloat
+    K4A_PIXEL_FORMAT_POINT_XYZ_INT16 = 0x1080F402, // K4APointXYZInt16
+};
+
+// Custom Pixel Formats of K4ADriver (color sensor)
+// Color is delivered as sent by device without conversion, OpenNI formats ONI_PIXEL_FORMAT_YUYV and ONI_PIXEL_FORMAT_JPEG are also delivered as is.
+// Cropping and mirroring are only applied to ONI_PIXEL_FORMAT_RGB888.
+enum
+{
+    K4A_PIXEL_FORMAT_BGRA32 = 0x1080F403, // 4 bytes per pixel in order B, G, R, A
+    K4A_PIXEL_FORMAT_NV12   = 0x1080F404, // Y plane of width * height bytes followed by interleaved UV plane of width * height / 2 bytes
+};
+
+// Points are in millimeter, pixels without depth get ( 0, 0, 0 )
+struct K4APointXYZFloat
+{
+    float x;
+    float y;
+    float z;
+};
+
+struct K4APointXYZInt16
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+enum K4ARegistrationEngine
+{
+    K4A_REGISTRATION_ENGINE_SDK   = 0, // k4a::transformation (default)
+    K4A_REGISTRATION_ENGINE_TABLE = 1, // precomputed tables in driver, falls back to SDK if tables are not available
+};
+
+// Decoder of RGB888 color, other pixel formats of color are always delivered as sent by device
+enum K4AColorDecoder
+{
+    K4A_COLOR_DECODER_SDK  = 0, // SDK decodes MJPG to BGRA32 in its single thread, stream converts it to RGB888 (default)
+    K4A_COLOR_DECODER_POOL = 1, // pool of decoder threads of driver decodes MJPG directly to RGB888, needs driver built with libjpeg-turbo,
+                                // falls back to SDK for sources that can not deliver MJPG such as recordings
+};
+
+enum K4AQueuePolicy
+{
+    K4A_QUEUE_POLICY_DROP_OLDEST = 0, // oldest frame is dropped when queue is full (default)
+    K4A_QUEUE_POLICY_LATEST_ONLY = 1, // queue holds only newest frame, for consumers that need freshness
+    K4A_QUEUE_POLICY_BLOCK       = 2, // capture waits for space in queue, for consumers that need every frame such as recording
+};
+
+enum K4AHoleFilling
+{
+    K4A_HOLE_FILLING_NONE            = 0, // holes are kept (default)
+    K4A_HOLE_FILLING_FROM_LEFT       = 1, // hole takes depth of nearest valid pixel on its left
+    K4A_HOLE_FILLING_FARTHEST_AROUND = 2, // hole takes farthest depth of valid pixels around it
+    K4A_HOLE_FILLING_NEAREST_AROUND  = 3, // hole takes nearest depth of valid pixels around it
+};
+
+// Filters are applied in order spatial, temporal, hole filling to depth of device, one frame at a time in order of capture by first stage of pipeline.
+// Registered depth and point cloud are computed from filtered depth, recording keeps depth as delivered by device.
+// Pixels without depth are never averaged with valid pixels, steps larger than delta are kept as edges.
+struct K4ADepthFilterSettings
+{
+    int32_t spatial_iterations;   // 0 disables spatial filter (default), up to 5 passes of edge preserving smoothing
+    float spatial_alpha;          // 0.25 to 1, weight of pixel against its smoothed neighbor, 1 disables smoothing (default 0.5)
+    int32_t spatial_delta;        // 1 to 65535 mm (default 20)
+    int32_t temporal;             // 0 disables temporal filter (default), 1 averages each pixel with its history
+    float temporal_alpha;         // over 0 up to 1, weight of current frame, 1 disables averaging (default 0.4)
+    int32_t temporal_delta;       // 1 to 65535 mm (default 20)
+    int32_t temporal_persistence; // 0 to 8, missing pixel is filled from history when it was valid in this many of last 8 frames, 0 never fills (default 3)
+    int32_t hole_filling;         // K4AHoleFilling
+};
+
+struct K4APoolStatistics
+{
+    uint64_t hits;   // buffers served from the pool
+    uint64_t misses; // buffers allocated because no free buffer was in the pool, pools grow on demand
+};
+
+struct K4ARecordStatistics
+{
+    uint64_t written_frames;
+    uint64_t dropped_frames; // frames dropped because writer could not keep up or failed to write
+    uint64_t written_bytes;
+};
+
+// Counters are cumulative since the device was opened, compare two reads to get rates.
+struct K4ACaptureStatistics
+{
+    uint64_t captures;              // captures returned by source
+    uint64_t capture_timeouts;      // waits for capture that returned nothing
+    uint64_t dropped_sync;          // frame sets in which a frame sync group lacked a member of started stream
+    uint64_t dropped_registration;  // frame sets dropped because registration or decoding of color could not keep up
+    uint64_t time_stamp_gaps;       // captures missing between device time stamps of consecutive captures
+};
+
+#define K4A_LATENCY_HISTOGRAM_BINS 16
+
+// Counters are cumulative since the device was opened, except queue depth and latency histogram.
+// Latency is measured from capture returned by source until frame is delivered to OpenNI,
+// histogram counts recent frames, bin i holds latencies in [ 2^(i+6), 2^(i+7) ) usec ( first bin also holds shorter, last bin also holds longer ).
+struct K4AStreamStatistics
+{
+    uint64_t captured_frames;       // frames extracted from captures for this stream
+    uint64_t delivered_frames;      // frames delivered to OpenNI
+    uint64_t dropped_queue_full;    // frames dropped because stream did not consume queue in time
+    uint64_t dropped_sync;          // frames held back from sync group because another member of the group was missing
+    uint64_t dropped_registration;  // frames dropped because registration or decoding of color could not keep up
+    uint64_t time_stamp_gaps;       // frames missing between device time stamps of consecutive frames
+    uint64_t queue_depth;           // frames waiting in queue
+    uint32_t latency_histogram[K4A_LATENCY_HISTOGRAM_BINS];
+};
+
+// Map whole depth image of current depth mode to color image coordinates.
+// Outputs are width * height arrays, pixels that can not be mapped get -1.
+struct K4ADepthImageToColorCoordinates
+{
+    const uint16_t* depth; // depth image
+    int32_t width;         // must be same as depth video mode
+    int32_t height;        // must be same as depth video mode
+    float* color_x;
+    float* color_y;
+};
+
+// Map list of depth pixels to color image coordinates.
+// Outputs are count arrays, points that can not be mapped get -1.
+struct K4ADepthPointsToColorCoordinates
+{
+    const int32_t* depth_x;
+    const int32_t* depth_y;
+    const uint16_t* depth_z;
+    float* color_x;
+    float* color_y;
+    uint32_t count;
+};
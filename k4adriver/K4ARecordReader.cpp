@@ -0,0 +1,190 @@
+#include "K4AUtil.h"
+#include "K4ARecordReader.h"
+
+#include <cstring>
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            uint64_t align( uint64_t size )
+            {
+                return ( size + RECORD_ALIGNMENT - 1 ) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+            }
+
+            // Recordings easily exceed 2 GB, so offsets are 64 bit on every platform
+            bool seek( std::FILE* file, uint64_t offset, int origin )
+            {
+            #ifdef _WIN32
+                return ( _fseeki64( file, static_cast<__int64>( offset ), origin ) == 0 );
+            #else
+                return ( fseeko( file, static_cast<off_t>( offset ), origin ) == 0 );
+            #endif
+            }
+
+            int64_t tell( std::FILE* file )
+            {
+            #ifdef _WIN32
+                return static_cast<int64_t>( _ftelli64( file ) );
+            #else
+                return static_cast<int64_t>( ftello( file ) );
+            #endif
+            }
+        }
+
+        K4ARecordReader::K4ARecordReader()
+            : file( nullptr ),
+              has_index( false )
+        {
+            K4ALogDebug( "K4ARecordReader::K4ARecordReader" );
+        }
+
+        K4ARecordReader::~K4ARecordReader()
+        {
+            K4ALogDebug( "K4ARecordReader::~K4ARecordReader" );
+
+            close();
+        }
+
+        bool K4ARecordReader::open( const std::string& path )
+        {
+            K4ATraceFunc( "path = %s", path.c_str() );
+
+            close();
+
+            file = std::fopen( path.c_str(), "rb" );
+            if( !file ){
+                K4ATraceError( "failed to open %s", path.c_str() );
+                return false;
+            }
+
+            int64_t file_size = -1;
+            if( seek( file, 0, SEEK_END ) ){
+                file_size = tell( file );
+            }
+
+            K4ARecordFileHeader header = {};
+            if( file_size < static_cast<int64_t>( sizeof( header ) ) || !read( 0, &header, sizeof( header ) ) || std::memcmp( header.magic, "K4AREC\0\0", sizeof( header.magic ) ) != 0 || header.version != 1 ){
+                K4ATraceError( "%s is not a recording of K4ADriver", path.c_str() );
+                close();
+                return false;
+            }
+
+            has_index = read_index( static_cast<uint64_t>( file_size ) );
+            if( !has_index ){
+                K4ALogDebug( "recording has no index, chunks are scanned" );
+                index.clear();
+                if( !scan_chunks( static_cast<uint64_t>( file_size ) ) ){
+                    K4ATraceError( "failed to read chunks of %s", path.c_str() );
+                    close();
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        void K4ARecordReader::close()
+        {
+            if( file ){
+                std::fclose( file );
+                file = nullptr;
+            }
+            has_index = false;
+            index.clear();
+        }
+
+        bool K4ARecordReader::read_frame( size_t entry, K4ARecordFrameHeader& header, std::vector<uint8_t>& data )
+        {
+            if( !file || entry >= index.size() ){
+                return false;
+            }
+
+            const K4ARecordIndexEntry& index_entry = index[entry];
+            if( !read( index_entry.offset, &header, sizeof( header ) ) || header.index != index_entry.index || header.sensor_type != index_entry.sensor_type ){
+                return false;
+            }
+
+            data.resize( static_cast<size_t>( header.size ) );
+            return data.empty() || read( index_entry.offset + sizeof( header ), &data[0], data.size() );
+        }
+
+        bool K4ARecordReader::read_index( uint64_t file_size )
+        {
+            // Footer is written last, recording that was not stopped cleanly ends in middle of chunk or index
+            K4ARecordFileFooter footer = {};
+            if( file_size < sizeof( K4ARecordFileHeader ) + sizeof( footer ) || !read( file_size - sizeof( footer ), &footer, sizeof( footer ) ) ){
+                return false;
+            }
+            if( std::memcmp( footer.magic, "K4AINDX\0", sizeof( footer.magic ) ) != 0 ){
+                return false;
+            }
+            const uint64_t index_size = file_size - sizeof( footer ) - footer.index_offset;
+            if( footer.index_offset < sizeof( K4ARecordFileHeader ) || footer.index_offset > file_size - sizeof( footer ) || index_size % sizeof( K4ARecordIndexEntry ) != 0 || index_size / sizeof( K4ARecordIndexEntry ) != footer.entry_count ){
+                return false;
+            }
+
+            index.resize( static_cast<size_t>( footer.entry_count ) );
+            if( !index.empty() && !read( footer.index_offset, &index[0], static_cast<size_t>( index_size ) ) ){
+                return false;
+            }
+
+            for( const K4ARecordIndexEntry& entry : index ){
+                if( entry.offset < sizeof( K4ARecordFileHeader ) || entry.offset + sizeof( K4ARecordFrameHeader ) > footer.index_offset ){
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool K4ARecordReader::scan_chunks( uint64_t file_size )
+        {
+            // Chunk is flushed as a whole, so frames are taken from every chunk that is completely in file
+            uint64_t offset = sizeof( K4ARecordFileHeader );
+            while( offset + sizeof( K4ARecordChunkHeader ) <= file_size ){
+                K4ARecordChunkHeader chunk = {};
+                if( !read( offset, &chunk, sizeof( chunk ) ) ){
+                    return false;
+                }
+                const uint64_t chunk_end = offset + sizeof( chunk ) + chunk.size;
+                if( std::memcmp( chunk.magic, "CHNK", sizeof( chunk.magic ) ) != 0 || chunk.size > file_size || chunk_end > file_size ){
+                    break;
+                }
+
+                std::vector<K4ARecordIndexEntry> entries;
+                uint64_t position = offset + sizeof( chunk );
+                for( uint32_t frame = 0; frame < chunk.frame_count; frame++ ){
+                    K4ARecordFrameHeader header = {};
+                    if( position + sizeof( header ) > chunk_end || !read( position, &header, sizeof( header ) ) ){
+                        break;
+                    }
+
+                    K4ARecordIndexEntry entry;
+                    entry.offset      = position;
+                    entry.time_stamp  = header.time_stamp;
+                    entry.index       = header.index;
+                    entry.sensor_type = header.sensor_type;
+                    entries.push_back( entry );
+
+                    position += sizeof( header ) + align( header.size );
+                }
+                if( position != chunk_end ){
+                    break;
+                }
+
+                index.insert( index.end(), entries.begin(), entries.end() );
+                offset = chunk_end;
+            }
+
+            return true;
+        }
+
+        bool K4ARecordReader::read( uint64_t offset, void* data, size_t size )
+        {
+            return seek( file, offset, SEEK_SET ) && ( std::fread( data, 1, size, file ) == size );
+        }
+    }
+}
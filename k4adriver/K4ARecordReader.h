@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "K4ARecorder.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Reads recording of K4ARecorder.
+        // Frames are found through index at end of file, index is rebuilt by scanning chunks when recording was not stopped cleanly.
+        class K4ARecordReader
+        {
+            public:
+                K4ARecordReader();
+
+                ~K4ARecordReader();
+
+                bool open( const std::string& path );
+
+                void close();
+
+                // False when index was rebuilt from chunks, frames of chunk that was not completely written are lost
+                inline bool is_indexed() const { return has_index; }
+
+                inline const std::vector<K4ARecordIndexEntry>& get_index() const { return index; }
+
+                // Data of frame without padding
+                bool read_frame( size_t entry, K4ARecordFrameHeader& header, std::vector<uint8_t>& data );
+
+            protected:
+                K4ARecordReader( const K4ARecordReader& );
+                void operator=( const K4ARecordReader& );
+
+            private:
+                bool read_index( uint64_t file_size );
+
+                bool scan_chunks( uint64_t file_size );
+
+                bool read( uint64_t offset, void* data, size_t size );
+
+            protected:
+                std::FILE* file;
+                bool has_index;
+                std::vector<K4ARecordIndexEntry> index;
+        };
+    }
+}
@@ -0,0 +1,238 @@
+#include "K4AUtil.h"
+#include "K4ARecorder.h"
+
+#include <cstring>
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            uint64_t get_frame_count( const K4AFrameSet& frame_set )
+            {
+                return ( frame_set.color.image ? 1 : 0 ) + ( frame_set.depth.image ? 1 : 0 ) + ( frame_set.infrared.image ? 1 : 0 );
+            }
+
+            uint64_t align( uint64_t size )
+            {
+                return ( size + RECORD_ALIGNMENT - 1 ) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+            }
+        }
+
+        K4ARecorder::K4ARecorder()
+            : file( nullptr ),
+              position( 0 ),
+              written_frames( 0 ),
+              dropped_frames( 0 ),
+              written_bytes( 0 ),
+              is_running( false )
+        {
+            K4ALogDebug( "K4ARecorder::K4ARecorder" );
+        }
+
+        K4ARecorder::~K4ARecorder()
+        {
+            K4ALogDebug( "K4ARecorder::~K4ARecorder" );
+
+            stop();
+        }
+
+        bool K4ARecorder::start( const std::string& path )
+        {
+            K4ATraceFunc( "path = %s", path.c_str() );
+
+            stop();
+
+            file = std::fopen( path.c_str(), "wb" );
+            if( !file ){
+                K4ATraceError( "failed to open %s", path.c_str() );
+                return false;
+            }
+
+            position = 0;
+            index.clear();
+            written_frames = 0;
+            dropped_frames = 0;
+            written_bytes  = 0;
+
+            K4ARecordFileHeader header = {};
+            std::memcpy( header.magic, "K4AREC", 6 );
+            header.version = 1;
+            if( !write( &header, sizeof( header ) ) ){
+                std::fclose( file );
+                file = nullptr;
+                return false;
+            }
+
+            is_running = true;
+            thread = std::thread( &K4ARecorder::writer_thread, this );
+
+            return true;
+        }
+
+        void K4ARecorder::stop()
+        {
+            K4ATraceFunc( "" );
+
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                is_running = false;
+            }
+            condition.notify_all();
+
+            if( thread.joinable() ){
+                thread.join();
+            }
+        }
+
+        void K4ARecorder::push( const K4AFrameSet& frame_set )
+        {
+            // Frame set only holds references of images, capture thread never waits for disk
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                if( !is_running ){
+                    return;
+                }
+
+                if( pending.size() >= MAX_RECORD_PENDING_FRAME_SETS ){
+                    dropped_frames += get_frame_count( frame_set );
+                    return;
+                }
+
+                pending.push_back( frame_set );
+            }
+            condition.notify_one();
+        }
+
+        K4ARecordStatistics K4ARecorder::get_statistics() const
+        {
+            K4ARecordStatistics statistics;
+            statistics.written_frames = written_frames;
+            statistics.dropped_frames = dropped_frames;
+            statistics.written_bytes  = written_bytes;
+            return statistics;
+        }
+
+        void K4ARecorder::writer_thread()
+        {
+            K4ATraceFunc( "" );
+
+            bool is_failed = false;
+            std::vector<K4AFrameSet> batch;
+
+            while( true ){
+                {
+                    std::unique_lock<std::mutex> lock( mutex );
+                    condition.wait( lock, [this]{ return !pending.empty() || !is_running; } );
+                    if( pending.empty() && !is_running ){
+                        break;
+                    }
+
+                    // Everything that arrived while previous chunk was written goes into one chunk
+                    batch.swap( pending );
+                }
+
+                if( is_failed || !write_chunk( batch ) ){
+                    if( !is_failed ){
+                        K4ATraceError( "failed to write recording, frames are dropped until recording is stopped" );
+                    }
+                    is_failed = true;
+                    for( const K4AFrameSet& frame_set : batch ){
+                        dropped_frames += get_frame_count( frame_set );
+                    }
+                }
+                batch.clear();
+            }
+
+            // Index is written at end of file, so that chunks never have to be rewritten
+            if( !is_failed ){
+                K4ARecordFileFooter footer = {};
+                footer.index_offset = position;
+                footer.entry_count  = index.size();
+                std::memcpy( footer.magic, "K4AINDX", 7 );
+                if( ( !index.empty() && !write( &index[0], index.size() * sizeof( K4ARecordIndexEntry ) ) ) || !write( &footer, sizeof( footer ) ) ){
+                    K4ATraceError( "failed to write index of recording" );
+                }
+            }
+
+            std::fclose( file );
+            file = nullptr;
+        }
+
+        bool K4ARecorder::write_chunk( const std::vector<K4AFrameSet>& batch )
+        {
+            K4ARecordChunkHeader header = {};
+            std::memcpy( header.magic, "CHNK", 4 );
+            for( const K4AFrameSet& frame_set : batch ){
+                for( const K4AFrame* frame : { &frame_set.color, &frame_set.depth, &frame_set.infrared } ){
+                    if( frame->image ){
+                        header.frame_count++;
+                        header.size += sizeof( K4ARecordFrameHeader ) + align( frame->image.get_size() );
+                    }
+                }
+            }
+
+            if( !write( &header, sizeof( header ) ) ){
+                return false;
+            }
+
+            for( const K4AFrameSet& frame_set : batch ){
+                if( ( frame_set.color.image && !write_frame( frame_set.color, ONI_SENSOR_COLOR ) )
+                    || ( frame_set.depth.image && !write_frame( frame_set.depth, ONI_SENSOR_DEPTH ) )
+                    || ( frame_set.infrared.image && !write_frame( frame_set.infrared, ONI_SENSOR_IR ) ) ){
+                    return false;
+                }
+            }
+
+            return ( std::fflush( file ) == 0 );
+        }
+
+        bool K4ARecorder::write_frame( const K4AFrame& frame, OniSensorType sensor_type )
+        {
+            const k4a::image& image = frame.image;
+
+            K4ARecordFrameHeader header = {};
+            header.time_stamp  = image.get_device_timestamp().count();
+            header.size        = image.get_size();
+            header.index       = frame.index;
+            header.sensor_type = sensor_type;
+            header.format      = image.get_format();
+            header.width       = image.get_width_pixels();
+            header.height      = image.get_height_pixels();
+            header.stride      = image.get_stride_bytes();
+
+            K4ARecordIndexEntry entry;
+            entry.offset      = position;
+            entry.time_stamp  = header.time_stamp;
+            entry.index       = header.index;
+            entry.sensor_type = header.sensor_type;
+
+            const uint8_t padding[RECORD_ALIGNMENT] = {};
+            const size_t padding_size = static_cast<size_t>( align( header.size ) - header.size );
+            if( !write( &header, sizeof( header ) ) || !write( image.get_buffer(), image.get_size() ) || !write( padding, padding_size ) ){
+                return false;
+            }
+
+            index.push_back( entry );
+            written_frames++;
+
+            return true;
+        }
+
+        bool K4ARecorder::write( const void* data, size_t size )
+        {
+            if( size == 0 ){
+                return true;
+            }
+
+            if( std::fwrite( data, 1, size, file ) != size ){
+                return false;
+            }
+
+            position      += size;
+            written_bytes += size;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+#include <Driver/OniDriverAPI.h>
+
+#include "K4AFrameQueue.h"
+#include "K4AProperties.h"
+
+// Pending frame sets hold images of SDK, which are allocated from its limited pool, so they are bounded by count
+#define MAX_RECORD_PENDING_FRAME_SETS 8
+#define RECORD_ALIGNMENT 8
+
+namespace oni
+{
+    namespace driver
+    {
+        // File layout of recording (little endian, all structures are 8 byte aligned)
+        //   K4ARecordFileHeader
+        //   K4ARecordChunkHeader, ( K4ARecordFrameHeader, frame data padded to RECORD_ALIGNMENT ) * frame_count
+        //   ... more chunks
+        //   K4ARecordIndexEntry * entry_count
+        //   K4ARecordFileFooter
+        // K4ARecordReader reads footer from end of file, and finds any frame through index without scanning chunks.
+        // Index only exists when recording was stopped, reader scans chunks of recording that was not stopped cleanly.
+        struct K4ARecordFileHeader
+        {
+            char magic[8];    // "K4AREC\0\0"
+            uint32_t version;
+            uint32_t reserved;
+        };
+
+        struct K4ARecordChunkHeader
+        {
+            char magic[4];    // "CHNK"
+            uint32_t frame_count;
+            uint64_t size;    // bytes of frames that follow this header
+        };
+
+        struct K4ARecordFrameHeader
+        {
+            int64_t time_stamp; // microseconds of device clock, time stamps of devices in wired sync are not aligned to host clock
+            uint64_t size;      // bytes of frame data without padding
+            int32_t index;
+            int32_t sensor_type;
+            int32_t format;
+            int32_t width;
+            int32_t height;
+            int32_t stride;
+        };
+
+        struct K4ARecordIndexEntry
+        {
+            uint64_t offset;    // file offset of K4ARecordFrameHeader
+            int64_t time_stamp;
+            int32_t index;
+            int32_t sensor_type;
+        };
+
+        struct K4ARecordFileFooter
+        {
+            uint64_t index_offset;
+            uint64_t entry_count;
+            char magic[8];    // "K4AINDX\0"
+        };
+
+        static_assert( sizeof( K4ARecordFileHeader ) == 16, "unexpected padding in K4ARecordFileHeader" );
+        static_assert( sizeof( K4ARecordChunkHeader ) == 16, "unexpected padding in K4ARecordChunkHeader" );
+        static_assert( sizeof( K4ARecordFrameHeader ) == 40, "unexpected padding in K4ARecordFrameHeader" );
+        static_assert( sizeof( K4ARecordIndexEntry ) == 24, "unexpected padding in K4ARecordIndexEntry" );
+        static_assert( sizeof( K4ARecordFileFooter ) == 24, "unexpected padding in K4ARecordFileFooter" );
+
+        // Records frame sets on writer thread.
+        // push never blocks capture thread, frame sets are dropped and counted when writer falls behind.
+        class K4ARecorder
+        {
+            public:
+                K4ARecorder();
+
+                ~K4ARecorder();
+
+                bool start( const std::string& path );
+
+                void stop();
+
+                void push( const K4AFrameSet& frame_set );
+
+                inline bool is_recording() const { return is_running; }
+
+                K4ARecordStatistics get_statistics() const;
+
+            protected:
+                K4ARecorder( const K4ARecorder& );
+                void operator=( const K4ARecorder& );
+
+            private:
+                void writer_thread();
+
+                bool write_chunk( const std::vector<K4AFrameSet>& batch );
+
+                bool write_frame( const K4AFrame& frame, OniSensorType sensor_type );
+
+                bool write( const void* data, size_t size );
+
+            protected:
+                std::FILE* file;
+                uint64_t position;
+                std::vector<K4ARecordIndexEntry> index;
+
+                std::mutex mutex;
+                std::condition_variable condition;
+                std::vector<K4AFrameSet> pending;
+
+                std::atomic<uint64_t> written_frames;
+                std::atomic<uint64_t> dropped_frames;
+                std::atomic<uint64_t> written_bytes;
+
+                std::thread thread;
+                std::atomic_bool is_running;
+        };
+    }
+}
@@ -0,0 +1,164 @@
+#include "K4AUtil.h"
+#include "K4ARegistration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+// Number of rows that are processed by one parallel task
+#define PARALLEL_BLOCK_ROWS 32
+
+namespace oni
+{
+    namespace driver
+    {
+        K4ARegistration::K4ARegistration( const std::shared_ptr<const K4ACalibrationTable>& table )
+            : table( table )
+        {
+            K4ALogDebug( "K4ARegistration::K4ARegistration" );
+
+            const size_t size = static_cast<size_t>( table->depth_width ) * table->depth_height;
+            color_x.resize( size );
+            color_y.resize( size );
+            color_z.resize( size );
+            row_min_y.resize( table->depth_height );
+            row_max_y.resize( table->depth_height );
+        }
+
+        K4ARegistration::~K4ARegistration()
+        {
+            K4ALogDebug( "K4ARegistration::~K4ARegistration" );
+        }
+
+        bool K4ARegistration::depth_image_to_color_camera( const k4a::image& depth_image, k4a::image& transformed_image )
+        {
+            return depth_image_to_color_camera( depth_image, transformed_image, 0, 0, table->color_width, table->color_height );
+        }
+
+        bool K4ARegistration::depth_image_to_color_camera( const k4a::image& depth_image, k4a::image& transformed_image, int32_t begin_x, int32_t begin_y, int32_t end_x, int32_t end_y )
+        {
+            const int32_t depth_width  = table->depth_width;
+            const int32_t depth_height = table->depth_height;
+            if( depth_image.get_width_pixels() != depth_width || depth_image.get_height_pixels() != depth_height
+                || transformed_image.get_width_pixels() != table->color_width || transformed_image.get_height_pixels() != table->color_height ){
+                return false;
+            }
+
+            const uint16_t* depth = reinterpret_cast<const uint16_t*>( depth_image.get_buffer() );
+            uint16_t* transformed = reinterpret_cast<uint16_t*>( transformed_image.get_buffer() );
+            const int32_t depth_stride       = depth_image.get_stride_bytes() / static_cast<int32_t>( sizeof( uint16_t ) );
+            const int32_t transformed_stride = transformed_image.get_stride_bytes() / static_cast<int32_t>( sizeof( uint16_t ) );
+            if( depth_stride != depth_width ){
+                return false;
+            }
+
+            begin_x = std::max( begin_x, 0 );
+            begin_y = std::max( begin_y, 0 );
+            end_x   = std::min( end_x, table->color_width );
+            end_y   = std::min( end_y, table->color_height );
+            if( begin_x >= end_x || begin_y >= end_y ){
+                begin_x = begin_y = end_x = end_y = 0;
+            }
+
+            // Map depth pixels to color image, and find range of color rows that each depth row covers
+            const int32_t depth_blocks = ( depth_height + PARALLEL_BLOCK_ROWS - 1 ) / PARALLEL_BLOCK_ROWS;
+            concurrency::parallel_for( 0, depth_blocks, [&]( int32_t block ){
+                const int32_t begin_y = block * PARALLEL_BLOCK_ROWS;
+                const int32_t end_y   = std::min( begin_y + PARALLEL_BLOCK_ROWS, depth_height );
+                const size_t begin = static_cast<size_t>( begin_y ) * depth_width;
+                const size_t end   = static_cast<size_t>( end_y ) * depth_width;
+                table->depth_to_color( depth, &color_x[0], &color_y[0], &color_z[0], begin, end );
+
+                for( int32_t y = begin_y; y < end_y; y++ ){
+                    float min_y = static_cast<float>( table->color_height );
+                    float max_y = -1.0f;
+                    const size_t row = static_cast<size_t>( y ) * depth_width;
+                    for( size_t i = row; i < row + depth_width; i++ ){
+                        if( color_x[i] < 0.0f ){
+                            continue;
+                        }
+                        min_y = std::min( min_y, color_y[i] - table->footprint_y[i] );
+                        max_y = std::max( max_y, color_y[i] + table->footprint_y[i] );
+                    }
+                    row_min_y[y] = min_y;
+                    row_max_y[y] = max_y;
+                }
+            } );
+
+            // Rows outside of region are cleared once, so that frame never shows depth of older frames there
+            const size_t row_size = table->color_width * sizeof( uint16_t );
+            for( int32_t y = 0; y < begin_y; y++ ){
+                memset( transformed + static_cast<size_t>( y ) * transformed_stride, 0, row_size );
+            }
+            for( int32_t y = end_y; y < table->color_height; y++ ){
+                memset( transformed + static_cast<size_t>( y ) * transformed_stride, 0, row_size );
+            }
+
+            // Splat into horizontal bands of color image, bands do not overlap so that z-buffering needs no synchronization
+            const int32_t color_blocks = ( end_y - begin_y + PARALLEL_BLOCK_ROWS - 1 ) / PARALLEL_BLOCK_ROWS;
+            concurrency::parallel_for( 0, color_blocks, [&]( int32_t block ){
+                const int32_t band_begin_y = begin_y + block * PARALLEL_BLOCK_ROWS;
+                const int32_t band_end_y   = std::min( band_begin_y + PARALLEL_BLOCK_ROWS, end_y );
+                splat( transformed, transformed_stride, begin_x, end_x, band_begin_y, band_end_y );
+            } );
+
+            return true;
+        }
+
+        void K4ARegistration::splat( uint16_t* transformed, int32_t transformed_stride, int32_t begin_x, int32_t end_x, int32_t begin_y, int32_t end_y ) const
+        {
+            const int32_t depth_width  = table->depth_width;
+            const int32_t depth_height = table->depth_height;
+            const int32_t color_width  = table->color_width;
+
+            for( int32_t y = begin_y; y < end_y; y++ ){
+                memset( transformed + static_cast<size_t>( y ) * transformed_stride, 0, color_width * sizeof( uint16_t ) );
+            }
+
+            const float band_min_y = static_cast<float>( begin_y ) - 0.5f;
+            const float band_max_y = static_cast<float>( end_y ) - 0.5f;
+
+            for( int32_t depth_y = 0; depth_y < depth_height; depth_y++ ){
+                if( row_max_y[depth_y] < band_min_y || row_min_y[depth_y] > band_max_y ){
+                    continue;
+                }
+
+                const size_t row = static_cast<size_t>( depth_y ) * depth_width;
+                for( size_t i = row; i < row + depth_width; i++ ){
+                    const float u = color_x[i];
+                    if( u < 0.0f ){
+                        continue;
+                    }
+
+                    const float v  = color_y[i];
+                    const float fx = table->footprint_x[i];
+                    const float fy = table->footprint_y[i];
+                    const int32_t x0 = std::max( static_cast<int32_t>( std::ceil( u - fx ) ), begin_x );
+                    const int32_t x1 = std::min( static_cast<int32_t>( std::floor( u + fx ) ), end_x - 1 );
+                    const int32_t y0 = std::max( static_cast<int32_t>( std::ceil( v - fy ) ), begin_y );
+                    const int32_t y1 = std::min( static_cast<int32_t>( std::floor( v + fy ) ), end_y - 1 );
+                    if( x0 > x1 || y0 > y1 ){
+                        continue;
+                    }
+
+                    const float z = color_z[i] + 0.5f;
+                    const uint16_t value = ( z >= 65535.0f ) ? 65535 : static_cast<uint16_t>( z );
+                    for( int32_t y = y0; y <= y1; y++ ){
+                        uint16_t* pixels = transformed + static_cast<size_t>( y ) * transformed_stride;
+                        for( int32_t x = x0; x <= x1; x++ ){
+                            const uint16_t current = pixels[x];
+                            pixels[x] = ( current == 0 || value < current ) ? value : current;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <k4a/k4a.hpp>
+
+namespace oni
+{
+    namespace driver
+    {
+        // Source of captures and calibration behind K4ADevice.
+        // K4ADevice and K4ACapture only use this interface, so live devices and recordings run through the same pipeline.
+        class K4ASource
+        {
+            public:
+                virtual ~K4ASource(){}
+
+                virtual std::string get_serialnum() const = 0;
+
+                virtual k4a::calibration get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const = 0;
+
+                // Modes that source is able to deliver, these are advertised as video modes of sensors
+                virtual bool is_color_mode_supported( k4a_color_resolution_t, k4a_fps_t ) const { return true; }
+
+                virtual bool is_depth_mode_supported( k4a_depth_mode_t, k4a_fps_t ) const { return true; }
+
+                // Color formats that source delivers without conversion, BGRA32 is always required
+                virtual bool is_color_format_supported( k4a_image_format_t color_format, k4a_color_resolution_t ) const { return ( color_format == K4A_IMAGE_FORMAT_COLOR_BGRA32 ); }
+
+                // Overwrite values of configuration that are fixed by source
+                virtual void get_default_configuration( k4a_device_configuration_t& ) const {}
+
+                virtual void start_cameras( const k4a_device_configuration_t& configuration ) = 0;
+
+                virtual void stop_cameras() = 0;
+
+                // Returns false if no capture arrived within timeout
+                virtual bool get_capture( k4a::capture* capture, std::chrono::milliseconds timeout ) = 0;
+
+                virtual bool is_sync_in_connected() const { return false; }
+
+                virtual bool is_sync_out_connected() const { return false; }
+
+                // Playback control, only supported by sources that play recordings
+                virtual bool is_playback() const { return false; }
+
+                virtual void set_speed( float ) {}
+
+                virtual float get_speed() const { return 0.0f; }
+
+                virtual void set_repeat( bool ) {}
+
+                virtual bool get_repeat() const { return false; }
+
+                virtual bool seek( int32_t ) { return false; }
+        };
+    }
+}
@@ -0,0 +1,91 @@
+#include "K4AUtil.h"
+#include "K4AStatistics.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            const uint8_t EMPTY_SLOT = 0xFF;
+
+            uint8_t get_latency_bin( std::chrono::microseconds latency )
+            {
+                // First bin holds latency < 128 usec, each following bin doubles
+                uint64_t usec = ( latency.count() > 0 ) ? static_cast<uint64_t>( latency.count() ) >> 7 : 0;
+                uint8_t bin = 0;
+                while( usec > 0 && bin < K4A_LATENCY_HISTOGRAM_BINS - 1 ){
+                    usec >>= 1;
+                    bin++;
+                }
+                return bin;
+            }
+        }
+
+        K4AStreamCounters::K4AStreamCounters()
+            : captured_frames( 0 ),
+              delivered_frames( 0 ),
+              dropped_sync( 0 ),
+              dropped_registration( 0 ),
+              time_stamp_gaps( 0 ),
+              has_time_stamp( false ),
+              last_time_stamp( 0 ),
+              window_position( 0 )
+        {
+            for( std::atomic<int32_t>& bin : latency_bins ){
+                bin = 0;
+            }
+            for( std::atomic<uint8_t>& slot : window ){
+                slot = EMPTY_SLOT;
+            }
+        }
+
+        void K4AStreamCounters::count_time_stamp( std::chrono::microseconds time_stamp, std::chrono::microseconds period )
+        {
+            // Device time stamps jitter, so interval is rounded to frame periods
+            if( has_time_stamp && period.count() > 0 && time_stamp > last_time_stamp ){
+                const int64_t periods = ( ( time_stamp - last_time_stamp ).count() + period.count() / 2 ) / period.count();
+                if( periods > 1 ){
+                    time_stamp_gaps += static_cast<uint64_t>( periods - 1 );
+                }
+            }
+
+            last_time_stamp = time_stamp;
+            has_time_stamp  = true;
+        }
+
+        void K4AStreamCounters::reset_time_stamp()
+        {
+            has_time_stamp = false;
+        }
+
+        void K4AStreamCounters::count_delivered( std::chrono::microseconds latency )
+        {
+            delivered_frames++;
+
+            const uint8_t bin = get_latency_bin( latency );
+            const uint32_t position = window_position++;
+            const uint8_t previous = window[position % LATENCY_WINDOW].exchange( bin );
+            if( previous != EMPTY_SLOT ){
+                latency_bins[previous]--;
+            }
+            latency_bins[bin]++;
+        }
+
+        K4AStreamStatistics K4AStreamCounters::get_statistics() const
+        {
+            K4AStreamStatistics statistics = {};
+            statistics.captured_frames      = captured_frames;
+            statistics.delivered_frames     = delivered_frames;
+            statistics.dropped_sync         = dropped_sync;
+            statistics.dropped_registration = dropped_registration;
+            statistics.time_stamp_gaps      = time_stamp_gaps;
+            for( int32_t bin = 0; bin < K4A_LATENCY_HISTOGRAM_BINS; bin++ ){
+                // Bin can be read between removal of old frame and addition of new frame by other writer
+                const int32_t count = latency_bins[bin];
+                statistics.latency_histogram[bin] = static_cast<uint32_t>( count > 0 ? count : 0 );
+            }
+            return statistics;
+        }
+    }
+}
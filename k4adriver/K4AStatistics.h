@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "K4AProperties.h"
+
+#define LATENCY_WINDOW 256
+
+namespace oni
+{
+    namespace driver
+    {
+        // Counters of frames of one sensor.
+        // Capture thread, registration workers and stream thread update them without locks, readers get a snapshot that may be off by a frame.
+        class K4AStreamCounters
+        {
+            public:
+                K4AStreamCounters();
+
+                inline void count_captured() { captured_frames++; }
+
+                inline void count_dropped_sync() { dropped_sync++; }
+
+                inline void count_dropped_registration() { dropped_registration++; }
+
+                // Called only by capture thread, frames that are missing between device time stamps are counted as gaps
+                void count_time_stamp( std::chrono::microseconds time_stamp, std::chrono::microseconds period );
+
+                void reset_time_stamp();
+
+                void count_delivered( std::chrono::microseconds latency );
+
+                K4AStreamStatistics get_statistics() const;
+
+            protected:
+                K4AStreamCounters( const K4AStreamCounters& );
+                void operator=( const K4AStreamCounters& );
+
+            protected:
+                std::atomic<uint64_t> captured_frames;
+                std::atomic<uint64_t> delivered_frames;
+                std::atomic<uint64_t> dropped_sync;
+                std::atomic<uint64_t> dropped_registration;
+                std::atomic<uint64_t> time_stamp_gaps;
+
+                bool has_time_stamp;
+                std::chrono::microseconds last_time_stamp;
+
+                // Rolling histogram of last LATENCY_WINDOW frames, bin of each frame is kept to remove it when it leaves window
+                std::atomic<int32_t> latency_bins[K4A_LATENCY_HISTOGRAM_BINS];
+                std::atomic<uint8_t> window[LATENCY_WINDOW];
+                std::atomic<uint32_t> window_position;
+        };
+    }
+}
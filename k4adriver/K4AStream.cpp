@@ -1,14 +1,47 @@
 #include "K4AUtil.h"
 #include "K4AStream.h"
+#include "K4AConvert.h"
 
 #include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#if __has_include(<ppl.h>)
+#include <ppl.h>
+#else
+#include <tbb/parallel_for.h>
+namespace concurrency = tbb;
+#endif
+
+// Number of rows that are converted by one parallel task
+#define CONVERT_BLOCK_ROWS 32
 
 namespace oni
 {
     namespace driver
     {
-        K4AStream::K4AStream( class K4ADevice* k4a_device )
-            : k4a_device( k4a_device )
+        namespace
+        {
+            // Copy region of 16 bit image into packed frame, region is in mirrored image when is_mirror is true
+            void copy_region( const k4a::image& image, const OniCropping& region, bool is_mirror, void* destination )
+            {
+                const int32_t stride = image.get_stride_bytes();
+                const int32_t width  = image.get_width_pixels();
+                const int32_t source_x = is_mirror ? width - region.originX - region.width : region.originX;
+                const uint8_t* source = image.get_buffer() + static_cast<size_t>( region.originY ) * stride + source_x * sizeof( uint16_t );
+                copy_gray16( source, stride, reinterpret_cast<uint8_t*>( destination ), region.width * static_cast<int32_t>( sizeof( uint16_t ) ), region.width, region.height, is_mirror );
+            }
+        }
+
+        K4AStream::K4AStream( class K4ADevice* k4a_device, OniSensorType sensor_type )
+            : k4a_device( k4a_device ),
+              is_running( false ),
+              sensor_type( sensor_type ),
+              queue( DEFAULT_QUEUE_SIZE, K4A_QUEUE_POLICY_DROP_OLDEST ),
+              queue_policy( K4A_QUEUE_POLICY_DROP_OLDEST ),
+              queue_depth( DEFAULT_QUEUE_SIZE ),
+              cropping(),
+              is_mirror( false )
         {
             K4ALogDebug( "K4AStream::K4AStream" );
 
@@ -21,12 +54,24 @@ namespace oni
             K4ALogDebug( "K4AStream::~K4AStream" );
 
             stop();
+            k4a_capture->remove_from_frame_sync( &queue );
         }
 
         OniStatus K4AStream::start()
         {
             K4ATraceFunc( "" );
 
+            if( is_running ){
+                return ONI_STATUS_OK;
+            }
+
+            queue.configure( queue_depth, queue_policy );
+            k4a_capture->subscribe( sensor_type, &queue );
+            {
+                std::lock_guard<std::mutex> lock( cropping_mutex );
+                k4a_capture->set_cropping( sensor_type, &queue, cropping, is_mirror );
+            }
+
             is_running = true;
 
             thread = std::thread( &K4AStream::MainLoop, this );
@@ -38,8 +83,15 @@ namespace oni
         {
             K4ATraceFunc( "" );
 
+            if( !is_running ){
+                return;
+            }
+
             is_running = false;
 
+            // Unsubscribe before join so that the waiting loop wakes up immediately
+            k4a_capture->unsubscribe( sensor_type, &queue );
+
             if( thread.joinable() ){
                 thread.join();
             }
@@ -54,8 +106,7 @@ namespace oni
                     if( data && ( dataSize == sizeof( OniVideoMode ) ) ){
                         OniVideoMode* mode = ( OniVideoMode* )data;
                         K4ALogDebug( "set video mode: %dx%d @%d format=%d", mode->resolutionX, mode->resolutionY, mode->fps, static_cast<int>( mode->pixelFormat ) );
-                        video_mode = *mode;
-                        return ONI_STATUS_OK;
+                        return k4a_device->setVideoMode( sensor_type, *mode );
                     }
                     break;
                 case ONI_STREAM_PROPERTY_AUTO_WHITE_BALANCE:
@@ -68,6 +119,26 @@ namespace oni
                         return ONI_STATUS_OK;
                     }
                     break;
+                case K4A_STREAM_PROPERTY_QUEUE_POLICY:
+                    if( data && ( dataSize == sizeof( int32_t ) ) ){
+                        return configure_queue( static_cast<K4AQueuePolicy>( *reinterpret_cast<const int32_t*>( data ) ), queue_depth );
+                    }
+                    break;
+                case K4A_STREAM_PROPERTY_QUEUE_DEPTH:
+                    if( data && ( dataSize == sizeof( int32_t ) ) ){
+                        return configure_queue( queue_policy, *reinterpret_cast<const int32_t*>( data ) );
+                    }
+                    break;
+                case ONI_STREAM_PROPERTY_CROPPING:
+                    if( data && ( dataSize == sizeof( OniCropping ) ) ){
+                        return set_cropping( *reinterpret_cast<const OniCropping*>( data ) );
+                    }
+                    break;
+                case ONI_STREAM_PROPERTY_MIRRORING:
+                    if( data && ( dataSize == sizeof( OniBool ) ) ){
+                        return set_mirroring( *reinterpret_cast<const OniBool*>( data ) != FALSE );
+                    }
+                    break;
                 default:
                     break;
             }
@@ -98,6 +169,19 @@ namespace oni
                         return ONI_STATUS_OK;
                     }
                     break;
+                case ONI_STREAM_PROPERTY_CROPPING:
+                    if( data && dataSize && *dataSize == sizeof( OniCropping ) ){
+                        std::lock_guard<std::mutex> lock( cropping_mutex );
+                        *reinterpret_cast<OniCropping*>( data ) = cropping;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case ONI_STREAM_PROPERTY_MIRRORING:
+                    if( data && dataSize && *dataSize == sizeof( OniBool ) ){
+                        *reinterpret_cast<OniBool*>( data ) = is_mirror ? TRUE : FALSE;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
                 case ONI_STREAM_PROPERTY_MAX_VALUE:
                     if( data && dataSize && *dataSize == sizeof( int ) ){
                         int32_t max_value;
@@ -160,6 +244,27 @@ namespace oni
                         return ONI_STATUS_OK;
                     }
                     break;
+                case K4A_STREAM_PROPERTY_STATISTICS:
+                    if( data && dataSize && *dataSize == sizeof( K4AStreamStatistics ) ){
+                        K4AStreamStatistics statistics = k4a_capture->get_stream_statistics( sensor_type );
+                        statistics.dropped_queue_full = queue.get_dropped();
+                        statistics.queue_depth        = queue.size();
+                        *reinterpret_cast<K4AStreamStatistics*>( data ) = statistics;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_STREAM_PROPERTY_QUEUE_POLICY:
+                    if( data && dataSize && *dataSize == sizeof( int32_t ) ){
+                        *reinterpret_cast<int32_t*>( data ) = queue_policy;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
+                case K4A_STREAM_PROPERTY_QUEUE_DEPTH:
+                    if( data && dataSize && *dataSize == sizeof( int32_t ) ){
+                        *reinterpret_cast<int32_t*>( data ) = queue_depth;
+                        return ONI_STATUS_OK;
+                    }
+                    break;
                 default:
                     break;
             }
@@ -176,52 +281,333 @@ namespace oni
                 case ONI_STREAM_PROPERTY_HORIZONTAL_FOV:
                 case ONI_STREAM_PROPERTY_VERTICAL_FOV:
                 case ONI_STREAM_PROPERTY_VIDEO_MODE:
+                case ONI_STREAM_PROPERTY_CROPPING:
+                case ONI_STREAM_PROPERTY_MIRRORING:
                 case ONI_STREAM_PROPERTY_MAX_VALUE:
                 case ONI_STREAM_PROPERTY_MIN_VALUE:
                 case ONI_STREAM_PROPERTY_STRIDE:
                 case ONI_STREAM_PROPERTY_AUTO_WHITE_BALANCE:
                 case ONI_STREAM_PROPERTY_AUTO_EXPOSURE:
-                    return true;
+                case K4A_STREAM_PROPERTY_STATISTICS:
+                case K4A_STREAM_PROPERTY_QUEUE_POLICY:
+                case K4A_STREAM_PROPERTY_QUEUE_DEPTH:
+                    return TRUE;
                 default:
-                    return false;
+                    return FALSE;
             }
         }
 
-        OniStatus K4AStream::convertDepthToColorCoordinates( StreamBase* colorStream, int depthX, int depthY, OniDepthPixel depthZ, int* pColorX, int* pColorY )
+        OniStatus K4AStream::invoke( int commandId, void* data, int dataSize )
         {
-            K4ATraceFunc( "" );
+            K4ALogDebug( "K4AStream::invoke : %d", commandId );
+
+            if( !is_depth_image_stream() ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            switch( commandId ){
+                case K4A_STREAM_COMMAND_DEPTH_IMAGE_TO_COLOR_COORDINATES:
+                    if( data && ( dataSize == sizeof( K4ADepthImageToColorCoordinates ) ) ){
+                        return convert_depth_image_to_color( *reinterpret_cast<K4ADepthImageToColorCoordinates*>( data ) );
+                    }
+                    return ONI_STATUS_BAD_PARAMETER;
+                case K4A_STREAM_COMMAND_DEPTH_POINTS_TO_COLOR_COORDINATES:
+                    if( data && ( dataSize == sizeof( K4ADepthPointsToColorCoordinates ) ) ){
+                        return convert_depth_points_to_color( *reinterpret_cast<K4ADepthPointsToColorCoordinates*>( data ) );
+                    }
+                    return ONI_STATUS_BAD_PARAMETER;
+                default:
+                    break;
+            }
+
+            return ONI_STATUS_NOT_IMPLEMENTED;
+        }
+
+        OniBool K4AStream::isCommandSupported( int commandId )
+        {
+            K4ALogDebug( "K4AStream::isCommandSupported : %d", commandId );
+
+            if( !is_depth_image_stream() ){
+                return FALSE;
+            }
+
+            switch( commandId ){
+                case K4A_STREAM_COMMAND_DEPTH_IMAGE_TO_COLOR_COORDINATES:
+                case K4A_STREAM_COMMAND_DEPTH_POINTS_TO_COLOR_COORDINATES:
+                    return TRUE;
+                default:
+                    return FALSE;
+            }
+        }
 
+        OniStatus K4AStream::convertDepthToColorCoordinates( StreamBase* colorStream, int depthX, int depthY, OniDepthPixel depthZ, int* pColorX, int* pColorY )
+        {
+            // This is called for every pixel, so it must not trace, lock nor copy calibration, table of current mode is kept by stream and built on first call
             if( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ){
                 *pColorX = depthX;
                 *pColorY = depthY;
                 return ONI_STATUS_OK;
             }
-            else{
-                k4a::calibration calibration = k4a_device->getCalibration();
-                k4a_float2_t target_point2d;
-                k4a_float2_t source_point2d = { static_cast<float>( depthX ), static_cast<float>( depthY ) };
-                float source_depth = static_cast<float>( depthZ );
-                bool result = calibration.convert_2d_to_2d( source_point2d, source_depth, k4a_calibration_type_t::K4A_CALIBRATION_TYPE_DEPTH, k4a_calibration_type_t::K4A_CALIBRATION_TYPE_COLOR, &target_point2d );
-                *pColorX = static_cast<int32_t>( target_point2d.xy.x );
-                *pColorY = static_cast<int32_t>( target_point2d.xy.y );
-                return ( result ? ONI_STATUS_OK : ONI_STATUS_ERROR );
+
+            const std::shared_ptr<const K4ACalibrationTable> table = get_calibration_table();
+            if( table->is_valid() ){
+                const int32_t depth_x = depthX;
+                const int32_t depth_y = depthY;
+                const uint16_t depth_z = depthZ;
+                float color_x, color_y;
+                table->points_to_color( &depth_x, &depth_y, &depth_z, &color_x, &color_y, 1 );
+                if( color_x < 0.0f ){
+                    return ONI_STATUS_ERROR;
+                }
+                *pColorX = static_cast<int32_t>( color_x );
+                *pColorY = static_cast<int32_t>( color_y );
+                return ONI_STATUS_OK;
+            }
+
+            const k4a::calibration& calibration = k4a_device->getCalibration();
+            k4a_float2_t target_point2d;
+            k4a_float2_t source_point2d = { static_cast<float>( depthX ), static_cast<float>( depthY ) };
+            float source_depth = static_cast<float>( depthZ );
+            bool result = calibration.convert_2d_to_2d( source_point2d, source_depth, k4a_calibration_type_t::K4A_CALIBRATION_TYPE_DEPTH, k4a_calibration_type_t::K4A_CALIBRATION_TYPE_COLOR, &target_point2d );
+            *pColorX = static_cast<int32_t>( target_point2d.xy.x );
+            *pColorY = static_cast<int32_t>( target_point2d.xy.y );
+            return ( result ? ONI_STATUS_OK : ONI_STATUS_ERROR );
+        }
+
+        std::shared_ptr<const K4ACalibrationTable> K4AStream::get_calibration_table()
+        {
+            std::shared_ptr<const K4ACalibrationTable> table = std::atomic_load( &calibration_table );
+            if( table ){
+                return table;
+            }
+
+            // Lock is held while table is fetched, so table of previous mode is never stored after update_video_mode cleared it
+            std::lock_guard<std::mutex> lock( calibration_table_mutex );
+            table = std::atomic_load( &calibration_table );
+            if( !table ){
+                table = k4a_device->getCalibrationTable();
+                std::atomic_store( &calibration_table, table );
+            }
+            return table;
+        }
+
+        OniStatus K4AStream::configure_queue( K4AQueuePolicy policy, int32_t depth )
+        {
+            K4ATraceFunc( "policy = %d, depth = %d", policy, depth );
+
+            if( policy != K4A_QUEUE_POLICY_DROP_OLDEST && policy != K4A_QUEUE_POLICY_LATEST_ONLY && policy != K4A_QUEUE_POLICY_BLOCK ){
+                return ONI_STATUS_BAD_PARAMETER;
+            }
+            if( depth < 1 || depth > MAX_QUEUE_SIZE ){
+                return ONI_STATUS_BAD_PARAMETER;
+            }
+
+            // Queue is reallocated only while nobody uses it, so running stream is restarted, but not from its own new frame callback
+            const bool is_restart = is_running;
+            if( is_restart && std::this_thread::get_id() == thread.get_id() ){
+                return ONI_STATUS_OUT_OF_FLOW;
+            }
+
+            queue_policy = policy;
+            queue_depth  = depth;
+
+            if( is_restart ){
+                stop();
+                return start();
             }
+
+            return ONI_STATUS_OK;
+        }
+
+        OniStatus K4AStream::set_cropping( const OniCropping& cropping )
+        {
+            K4ATraceFunc( "enabled = %d, origin = ( %d, %d ), size = %dx%d", cropping.enabled, cropping.originX, cropping.originY, cropping.width, cropping.height );
+
+            if( cropping.enabled ){
+                if( cropping.originX < 0 || cropping.originY < 0 || cropping.width <= 0 || cropping.height <= 0 ){
+                    return ONI_STATUS_BAD_PARAMETER;
+                }
+                if( cropping.originX + cropping.width > video_mode.resolutionX || cropping.originY + cropping.height > video_mode.resolutionY ){
+                    return ONI_STATUS_BAD_PARAMETER;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock( cropping_mutex );
+            this->cropping = cropping;
+            if( is_running ){
+                k4a_capture->set_cropping( sensor_type, &queue, cropping, is_mirror );
+            }
+
+            return ONI_STATUS_OK;
+        }
+
+        OniStatus K4AStream::set_mirroring( bool is_mirror )
+        {
+            K4ATraceFunc( "mirroring = %d", is_mirror );
+
+            std::lock_guard<std::mutex> lock( cropping_mutex );
+            this->is_mirror = is_mirror;
+            if( is_running ){
+                k4a_capture->set_cropping( sensor_type, &queue, cropping, is_mirror );
+            }
+
+            return ONI_STATUS_OK;
+        }
+
+        OniCropping K4AStream::get_crop_region( int32_t width, int32_t height )
+        {
+            OniCropping region;
+            {
+                std::lock_guard<std::mutex> lock( cropping_mutex );
+                region = cropping;
+            }
+
+            if( !region.enabled || region.originX + region.width > width || region.originY + region.height > height ){
+                region.enabled = FALSE;
+                region.originX = 0;
+                region.originY = 0;
+                region.width   = width;
+                region.height  = height;
+            }
+
+            return region;
+        }
+
+        bool K4AStream::is_region_filled( const K4AFrame& frame, const OniCropping& region, bool is_mirror, int32_t width ) const
+        {
+            const OniCropping& filled = frame.filled_region;
+            if( !filled.enabled ){
+                return true;
+            }
+
+            // Filled region is in image as delivered by device, crop region is in mirrored image
+            const int32_t origin_x = is_mirror ? width - region.originX - region.width : region.originX;
+            return ( origin_x >= filled.originX && origin_x + region.width <= filled.originX + filled.width
+                  && region.originY >= filled.originY && region.originY + region.height <= filled.originY + filled.height );
+        }
+
+        OniStatus K4AStream::convert_depth_image_to_color( K4ADepthImageToColorCoordinates& conversion )
+        {
+            K4ATraceFunc( "%dx%d", conversion.width, conversion.height );
+
+            if( !conversion.depth || !conversion.color_x || !conversion.color_y || conversion.width <= 0 || conversion.height <= 0 ){
+                return ONI_STATUS_BAD_PARAMETER;
+            }
+
+            const int32_t width  = conversion.width;
+            const int32_t height = conversion.height;
+
+            // Depth image is already in color camera
+            if( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ){
+                for( int32_t y = 0; y < height; y++ ){
+                    float* color_x = conversion.color_x + static_cast<size_t>( y ) * width;
+                    float* color_y = conversion.color_y + static_cast<size_t>( y ) * width;
+                    for( int32_t x = 0; x < width; x++ ){
+                        color_x[x] = static_cast<float>( x );
+                        color_y[x] = static_cast<float>( y );
+                    }
+                }
+                return ONI_STATUS_OK;
+            }
+
+            const std::shared_ptr<const K4ACalibrationTable> table = get_calibration_table();
+            if( !table->is_valid() ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+            if( width != table->depth_width || height != table->depth_height ){
+                return ONI_STATUS_BAD_PARAMETER;
+            }
+
+            const int32_t blocks = ( height + CONVERT_BLOCK_ROWS - 1 ) / CONVERT_BLOCK_ROWS;
+            concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                const int32_t begin_y = block * CONVERT_BLOCK_ROWS;
+                const int32_t end_y   = std::min( begin_y + CONVERT_BLOCK_ROWS, height );
+                const size_t begin = static_cast<size_t>( begin_y ) * width;
+                const size_t end   = static_cast<size_t>( end_y ) * width;
+                table->depth_to_color( conversion.depth, conversion.color_x, conversion.color_y, nullptr, begin, end );
+            } );
+
+            return ONI_STATUS_OK;
+        }
+
+        OniStatus K4AStream::convert_depth_points_to_color( K4ADepthPointsToColorCoordinates& conversion )
+        {
+            K4ATraceFunc( "count = %u", conversion.count );
+
+            if( conversion.count == 0 ){
+                return ONI_STATUS_OK;
+            }
+            if( !conversion.depth_x || !conversion.depth_y || !conversion.depth_z || !conversion.color_x || !conversion.color_y ){
+                return ONI_STATUS_BAD_PARAMETER;
+            }
+
+            if( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ){
+                for( uint32_t i = 0; i < conversion.count; i++ ){
+                    conversion.color_x[i] = static_cast<float>( conversion.depth_x[i] );
+                    conversion.color_y[i] = static_cast<float>( conversion.depth_y[i] );
+                }
+                return ONI_STATUS_OK;
+            }
+
+            const std::shared_ptr<const K4ACalibrationTable> table = get_calibration_table();
+            if( !table->is_valid() ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+
+            table->points_to_color( conversion.depth_x, conversion.depth_y, conversion.depth_z, conversion.color_x, conversion.color_y, conversion.count );
+
+            return ONI_STATUS_OK;
         }
 
         K4AColorStream::K4AColorStream( class K4ADevice* k4a_device )
-            : K4AStream( k4a_device )
+            : K4AStream( k4a_device, ONI_SENSOR_COLOR )
         {
             K4ALogDebug( "K4AColorStream::K4AColorStream" );
 
-            k4a::calibration calibration = k4a_device->getCalibration();
+            update_video_mode();
+        }
+
+        K4AColorStream::~K4AColorStream()
+        {
+            K4ALogDebug( "K4AColorStream::~K4AColorStream" );
+        }
+
+        int K4AColorStream::getRequiredFrameSize()
+        {
+            // OpenNI does not know size of custom pixel formats, JPEG gets room of RGB888
+            const int32_t pixels = video_mode.resolutionX * video_mode.resolutionY;
+            if( static_cast<int32_t>( video_mode.pixelFormat ) == K4A_PIXEL_FORMAT_NV12 ){
+                return pixels + pixels / 2;
+            }
+            return pixels * static_cast<int32_t>( bytes_per_pixel );
+        }
+
+        void K4AColorStream::update_video_mode()
+        {
+            const k4a::calibration& calibration = k4a_device->getCalibration();
 
-            video_mode.pixelFormat = ONI_PIXEL_FORMAT_RGB888;
+            video_mode.pixelFormat = static_cast<OniPixelFormat>( k4a_device->getColorPixelFormat() );
             video_mode.resolutionX = calibration.color_camera_calibration.resolution_width;
             video_mode.resolutionY = calibration.color_camera_calibration.resolution_height;
-            video_mode.fps = 30;
+            video_mode.fps = k4a_device->getFps();
 
-            constexpr int32_t channels = 3;
-            bytes_per_pixel = sizeof( uint8_t ) * channels;
+            // Bytes per pixel of first plane, stride of NV12 is stride of Y plane
+            switch( static_cast<int32_t>( video_mode.pixelFormat ) ){
+                case K4A_PIXEL_FORMAT_BGRA32:
+                    bytes_per_pixel = sizeof( uint8_t ) * 4;
+                    break;
+                case ONI_PIXEL_FORMAT_YUYV:
+                    bytes_per_pixel = sizeof( uint8_t ) * 2;
+                    break;
+                case K4A_PIXEL_FORMAT_NV12:
+                    bytes_per_pixel = sizeof( uint8_t );
+                    break;
+                case ONI_PIXEL_FORMAT_RGB888:
+                case ONI_PIXEL_FORMAT_JPEG:
+                default:
+                    bytes_per_pixel = sizeof( uint8_t ) * 3;
+                    break;
+            }
 
             switch( calibration.color_camera_calibration.resolution_height ){
                 case  720:
@@ -241,80 +627,140 @@ namespace oni
             }
         }
 
-        K4AColorStream::~K4AColorStream()
-        {
-            K4ALogDebug( "K4AColorStream::~K4AColorStream" );
-        }
-
         void K4AColorStream::MainLoop()
         {
             K4ATraceFunc( "" );
 
-            int32_t frame_index = 0;
+            K4AStreamCounters& counters = k4a_capture->get_counters( sensor_type );
 
             while( is_running ){
-                std::pair<std::vector<uint8_t>, std::chrono::microseconds> data;
-                const bool result = k4a_capture->get_color_image( data );
+                K4AFrame frame;
+                const bool result = queue.wait_pop( frame, std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                 if( !result ){
-                    std::this_thread::sleep_for( std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                     continue;
                 }
-
-                std::vector<uint8_t> color_image     = data.first;
-                std::chrono::microseconds time_stamp = data.second;
+                frame.stage_times.dequeue = std::chrono::steady_clock::now();
+
+                const k4a::image& color_image        = frame.image;
+                std::chrono::microseconds time_stamp = frame.time_stamp;
+
+                // Format is taken from image, frames that were queued before format was changed keep their format
+                int32_t pixel_format = ONI_PIXEL_FORMAT_RGB888;
+                bool is_decoded = false;
+                switch( color_image.get_format() ){
+                    case K4A_IMAGE_FORMAT_CUSTOM:
+                        // RGB888 decoded from MJPG by decoder pool of capture
+                        is_decoded = true;
+                        break;
+                    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+                        if( static_cast<int32_t>( video_mode.pixelFormat ) == K4A_PIXEL_FORMAT_BGRA32 ){
+                            pixel_format = K4A_PIXEL_FORMAT_BGRA32;
+                        }
+                        break;
+                    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+                        pixel_format = ONI_PIXEL_FORMAT_YUYV;
+                        break;
+                    case K4A_IMAGE_FORMAT_COLOR_NV12:
+                        pixel_format = K4A_PIXEL_FORMAT_NV12;
+                        break;
+                    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+                        pixel_format = ONI_PIXEL_FORMAT_JPEG;
+                        break;
+                    default:
+                        K4ATraceError( "color format %d is not supported", static_cast<int>( color_image.get_format() ) );
+                        continue;
+                }
 
                 OniFrame* pFrame = getServices().acquireFrame();
 
-                k4a::calibration calibration = k4a_device->getCalibration();
-                const int32_t width  = calibration.color_camera_calibration.resolution_width;
-                const int32_t height = calibration.color_camera_calibration.resolution_height;
+                const int32_t width  = color_image.get_width_pixels();
+                const int32_t height = color_image.get_height_pixels();
+
+                // Native formats are delivered as sent by source, without cropping and mirroring
+                const bool is_native = ( pixel_format != ONI_PIXEL_FORMAT_RGB888 );
+                const OniCropping region = is_native ? OniCropping{ FALSE, 0, 0, width, height } : get_crop_region( width, height );
+                const size_t native_size = is_native ? color_image.get_size() : 0;
+                const size_t frame_size  = is_native ? native_size : static_cast<size_t>( region.width ) * region.height * sizeof( OniRGB888Pixel );
+                if( frame_size > static_cast<size_t>( pFrame->dataSize ) ){
+                    K4ATraceError( "color frame of %d bytes does not fit into %d bytes", static_cast<int>( frame_size ), pFrame->dataSize );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
 
-                pFrame->frameIndex            = frame_index++;
-                pFrame->videoMode.pixelFormat = ONI_PIXEL_FORMAT_RGB888;
+                pFrame->frameIndex            = frame.index;
+                pFrame->videoMode.pixelFormat = static_cast<OniPixelFormat>( pixel_format );
                 pFrame->videoMode.resolutionX = width;
                 pFrame->videoMode.resolutionY = height;
-                pFrame->videoMode.fps         = 30;
-                pFrame->width                 = width;
-                pFrame->height                = height;
-                pFrame->cropOriginX           = 0;
-                pFrame->cropOriginY           = 0;
-                pFrame->croppingEnabled       = FALSE;
+                pFrame->videoMode.fps         = video_mode.fps;
+                pFrame->width                 = region.width;
+                pFrame->height                = region.height;
+                pFrame->cropOriginX           = region.originX;
+                pFrame->cropOriginY           = region.originY;
+                pFrame->croppingEnabled       = region.enabled;
                 pFrame->sensorType            = ONI_SENSOR_COLOR;
-                pFrame->stride                = width * sizeof( OniRGB888Pixel );
+                pFrame->stride                = is_native ? color_image.get_stride_bytes() : region.width * sizeof( OniRGB888Pixel );
                 pFrame->timestamp             = time_stamp.count();
 
-                OniRGB888Pixel* pixels = reinterpret_cast<OniRGB888Pixel*>( pFrame->data );
-                uint8_t* buffer = reinterpret_cast<uint8_t*>( &color_image[0] );
-                constexpr int32_t channels = 4;
-                const int32_t stride = width * channels;
-                #pragma omp parallel for
-                for( int32_t y = 0; y < height; y++ ){
-                    for( int32_t x = 0; x < width; x++ ){
-                        int32_t buffer_index = y * stride + x * channels;
-                        int32_t pixels_index = y * width  + x;
-                        pixels[pixels_index].b = buffer[buffer_index + 0];
-                        pixels[pixels_index].g = buffer[buffer_index + 1];
-                        pixels[pixels_index].r = buffer[buffer_index + 2];
+                if( is_native ){
+                    // Size of JPEG changes with each frame
+                    std::memcpy( pFrame->data, color_image.get_buffer(), native_size );
+                    pFrame->dataSize = static_cast<int>( native_size );
+                }
+                else{
+                    // Only pixels of region are converted, and mirrored in the same pass
+                    const bool mirror = is_mirror;
+                    const int32_t source_x = mirror ? width - region.originX - region.width : region.originX;
+                    uint8_t* pixels = reinterpret_cast<uint8_t*>( pFrame->data );
+                    const int32_t color_stride = color_image.get_stride_bytes();
+                    const uint8_t* buffer = color_image.get_buffer() + static_cast<size_t>( region.originY ) * color_stride + source_x * ( is_decoded ? 3 : 4 );
+                    if( is_decoded ){
+                        copy_rgb888( buffer, color_stride, pixels, pFrame->stride, region.width, region.height, mirror );
+                    }
+                    else{
+                        convert_bgra_to_rgb( buffer, color_stride, pixels, pFrame->stride, region.width, region.height, mirror );
                     }
                 }
 
+                frame.stage_times.convert = std::chrono::steady_clock::now();
+                stage_times = frame.stage_times;
+
                 raiseNewFrame( pFrame );
                 getServices().releaseFrame( pFrame );
+
+                counters.count_delivered( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - frame.stage_times.capture ) );
             }
         }
 
         K4ADepthStream::K4ADepthStream( class K4ADevice* k4a_device )
-            : K4AStream( k4a_device )
+            : K4AStream( k4a_device, ONI_SENSOR_DEPTH )
         {
             K4ALogDebug( "K4ADepthStream::K4ADepthStream" );
 
-            k4a::calibration calibration = k4a_device->getCalibration();
+            update_video_mode();
+        }
+
+        K4ADepthStream::~K4ADepthStream()
+        {
+            K4ALogDebug( "K4ADepthStream::~K4ADepthStream" );
+        }
+
+        void K4ADepthStream::update_video_mode()
+        {
+            // Registration mode may be changed by device after stream was created
+            registration_mode = k4a_device->getRegistrationMode();
+            {
+                // Table is built on first conversion, not for every mode change
+                std::lock_guard<std::mutex> lock( calibration_table_mutex );
+                std::atomic_store( &calibration_table, std::shared_ptr<const K4ACalibrationTable>() );
+            }
+
+            const k4a::calibration& calibration = k4a_device->getCalibration();
             k4a_calibration_camera_t camera_calibration = ( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ) ? calibration.color_camera_calibration : calibration.depth_camera_calibration;
 
             video_mode.pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
             video_mode.resolutionX = camera_calibration.resolution_width;
             video_mode.resolutionY = camera_calibration.resolution_height;
-            video_mode.fps         = 30;
+            video_mode.fps         = k4a_device->getFps();
 
             bytes_per_pixel = sizeof( uint16_t );
 
@@ -356,70 +802,247 @@ namespace oni
             }
         }
 
-        K4ADepthStream::~K4ADepthStream()
-        {
-            K4ALogDebug( "K4ADepthStream::~K4ADepthStream" );
-        }
-
         void K4ADepthStream::MainLoop()
         {
             K4ATraceFunc( "" );
 
-            int32_t frame_index = 0;
+            K4AStreamCounters& counters = k4a_capture->get_counters( sensor_type );
 
             while( is_running ){
-                std::pair<std::vector<uint16_t>, std::chrono::microseconds> data;
-                const bool result = k4a_capture->get_depth_image( data );
+                K4AFrame frame;
+                const bool result = queue.wait_pop( frame, std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                 if( !result ){
-                    std::this_thread::sleep_for( std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                     continue;
                 }
+                frame.stage_times.dequeue = std::chrono::steady_clock::now();
 
-                std::vector<uint16_t> depth_image    = data.first;
-                std::chrono::microseconds time_stamp = data.second;
+                const k4a::image& depth_image        = frame.image;
+                std::chrono::microseconds time_stamp = frame.time_stamp;
 
                 OniFrame* pFrame = getServices().acquireFrame();
 
-                k4a::calibration calibration = k4a_device->getCalibration();
-                k4a_calibration_camera_t camera_calibration = ( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ) ? calibration.color_camera_calibration : calibration.depth_camera_calibration;
-                const int32_t width  = camera_calibration.resolution_width;
-                const int32_t height = camera_calibration.resolution_height;
+                const int32_t width  = depth_image.get_width_pixels();
+                const int32_t height = depth_image.get_height_pixels();
+                const bool mirror = is_mirror;
+                const OniCropping region = get_crop_region( width, height );
+
+                // Frame is allocated for current video mode, frames of previous mode are dropped
+                if( static_cast<size_t>( region.width ) * region.height * sizeof( OniDepthPixel ) > static_cast<size_t>( pFrame->dataSize ) ){
+                    K4ATraceError( "depth frame %dx%d does not fit into %d bytes", region.width, region.height, pFrame->dataSize );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
+
+                if( !is_region_filled( frame, region, mirror, width ) ){
+                    K4ALogDebug( "depth frame %d was registered for previous cropping", frame.index );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
 
-                pFrame->frameIndex            = frame_index++;
+                pFrame->frameIndex            = frame.index;
                 pFrame->videoMode.pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
                 pFrame->videoMode.resolutionX = width;
                 pFrame->videoMode.resolutionY = height;
-                pFrame->videoMode.fps         = 30;
-                pFrame->width                 = width;
-                pFrame->height                = height;
-                pFrame->cropOriginX           = 0;
-                pFrame->cropOriginY           = 0;
-                pFrame->croppingEnabled       = FALSE;
+                pFrame->videoMode.fps         = video_mode.fps;
+                pFrame->width                 = region.width;
+                pFrame->height                = region.height;
+                pFrame->cropOriginX           = region.originX;
+                pFrame->cropOriginY           = region.originY;
+                pFrame->croppingEnabled       = region.enabled;
                 pFrame->sensorType            = ONI_SENSOR_DEPTH;
-                pFrame->stride                = width * sizeof( OniDepthPixel );
+                pFrame->stride                = region.width * sizeof( OniDepthPixel );
                 pFrame->timestamp             = time_stamp.count();
 
-                OniDepthPixel* pixels = reinterpret_cast<OniDepthPixel*>( pFrame->data );
-                uint16_t* buffer = reinterpret_cast<uint16_t*>( &depth_image[0] );
-                const size_t size = depth_image.size() * sizeof( uint16_t );
-                memcpy( pixels, buffer, size );
+                copy_region( depth_image, region, mirror, pFrame->data );
+
+                frame.stage_times.convert = std::chrono::steady_clock::now();
+                stage_times = frame.stage_times;
 
                 raiseNewFrame( pFrame );
                 getServices().releaseFrame( pFrame );
+
+                counters.count_delivered( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - frame.stage_times.capture ) );
+            }
+        }
+
+        K4APointCloudStream::K4APointCloudStream( class K4ADevice* k4a_device )
+            : K4ADepthStream( k4a_device ),
+              point_format( K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT )
+        {
+            K4ALogDebug( "K4APointCloudStream::K4APointCloudStream" );
+
+            update_video_mode();
+        }
+
+        K4APointCloudStream::~K4APointCloudStream()
+        {
+            K4ALogDebug( "K4APointCloudStream::~K4APointCloudStream" );
+        }
+
+        OniStatus K4APointCloudStream::setProperty( int propertyId, const void* data, int dataSize )
+        {
+            // Points are not reordered, mirroring belongs to images
+            if( propertyId == ONI_STREAM_PROPERTY_MIRRORING ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+            if( propertyId != ONI_STREAM_PROPERTY_VIDEO_MODE ){
+                return K4ADepthStream::setProperty( propertyId, data, dataSize );
+            }
+            if( !data || ( dataSize != sizeof( OniVideoMode ) ) ){
+                return ONI_STATUS_NOT_IMPLEMENTED;
+            }
+
+            // Resolution and frame rate are those of depth sensor, only format of points belongs to this stream
+            OniVideoMode mode = *reinterpret_cast<const OniVideoMode*>( data );
+            const int32_t format = static_cast<int32_t>( mode.pixelFormat );
+            if( format != K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT && format != K4A_PIXEL_FORMAT_POINT_XYZ_INT16 ){
+                return ONI_STATUS_NOT_SUPPORTED;
+            }
+            mode.pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
+
+            const OniStatus status = k4a_device->setVideoMode( ONI_SENSOR_DEPTH, mode );
+            if( status == ONI_STATUS_OK ){
+                point_format = format;
+                update_video_mode();
+            }
+            return status;
+        }
+
+        OniBool K4APointCloudStream::isPropertySupported( int propertyId )
+        {
+            if( propertyId == ONI_STREAM_PROPERTY_MIRRORING ){
+                return FALSE;
+            }
+            return K4ADepthStream::isPropertySupported( propertyId );
+        }
+
+        int K4APointCloudStream::getRequiredFrameSize()
+        {
+            // OpenNI does not know size of custom pixel formats
+            return video_mode.resolutionX * video_mode.resolutionY * static_cast<int32_t>( bytes_per_pixel );
+        }
+
+        void K4APointCloudStream::update_video_mode()
+        {
+            K4ADepthStream::update_video_mode();
+
+            video_mode.pixelFormat = static_cast<OniPixelFormat>( point_format );
+            bytes_per_pixel = ( point_format == K4A_PIXEL_FORMAT_POINT_XYZ_INT16 ) ? sizeof( K4APointXYZInt16 ) : sizeof( K4APointXYZFloat );
+
+            // Registered depth is depth of color camera, so points are unprojected with rays of color camera.
+            // Table is built here, before frames of new mode reach stream thread.
+            const k4a_calibration_type_t camera = ( registration_mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ) ? K4A_CALIBRATION_TYPE_COLOR : K4A_CALIBRATION_TYPE_DEPTH;
+            std::atomic_store( &point_cloud_table, k4a_device->getPointCloudTable( camera ) );
+        }
+
+        void K4APointCloudStream::MainLoop()
+        {
+            K4ATraceFunc( "" );
+
+            K4AStreamCounters& counters = k4a_capture->get_counters( sensor_type );
+
+            while( is_running ){
+                K4AFrame frame;
+                const bool result = queue.wait_pop( frame, std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
+                if( !result ){
+                    continue;
+                }
+                frame.stage_times.dequeue = std::chrono::steady_clock::now();
+
+                const k4a::image& depth_image        = frame.image;
+                std::chrono::microseconds time_stamp = frame.time_stamp;
+
+                const int32_t width  = depth_image.get_width_pixels();
+                const int32_t height = depth_image.get_height_pixels();
+
+                // Frames that were in flight when mode or registration was changed do not match table of new mode, they are dropped
+                const std::shared_ptr<const K4APointCloudTable> table = std::atomic_load( &point_cloud_table );
+                if( !table || table->get_width() != width || table->get_height() != height ){
+                    K4ALogDebug( "depth image %dx%d does not match point cloud table of current mode", width, height );
+                    continue;
+                }
+
+                const int32_t format = point_format;
+                const int32_t point_size = ( format == K4A_PIXEL_FORMAT_POINT_XYZ_INT16 ) ? sizeof( K4APointXYZInt16 ) : sizeof( K4APointXYZFloat );
+
+                OniFrame* pFrame = getServices().acquireFrame();
+                if( pFrame->dataSize < width * height * point_size ){
+                    K4ATraceError( "frame of %d bytes is too small for point cloud %dx%d", pFrame->dataSize, width, height );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
+
+                const OniCropping region = get_crop_region( width, height );
+                if( !is_region_filled( frame, region, false, width ) ){
+                    K4ALogDebug( "depth frame %d was registered for previous cropping", frame.index );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
+
+                pFrame->frameIndex            = frame.index;
+                pFrame->videoMode.pixelFormat = static_cast<OniPixelFormat>( format );
+                pFrame->videoMode.resolutionX = width;
+                pFrame->videoMode.resolutionY = height;
+                pFrame->videoMode.fps         = video_mode.fps;
+                pFrame->width                 = region.width;
+                pFrame->height                = region.height;
+                pFrame->cropOriginX           = region.originX;
+                pFrame->cropOriginY           = region.originY;
+                pFrame->croppingEnabled       = region.enabled;
+                pFrame->sensorType            = static_cast<OniSensorType>( K4A_SENSOR_POINT_CLOUD );
+                pFrame->stride                = region.width * point_size;
+                pFrame->timestamp             = time_stamp.count();
+
+                // Rows of region are unprojected into packed rows of frame
+                const uint16_t* buffer = reinterpret_cast<const uint16_t*>( depth_image.get_buffer() );
+                const int32_t blocks = ( region.height + CONVERT_BLOCK_ROWS - 1 ) / CONVERT_BLOCK_ROWS;
+                concurrency::parallel_for( 0, blocks, [&]( int32_t block ){
+                    const int32_t begin_y = block * CONVERT_BLOCK_ROWS;
+                    const int32_t end_y   = std::min( begin_y + CONVERT_BLOCK_ROWS, region.height );
+                    for( int32_t y = begin_y; y < end_y; y++ ){
+                        const size_t begin = static_cast<size_t>( region.originY + y ) * width + region.originX;
+                        const size_t end   = begin + region.width;
+                        const size_t row   = static_cast<size_t>( y ) * region.width;
+                        if( format == K4A_PIXEL_FORMAT_POINT_XYZ_INT16 ){
+                            table->unproject( buffer, reinterpret_cast<K4APointXYZInt16*>( pFrame->data ) + row, begin, end );
+                        }
+                        else{
+                            table->unproject( buffer, reinterpret_cast<K4APointXYZFloat*>( pFrame->data ) + row, begin, end );
+                        }
+                    }
+                } );
+
+                frame.stage_times.convert = std::chrono::steady_clock::now();
+                stage_times = frame.stage_times;
+
+                raiseNewFrame( pFrame );
+                getServices().releaseFrame( pFrame );
+
+                counters.count_delivered( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - frame.stage_times.capture ) );
             }
         }
 
         K4AInfraredStream::K4AInfraredStream( class K4ADevice* k4a_device )
-            : K4AStream( k4a_device )
+            : K4AStream( k4a_device, ONI_SENSOR_IR )
         {
             K4ALogDebug( "K4AInfraredStream::K4AInfraredStream" );
 
-            k4a::calibration calibration = k4a_device->getCalibration();
+            update_video_mode();
+        }
 
-            video_mode.pixelFormat = ONI_PIXEL_FORMAT_DEPTH_1_MM;
+        K4AInfraredStream::~K4AInfraredStream()
+        {
+            K4ALogDebug( "K4AInfraredStream::~K4AInfraredStream" );
+        }
+
+        void K4AInfraredStream::update_video_mode()
+        {
+            const k4a::calibration& calibration = k4a_device->getCalibration();
+
+            video_mode.pixelFormat = ONI_PIXEL_FORMAT_GRAY16;
             video_mode.resolutionX = calibration.depth_camera_calibration.resolution_width;
             video_mode.resolutionY = calibration.depth_camera_calibration.resolution_height;
-            video_mode.fps         = 30;
+            video_mode.fps         = k4a_device->getFps();
 
             bytes_per_pixel = sizeof( uint16_t );
 
@@ -439,55 +1062,59 @@ namespace oni
             }
         }
 
-        K4AInfraredStream::~K4AInfraredStream()
-        {
-            K4ALogDebug( "K4AInfraredStream::~K4AInfraredStream" );
-        }
-
         void K4AInfraredStream::MainLoop()
         {
             K4ATraceFunc( "" );
 
-            int32_t frame_index = 0;
+            K4AStreamCounters& counters = k4a_capture->get_counters( sensor_type );
 
             while( is_running ){
-                std::pair<std::vector<uint16_t>, std::chrono::microseconds> data;
-                const bool result = k4a_capture->get_infrared_image( data );
+                K4AFrame frame;
+                const bool result = queue.wait_pop( frame, std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                 if( !result ){
-                    std::this_thread::sleep_for( std::chrono::milliseconds( REQUEST_WAIT_TIME ) );
                     continue;
                 }
+                frame.stage_times.dequeue = std::chrono::steady_clock::now();
 
-                std::vector<uint16_t> infrared_image = data.first;
-                std::chrono::microseconds time_stamp = data.second;
+                const k4a::image& infrared_image     = frame.image;
+                std::chrono::microseconds time_stamp = frame.time_stamp;
 
                 OniFrame* pFrame = getServices().acquireFrame();
 
-                k4a::calibration calibration = k4a_device->getCalibration();
-                const int32_t width  = calibration.depth_camera_calibration.resolution_width;
-                const int32_t height = calibration.depth_camera_calibration.resolution_height;
+                const int32_t width  = infrared_image.get_width_pixels();
+                const int32_t height = infrared_image.get_height_pixels();
+                const OniCropping region = get_crop_region( width, height );
 
-                pFrame->frameIndex            = frame_index++;
+                // Frame is allocated for current video mode, frames of previous mode are dropped
+                if( static_cast<size_t>( region.width ) * region.height * sizeof( OniGrayscale16Pixel ) > static_cast<size_t>( pFrame->dataSize ) ){
+                    K4ATraceError( "infrared frame %dx%d does not fit into %d bytes", region.width, region.height, pFrame->dataSize );
+                    getServices().releaseFrame( pFrame );
+                    continue;
+                }
+
+                pFrame->frameIndex            = frame.index;
                 pFrame->videoMode.pixelFormat = ONI_PIXEL_FORMAT_GRAY16;
                 pFrame->videoMode.resolutionX = width;
                 pFrame->videoMode.resolutionY = height;
-                pFrame->videoMode.fps         = 30;
-                pFrame->width                 = width;
-                pFrame->height                = height;
-                pFrame->cropOriginX           = 0;
-                pFrame->cropOriginY           = 0;
-                pFrame->croppingEnabled       = FALSE;
+                pFrame->videoMode.fps         = video_mode.fps;
+                pFrame->width                 = region.width;
+                pFrame->height                = region.height;
+                pFrame->cropOriginX           = region.originX;
+                pFrame->cropOriginY           = region.originY;
+                pFrame->croppingEnabled       = region.enabled;
                 pFrame->sensorType            = ONI_SENSOR_IR;
-                pFrame->stride                = width * sizeof( OniGrayscale16Pixel );
+                pFrame->stride                = region.width * sizeof( OniGrayscale16Pixel );
                 pFrame->timestamp             = time_stamp.count();
 
-                OniGrayscale16Pixel* pixels = reinterpret_cast< OniGrayscale16Pixel* >( pFrame->data );
-                uint16_t* buffer = reinterpret_cast< uint16_t* >( &infrared_image[0] );
-                const size_t size = infrared_image.size() * sizeof( uint16_t );
-                memcpy( pixels, buffer, size );
+                copy_region( infrared_image, region, is_mirror, pFrame->data );
+
+                frame.stage_times.convert = std::chrono::steady_clock::now();
+                stage_times = frame.stage_times;
 
                 raiseNewFrame( pFrame );
                 getServices().releaseFrame( pFrame );
+
+                counters.count_delivered( std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - frame.stage_times.capture ) );
             }
         }
     }
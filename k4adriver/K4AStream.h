@@ -1,14 +1,20 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <k4a/k4a.hpp>
 #include <Driver/OniDriverAPI.h>
 
 #include "K4ADevice.h"
+#include "K4ACalibrationTable.h"
+#include "K4APointCloudTable.h"
+#include "K4AFrameQueue.h"
+#include "K4AProperties.h"
 
-#define REQUEST_WAIT_TIME 5
+#define REQUEST_WAIT_TIME 100
 
 namespace oni
 {
@@ -17,7 +23,7 @@ namespace oni
         class K4AStream : public StreamBase
         {
             public:
-                K4AStream( class K4ADevice* k4a_device );
+                K4AStream( class K4ADevice* k4a_device, OniSensorType sensor_type );
 
                 virtual ~K4AStream();
 
@@ -31,14 +37,50 @@ namespace oni
 
                 virtual OniBool isPropertySupported( int propertyId );
 
+                virtual OniStatus invoke( int commandId, void* data, int dataSize );
+
+                virtual OniBool isCommandSupported( int commandId );
+
                 virtual OniStatus convertDepthToColorCoordinates( StreamBase* colorStream, int depthX, int depthY, OniDepthPixel depthZ, int* pColorX, int* pColorY );
 
+                virtual void update_video_mode() = 0;
+
+                inline class K4ADevice* getDevice() { return k4a_device; }
+                inline OniSensorType getSensorType() const { return sensor_type; }
+                inline K4AFrameQueue* getQueue() { return &queue; }
+
+                // Stage times of frame that is being raised, valid inside new frame callback
+                inline const K4AStageTimes& getStageTimes() const { return stage_times; }
+
                 virtual void MainLoop() = 0;
 
             protected:
                 K4AStream( const K4AStream& );
                 void operator=( const K4AStream& );
 
+                // Coordinate conversions belong to streams that deliver depth images
+                virtual bool is_depth_image_stream() const { return ( sensor_type == ONI_SENSOR_DEPTH ); }
+
+                // Table of current mode, conversions of caller threads read it while update_video_mode replaces it
+                std::shared_ptr<const K4ACalibrationTable> get_calibration_table();
+
+                OniStatus convert_depth_image_to_color( K4ADepthImageToColorCoordinates& conversion );
+
+                OniStatus convert_depth_points_to_color( K4ADepthPointsToColorCoordinates& conversion );
+
+                OniStatus configure_queue( K4AQueuePolicy policy, int32_t depth );
+
+                OniStatus set_cropping( const OniCropping& cropping );
+
+                OniStatus set_mirroring( bool is_mirror );
+
+                // Region of frame that is converted, whole frame when cropping is disabled or does not fit in frame of current mode.
+                // Region is in mirrored frame when mirroring is enabled.
+                OniCropping get_crop_region( int32_t width, int32_t height );
+
+                // Frame registered for region of previous cropping does not hold all pixels of region
+                bool is_region_filled( const K4AFrame& frame, const OniCropping& region, bool is_mirror, int32_t width ) const;
+
                 void capture_thread( void* param )
                 {
                     K4AStream* stream = reinterpret_cast<K4AStream*>( param );
@@ -52,11 +94,23 @@ namespace oni
                 std::atomic_bool is_running;
                 std::thread thread;
 
+                OniSensorType sensor_type;
                 OniImageRegistrationMode registration_mode;
+                std::shared_ptr<const K4ACalibrationTable> calibration_table;
+                std::mutex calibration_table_mutex;
                 OniVideoMode video_mode;
                 size_t bytes_per_pixel;
                 float horizontal_fov;
                 float vertical_fov;
+                K4AStageTimes stage_times;
+
+                K4AFrameQueue queue;
+                K4AQueuePolicy queue_policy;
+                int32_t queue_depth;
+
+                std::mutex cropping_mutex;
+                OniCropping cropping;
+                std::atomic_bool is_mirror;
         };
 
         class K4AColorStream : public K4AStream
@@ -66,6 +120,10 @@ namespace oni
 
             virtual ~K4AColorStream();
 
+            virtual int getRequiredFrameSize();
+
+            void update_video_mode();
+
             void MainLoop();
         };
 
@@ -76,7 +134,37 @@ namespace oni
 
                 virtual ~K4ADepthStream();
 
+                void update_video_mode();
+
+                void MainLoop();
+        };
+
+        // Organized point cloud computed from frames of depth sensor, in color camera when image registration is depth to color
+        class K4APointCloudStream : public K4ADepthStream
+        {
+            public:
+                K4APointCloudStream( class K4ADevice* k4a_device );
+
+                virtual ~K4APointCloudStream();
+
+                virtual OniStatus setProperty( int propertyId, const void* data, int dataSize );
+
+                virtual OniBool isPropertySupported( int propertyId );
+
+                virtual int getRequiredFrameSize();
+
+                void update_video_mode();
+
                 void MainLoop();
+
+            protected:
+                // Stream reads frames of depth sensor, but delivers points
+                virtual bool is_depth_image_stream() const { return false; }
+
+                // Custom pixel formats are outside of range of OniPixelFormat, so they are kept as integer
+                int32_t point_format;
+                // Table of current mode and registration, replaced by update_video_mode while stream thread reads it
+                std::shared_ptr<const K4APointCloudTable> point_cloud_table;
         };
 
         class K4AInfraredStream : public K4AStream
@@ -86,6 +174,8 @@ namespace oni
 
             virtual ~K4AInfraredStream();
 
+            void update_video_mode();
+
             void MainLoop();
         };
     }
@@ -0,0 +1,453 @@
+#include "K4AUtil.h"
+#include "K4ASyntheticSource.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef K4A_WITH_JPEG
+#include <cstdio>
+#include <cstdlib>
+#include <jpeglib.h>
+#endif
+
+namespace oni
+{
+    namespace driver
+    {
+        namespace
+        {
+            const char* const URI_PREFIX = "synthetic://";
+
+            void get_color_size( k4a_color_resolution_t color_resolution, int32_t& width, int32_t& height )
+            {
+                switch( color_resolution ){
+                    case K4A_COLOR_RESOLUTION_720P:  width = 1280; height =  720; break;
+                    case K4A_COLOR_RESOLUTION_1080P: width = 1920; height = 1080; break;
+                    case K4A_COLOR_RESOLUTION_1440P: width = 2560; height = 1440; break;
+                    case K4A_COLOR_RESOLUTION_1536P: width = 2048; height = 1536; break;
+                    case K4A_COLOR_RESOLUTION_2160P: width = 3840; height = 2160; break;
+                    case K4A_COLOR_RESOLUTION_3072P: width = 4096; height = 3072; break;
+                    default:                         width =    0; height =    0; break;
+                }
+            }
+
+            void get_depth_size( k4a_depth_mode_t depth_mode, int32_t& width, int32_t& height )
+            {
+                switch( depth_mode ){
+                    case K4A_DEPTH_MODE_NFOV_2X2BINNED: width =  320; height =  288; break;
+                    case K4A_DEPTH_MODE_NFOV_UNBINNED:  width =  640; height =  576; break;
+                    case K4A_DEPTH_MODE_WFOV_2X2BINNED: width =  512; height =  512; break;
+                    case K4A_DEPTH_MODE_WFOV_UNBINNED:
+                    case K4A_DEPTH_MODE_PASSIVE_IR:     width = 1024; height = 1024; break;
+                    default:                            width =    0; height =    0; break;
+                }
+            }
+
+            void set_identity( k4a_calibration_extrinsics_t& extrinsics )
+            {
+                const float identity[9] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+                std::memcpy( extrinsics.rotation, identity, sizeof( identity ) );
+                extrinsics.translation[0] = extrinsics.translation[1] = extrinsics.translation[2] = 0.0f;
+            }
+
+            void set_camera( k4a_calibration_camera_t& camera, int32_t width, int32_t height, float focal_length, float metric_radius )
+            {
+                camera.resolution_width  = width;
+                camera.resolution_height = height;
+                camera.metric_radius     = metric_radius;
+                camera.intrinsics.type            = K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+                camera.intrinsics.parameter_count = 14;
+
+                k4a_calibration_intrinsic_parameters_t::_param& param = camera.intrinsics.parameters.param;
+                param.cx = ( width  - 1 ) * 0.5f;
+                param.cy = ( height - 1 ) * 0.5f;
+                param.fx = focal_length;
+                param.fy = focal_length;
+                param.metric_radius = metric_radius;
+            }
+
+            // BT.601 limited range like color camera
+            void to_yuv( const uint8_t* bgra, uint8_t& y, uint8_t& u, uint8_t& v )
+            {
+                const int32_t b = bgra[0];
+                const int32_t g = bgra[1];
+                const int32_t r = bgra[2];
+                y = static_cast<uint8_t>( ( (  66 * r + 129 * g +  25 * b + 128 ) >> 8 ) +  16 );
+                u = static_cast<uint8_t>( ( ( -38 * r -  74 * g + 112 * b + 128 ) >> 8 ) + 128 );
+                v = static_cast<uint8_t>( ( ( 112 * r -  94 * g -  18 * b + 128 ) >> 8 ) + 128 );
+            }
+
+            int32_t get_color_stride( k4a_image_format_t color_format, int32_t width )
+            {
+                switch( color_format ){
+                    case K4A_IMAGE_FORMAT_COLOR_YUY2: return width * 2;
+                    case K4A_IMAGE_FORMAT_COLOR_NV12: return width;
+                    default:                          return width * 4;
+                }
+            }
+
+            size_t get_color_buffer_size( k4a_image_format_t color_format, int32_t width, int32_t height )
+            {
+                const size_t size = static_cast<size_t>( get_color_stride( color_format, width ) ) * height;
+                return ( color_format == K4A_IMAGE_FORMAT_COLOR_NV12 ) ? size + size / 2 : size;
+            }
+
+            // Chroma of YUY2 and NV12 is taken from top left pixel of each block
+            void set_color_pixel( uint8_t* buffer, k4a_image_format_t color_format, int32_t width, int32_t height, int32_t x, int32_t y, const uint8_t* bgra )
+            {
+                const size_t index = static_cast<size_t>( y ) * width + x;
+                uint8_t u, v;
+                switch( color_format ){
+                    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+                        to_yuv( bgra, buffer[index * 2], u, v );
+                        if( ( x & 1 ) == 0 ){
+                            buffer[index * 2 + 1] = u;
+                            buffer[index * 2 + 3] = v;
+                        }
+                        break;
+                    case K4A_IMAGE_FORMAT_COLOR_NV12:
+                        to_yuv( bgra, buffer[index], u, v );
+                        if( ( ( x | y ) & 1 ) == 0 ){
+                            uint8_t* chroma = buffer + static_cast<size_t>( width ) * height + static_cast<size_t>( y / 2 ) * width + x;
+                            chroma[0] = u;
+                            chroma[1] = v;
+                        }
+                        break;
+                    default:
+                        std::memcpy( buffer + index * 4, bgra, 4 );
+                        break;
+                }
+            }
+
+#ifdef K4A_WITH_JPEG
+            std::vector<uint8_t> encode_jpeg( const std::vector<uint8_t>& bgra, int32_t width, int32_t height )
+            {
+                jpeg_compress_struct info;
+                jpeg_error_mgr error;
+                info.err = jpeg_std_error( &error );
+                jpeg_create_compress( &info );
+
+                unsigned char* buffer = nullptr;
+                unsigned long size = 0;
+                jpeg_mem_dest( &info, &buffer, &size );
+
+                info.image_width      = width;
+                info.image_height     = height;
+                info.input_components = 3;
+                info.in_color_space   = JCS_RGB;
+                jpeg_set_defaults( &info );
+                jpeg_set_quality( &info, 90, TRUE );
+                jpeg_start_compress( &info, TRUE );
+
+                std::vector<uint8_t> row( static_cast<size_t>( width ) * 3 );
+                while( info.next_scanline < info.image_height ){
+                    const uint8_t* pixel = &bgra[static_cast<size_t>( info.next_scanline ) * width * 4];
+                    for( int32_t x = 0; x < width; x++, pixel += 4 ){
+                        row[x * 3 + 0] = pixel[2];
+                        row[x * 3 + 1] = pixel[1];
+                        row[x * 3 + 2] = pixel[0];
+                    }
+                    JSAMPROW rows[1] = { &row[0] };
+                    jpeg_write_scanlines( &info, rows, 1 );
+                }
+
+                jpeg_finish_compress( &info );
+                jpeg_destroy_compress( &info );
+
+                const std::vector<uint8_t> jpeg( buffer, buffer + size );
+                std::free( buffer );
+                return jpeg;
+            }
+#endif
+
+            void release_jpeg( void* buffer, void* )
+            {
+                delete[] static_cast<uint8_t*>( buffer );
+            }
+
+            // Nominal calibration of Azure Kinect without lens distortion
+            k4a::calibration synthesize_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution )
+            {
+                k4a::calibration calibration;
+                static_cast<k4a_calibration_t&>( calibration ) = k4a_calibration_t();
+                calibration.depth_mode       = depth_mode;
+                calibration.color_resolution = color_resolution;
+
+                int32_t depth_width, depth_height;
+                get_depth_size( depth_mode, depth_width, depth_height );
+                const bool is_binned = ( depth_mode == K4A_DEPTH_MODE_NFOV_2X2BINNED || depth_mode == K4A_DEPTH_MODE_WFOV_2X2BINNED );
+                set_camera( calibration.depth_camera_calibration, depth_width, depth_height, is_binned ? 252.0f : 504.0f, 1.74f );
+
+                int32_t color_width, color_height;
+                get_color_size( color_resolution, color_width, color_height );
+                set_camera( calibration.color_camera_calibration, color_width, color_height, 0.4727f * color_width, 1.7f );
+
+                for( int32_t source = 0; source < K4A_CALIBRATION_TYPE_NUM; source++ ){
+                    for( int32_t target = 0; target < K4A_CALIBRATION_TYPE_NUM; target++ ){
+                        set_identity( calibration.extrinsics[source][target] );
+                    }
+                }
+
+                // Color camera is tilted 6 degrees down and placed 32 mm beside depth camera
+                const float angle = static_cast<float>( 6.0 * 0.01745329251994329576923690768489 );
+                const float rotation[9] = { 1.0f, 0.0f, 0.0f, 0.0f, std::cos( angle ), -std::sin( angle ), 0.0f, std::sin( angle ), std::cos( angle ) };
+                const float translation[3] = { -32.0f, -2.0f, 4.0f };
+
+                k4a_calibration_extrinsics_t& depth_to_color = calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+                k4a_calibration_extrinsics_t& color_to_depth = calibration.extrinsics[K4A_CALIBRATION_TYPE_COLOR][K4A_CALIBRATION_TYPE_DEPTH];
+                for( int32_t row = 0; row < 3; row++ ){
+                    for( int32_t column = 0; column < 3; column++ ){
+                        depth_to_color.rotation[row * 3 + column] = rotation[row * 3 + column];
+                        color_to_depth.rotation[row * 3 + column] = rotation[column * 3 + row];
+                    }
+                    depth_to_color.translation[row] = translation[row];
+                }
+                for( int32_t row = 0; row < 3; row++ ){
+                    color_to_depth.translation[row] = -( color_to_depth.rotation[row * 3 + 0] * translation[0] + color_to_depth.rotation[row * 3 + 1] * translation[1] + color_to_depth.rotation[row * 3 + 2] * translation[2] );
+                }
+                calibration.color_camera_calibration.extrinsics = depth_to_color;
+                set_identity( calibration.depth_camera_calibration.extrinsics );
+
+                return calibration;
+            }
+        }
+
+        K4ASyntheticSource::K4ASyntheticSource( int32_t id, const std::string& calibration_path )
+            : is_started( false ),
+              configuration( K4A_DEVICE_CONFIG_INIT_DISABLE_ALL ),
+              period( 33333 ),
+              frame_index( 0 ),
+              color_width( 0 ),
+              color_height( 0 ),
+              depth_width( 0 ),
+              depth_height( 0 )
+        {
+            K4ALogDebug( "K4ASyntheticSource::K4ASyntheticSource" );
+
+            serial_number = "synthetic-" + std::to_string( id );
+
+            if( !calibration_path.empty() ){
+                std::ifstream file( calibration_path, std::ios::binary );
+                if( file ){
+                    raw_calibration.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+                    raw_calibration.push_back( 0 );
+                }
+                else{
+                    K4ATraceError( "failed to open calibration %s, nominal calibration is used", calibration_path.c_str() );
+                }
+            }
+        }
+
+        K4ASyntheticSource::~K4ASyntheticSource()
+        {
+            K4ALogDebug( "K4ASyntheticSource::~K4ASyntheticSource" );
+        }
+
+        bool K4ASyntheticSource::is_synthetic( const char* uri )
+        {
+            return ( uri && std::strncmp( uri, URI_PREFIX, std::strlen( URI_PREFIX ) ) == 0 );
+        }
+
+        std::string K4ASyntheticSource::get_serialnum() const
+        {
+            return serial_number;
+        }
+
+        k4a::calibration K4ASyntheticSource::get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const
+        {
+            if( !raw_calibration.empty() ){
+                std::vector<uint8_t> raw = raw_calibration;
+                return k4a::calibration::get_from_raw( raw, depth_mode, color_resolution );
+            }
+
+            return synthesize_calibration( depth_mode, color_resolution );
+        }
+
+        bool K4ASyntheticSource::is_color_format_supported( k4a_image_format_t color_format, k4a_color_resolution_t color_resolution ) const
+        {
+            // Same native formats as device, MJPG needs encoder of libjpeg-turbo
+            switch( color_format ){
+                case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+                    return true;
+#ifdef K4A_WITH_JPEG
+                case K4A_IMAGE_FORMAT_COLOR_MJPG:
+                    return true;
+#endif
+                case K4A_IMAGE_FORMAT_COLOR_NV12:
+                case K4A_IMAGE_FORMAT_COLOR_YUY2:
+                    return ( color_resolution == K4A_COLOR_RESOLUTION_720P );
+                default:
+                    return false;
+            }
+        }
+
+        void K4ASyntheticSource::start_cameras( const k4a_device_configuration_t& configuration )
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            this->configuration = configuration;
+            switch( configuration.camera_fps ){
+                case K4A_FRAMES_PER_SECOND_5:
+                    period = std::chrono::microseconds( 200000 );
+                    break;
+                case K4A_FRAMES_PER_SECOND_15:
+                    period = std::chrono::microseconds( 66667 );
+                    break;
+                case K4A_FRAMES_PER_SECOND_30:
+                default:
+                    period = std::chrono::microseconds( 33333 );
+                    break;
+            }
+
+            render_backgrounds();
+
+            frame_index = 0;
+            next_time   = std::chrono::steady_clock::now() + period;
+            is_started  = true;
+            condition.notify_all();
+        }
+
+        void K4ASyntheticSource::stop_cameras()
+        {
+            K4ATraceFunc( "" );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            is_started = false;
+            condition.notify_all();
+        }
+
+        bool K4ASyntheticSource::get_capture( k4a::capture* capture, std::chrono::milliseconds timeout )
+        {
+            const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + ( ( timeout.count() < 0 ) ? std::chrono::milliseconds( std::chrono::hours( 24 ) ) : timeout );
+
+            std::unique_lock<std::mutex> lock( mutex );
+            while( true ){
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if( is_started && now >= next_time ){
+                    break;
+                }
+                if( now >= deadline ){
+                    return false;
+                }
+                condition.wait_until( lock, is_started ? std::min( next_time, deadline ) : deadline );
+            }
+
+            // Like device, frames are not delivered in burst when consumer was late
+            next_time = std::max( next_time + period, std::chrono::steady_clock::now() );
+
+            *capture = generate( frame_index++ );
+            return true;
+        }
+
+        void K4ASyntheticSource::render_backgrounds()
+        {
+            get_color_size( configuration.color_resolution, color_width, color_height );
+            get_depth_size( configuration.depth_mode, depth_width, depth_height );
+
+            // Color is gradient, depth is slanted floor, infrared is checker pattern
+            // Color is rendered in configured format once, so frames are not converted while streaming
+            color_background.resize( get_color_buffer_size( configuration.color_format, color_width, color_height ) );
+            for( int32_t y = 0; y < color_height; y++ ){
+                for( int32_t x = 0; x < color_width; x++ ){
+                    const uint8_t pixel[4] = { static_cast<uint8_t>( x * 255 / color_width ), static_cast<uint8_t>( y * 255 / color_height ), 64, 255 };
+                    set_color_pixel( &color_background[0], configuration.color_format, color_width, color_height, x, y, pixel );
+                }
+            }
+
+#ifdef K4A_WITH_JPEG
+            // Background of MJPG is encoded once from BGRA32, box is not drawn into compressed frames
+            if( configuration.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG && !color_background.empty() ){
+                color_background = encode_jpeg( color_background, color_width, color_height );
+            }
+#endif
+
+            depth_background.resize( static_cast<size_t>( depth_width ) * depth_height );
+            infrared_background.resize( static_cast<size_t>( depth_width ) * depth_height );
+            for( int32_t y = 0; y < depth_height; y++ ){
+                for( int32_t x = 0; x < depth_width; x++ ){
+                    const size_t index = static_cast<size_t>( y ) * depth_width + x;
+                    depth_background[index]    = static_cast<uint16_t>( 1500 + 1000 * y / depth_height );
+                    infrared_background[index] = static_cast<uint16_t>( ( ( ( x / 16 ) + ( y / 16 ) ) & 1 ) ? 600 : 200 );
+                }
+            }
+        }
+
+        k4a::capture K4ASyntheticSource::generate( int32_t frame_index ) const
+        {
+            k4a::capture capture = k4a::capture::create();
+            const std::chrono::microseconds time_stamp( period * frame_index );
+
+            // Box moves horizontally by 4 depth pixels per frame
+            const int32_t side  = std::max( depth_height / 4, 1 );
+            const int32_t box_x = ( depth_width > side ) ? ( frame_index * 4 ) % ( depth_width - side ) : 0;
+            const int32_t box_y = ( depth_height - side ) / 2;
+
+            if( color_width > 0 && configuration.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG ){
+                // Each frame owns copy of encoded background like frames of device
+                uint8_t* buffer = new uint8_t[color_background.size()];
+                std::memcpy( buffer, &color_background[0], color_background.size() );
+                k4a::image color = k4a::image::create_from_buffer( K4A_IMAGE_FORMAT_COLOR_MJPG, color_width, color_height, 0, buffer, color_background.size(), &release_jpeg, nullptr );
+                color.set_timestamp( time_stamp );
+                capture.set_color_image( color );
+            }
+            else if( color_width > 0 ){
+                const k4a_image_format_t color_format = configuration.color_format;
+                k4a::image color = k4a::image::create( color_format, color_width, color_height, get_color_stride( color_format, color_width ) );
+                uint8_t* buffer = color.get_buffer();
+                std::memcpy( buffer, &color_background[0], color_background.size() );
+                if( depth_width > 0 ){
+                    const int32_t begin_x = box_x * color_width / depth_width;
+                    const int32_t end_x   = ( box_x + side ) * color_width / depth_width;
+                    const int32_t begin_y = box_y * color_height / depth_height;
+                    const int32_t end_y   = ( box_y + side ) * color_height / depth_height;
+                    const uint8_t red[4]  = { 0, 0, 255, 255 };
+                    for( int32_t y = begin_y; y < end_y; y++ ){
+                        for( int32_t x = begin_x; x < end_x; x++ ){
+                            set_color_pixel( buffer, color_format, color_width, color_height, x, y, red );
+                        }
+                    }
+                }
+                color.set_timestamp( time_stamp );
+                capture.set_color_image( color );
+            }
+
+            if( depth_width > 0 ){
+                const bool has_depth = ( configuration.depth_mode != K4A_DEPTH_MODE_PASSIVE_IR );
+                const int32_t stride = depth_width * static_cast<int32_t>( sizeof( uint16_t ) );
+
+                k4a::image infrared = k4a::image::create( K4A_IMAGE_FORMAT_IR16, depth_width, depth_height, stride );
+                uint16_t* infrared_buffer = reinterpret_cast<uint16_t*>( infrared.get_buffer() );
+                std::memcpy( infrared_buffer, &infrared_background[0], infrared_background.size() * sizeof( uint16_t ) );
+
+                k4a::image depth;
+                uint16_t* depth_buffer = nullptr;
+                if( has_depth ){
+                    depth = k4a::image::create( K4A_IMAGE_FORMAT_DEPTH16, depth_width, depth_height, stride );
+                    depth_buffer = reinterpret_cast<uint16_t*>( depth.get_buffer() );
+                    std::memcpy( depth_buffer, &depth_background[0], depth_background.size() * sizeof( uint16_t ) );
+                }
+
+                for( int32_t y = box_y; y < box_y + side; y++ ){
+                    const size_t row = static_cast<size_t>( y ) * depth_width;
+                    std::fill( infrared_buffer + row + box_x, infrared_buffer + row + box_x + side, static_cast<uint16_t>( 2000 ) );
+                    if( depth_buffer ){
+                        std::fill( depth_buffer + row + box_x, depth_buffer + row + box_x + side, static_cast<uint16_t>( 1000 ) );
+                    }
+                }
+
+                infrared.set_timestamp( time_stamp );
+                capture.set_ir_image( infrared );
+                if( depth ){
+                    depth.set_timestamp( time_stamp );
+                    capture.set_depth_image( depth );
+                }
+            }
+
+            return capture;
+        }
+    }
+}
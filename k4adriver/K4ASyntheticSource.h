@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <k4a/k4a.hpp>
+
+#include "K4ASource.h"
+
+namespace oni
+{
+    namespace driver
+    {
+        // Deterministic source that generates patterned depth, color and infrared at configured mode without hardware.
+        // Calibration is parsed from raw calibration that was stored from a device, or synthesized from nominal intrinsics.
+        // Content of frame only depends on frame index, so results of pipeline are reproducible.
+        class K4ASyntheticSource : public K4ASource
+        {
+            public:
+                K4ASyntheticSource( int32_t id, const std::string& calibration_path );
+
+                virtual ~K4ASyntheticSource();
+
+                static bool is_synthetic( const char* uri );
+
+                virtual std::string get_serialnum() const;
+
+                virtual k4a::calibration get_calibration( k4a_depth_mode_t depth_mode, k4a_color_resolution_t color_resolution ) const;
+
+                virtual bool is_color_format_supported( k4a_image_format_t color_format, k4a_color_resolution_t color_resolution ) const;
+
+                virtual void start_cameras( const k4a_device_configuration_t& configuration );
+
+                virtual void stop_cameras();
+
+                virtual bool get_capture( k4a::capture* capture, std::chrono::milliseconds timeout );
+
+            protected:
+                K4ASyntheticSource( const K4ASyntheticSource& );
+                void operator=( const K4ASyntheticSource& );
+
+            private:
+                void render_backgrounds();
+
+                k4a::capture generate( int32_t frame_index ) const;
+
+            protected:
+                std::string serial_number;
+                std::vector<uint8_t> raw_calibration;
+
+                std::mutex mutex;
+                std::condition_variable condition;
+                bool is_started;
+                k4a_device_configuration_t configuration;
+                std::chrono::microseconds period;
+                std::chrono::steady_clock::time_point next_time;
+                int32_t frame_index;
+
+                // Backgrounds of current mode, box that moves with frame index is drawn over them
+                int32_t color_width, color_height;
+                int32_t depth_width, depth_height;
+                std::vector<uint8_t> color_background;
+                std::vector<uint16_t> depth_background;
+                std::vector<uint16_t> infrared_background;
+        };
+    }
+}
@@ -2,6 +2,8 @@
 
 #include <iostream>
 
+#include "K4ALogger.h"
+
 #ifndef XN_NEW
 #define XN_NEW(type, arg) new type(arg)
 #endif
@@ -14,6 +16,21 @@
 #define XN_MODULE_PROPERTY_AHB 0x1080E005
 #endif
 
-#define K4ATraceError( format, ... ) printf( "[K4A] ERROR at FILE %s LINE %d FUNC %s\n\t" format "\n", __FILE__, __LINE__, __FUNCTION__, ##  __VA_ARGS__)
-#define K4ATraceFunc( format, ... )  printf( "[K4A] %s " format "\n", __FUNCTION__, ##  __VA_ARGS__)
-#define K4ALogDebug( format, ... )   printf( "[K4A] " format "\n", ## __VA_ARGS__ )
+// Arguments are evaluated only when level is enabled, and macros above K4A_LOG_LEVEL expand to nothing
+#if K4A_LOG_LEVEL >= K4A_LOG_LEVEL_ERROR
+#define K4ATraceError( format, ... ) do{ if( oni::driver::K4ALogger::is_enabled( K4A_LOG_LEVEL_ERROR ) ){ oni::driver::K4ALogger::write( "[K4A] ERROR at FILE %s LINE %d FUNC %s\n\t" format "\n", __FILE__, __LINE__, __FUNCTION__, ##  __VA_ARGS__ ); } }while( 0 )
+#else
+#define K4ATraceError( format, ... ) do{}while( 0 )
+#endif
+
+#if K4A_LOG_LEVEL >= K4A_LOG_LEVEL_TRACE
+#define K4ATraceFunc( format, ... )  do{ if( oni::driver::K4ALogger::is_enabled( K4A_LOG_LEVEL_TRACE ) ){ oni::driver::K4ALogger::write( "[K4A] %s " format "\n", __FUNCTION__, ##  __VA_ARGS__ ); } }while( 0 )
+#else
+#define K4ATraceFunc( format, ... )  do{}while( 0 )
+#endif
+
+#if K4A_LOG_LEVEL >= K4A_LOG_LEVEL_DEBUG
+#define K4ALogDebug( format, ... )   do{ if( oni::driver::K4ALogger::is_enabled( K4A_LOG_LEVEL_DEBUG ) ){ oni::driver::K4ALogger::write( "[K4A] " format "\n", ## __VA_ARGS__ ); } }while( 0 )
+#else
+#define K4ALogDebug( format, ... )   do{}while( 0 )
+#endif
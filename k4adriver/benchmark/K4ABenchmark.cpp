@@ -0,0 +1,955 @@
+// Benchmark of K4ADriver
+// Drives streams of synthetic device (or recording) through driver API in each supported video mode,
+// and writes delivered frame rate, latency of each stage in driver, CPU time and peak RSS as JSON.
+// Registration of table engine is compared with k4a::transformation in each color resolution.
+// Recording is read back through its index, and by scanning chunks of same recording without index.
+//
+// Usage : k4abenchmark [--uri synthetic://0] [--duration 3] [--warmup 1] [--speed 0] [--output k4abenchmark.json]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "K4ADriver.h"
+#include "K4ADevice.h"
+#include "K4AStream.h"
+#include "K4ARegistration.h"
+#include "K4ARecordReader.h"
+
+using namespace oni::driver;
+
+namespace
+{
+    enum Stage
+    {
+        STAGE_CAPTURE_TO_QUEUE,
+        STAGE_QUEUE_TO_DEQUEUE,
+        STAGE_DEQUEUE_TO_CONVERT,
+        STAGE_CONVERT_TO_RAISE,
+        STAGE_CAPTURE_TO_RAISE,
+        STAGE_COUNT
+    };
+
+    const char* const STAGE_NAMES[STAGE_COUNT] = { "capture_to_queue", "queue_to_dequeue", "dequeue_to_convert", "convert_to_raise", "capture_to_raise" };
+
+    const char* get_sensor_name( OniSensorType sensor_type )
+    {
+        switch( static_cast<int32_t>( sensor_type ) ){
+            case ONI_SENSOR_COLOR:       return "color";
+            case ONI_SENSOR_DEPTH:       return "depth";
+            case ONI_SENSOR_IR:          return "ir";
+            case K4A_SENSOR_POINT_CLOUD: return "point_cloud";
+            default:                     return "unknown";
+        }
+    }
+
+    const char* get_format_name( OniPixelFormat pixel_format )
+    {
+        switch( static_cast<int32_t>( pixel_format ) ){
+            case ONI_PIXEL_FORMAT_RGB888:           return "rgb888";
+            case ONI_PIXEL_FORMAT_YUYV:             return "yuyv";
+            case ONI_PIXEL_FORMAT_JPEG:             return "jpeg";
+            case ONI_PIXEL_FORMAT_DEPTH_1_MM:       return "depth16";
+            case ONI_PIXEL_FORMAT_GRAY16:           return "gray16";
+            case K4A_PIXEL_FORMAT_BGRA32:           return "bgra32";
+            case K4A_PIXEL_FORMAT_NV12:             return "nv12";
+            case K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT: return "xyz_float";
+            case K4A_PIXEL_FORMAT_POINT_XYZ_INT16: return "xyz_int16";
+            default:                                return "unknown";
+        }
+    }
+
+    int32_t get_bytes_per_pixel( OniPixelFormat pixel_format )
+    {
+        switch( static_cast<int32_t>( pixel_format ) ){
+            case ONI_PIXEL_FORMAT_RGB888:           return 3;
+            case K4A_PIXEL_FORMAT_BGRA32:           return 4;
+            case ONI_PIXEL_FORMAT_GRAY8:            return 1;
+            case K4A_PIXEL_FORMAT_POINT_XYZ_FLOAT: return sizeof( K4APointXYZFloat );
+            case K4A_PIXEL_FORMAT_POINT_XYZ_INT16: return sizeof( K4APointXYZInt16 );
+            default:                                return 2;
+        }
+    }
+
+    double get_cpu_seconds()
+    {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if( !GetProcessTimes( GetCurrentProcess(), &creation, &exit, &kernel, &user ) ){
+            return 0.0;
+        }
+        const uint64_t kernel_time = ( static_cast<uint64_t>( kernel.dwHighDateTime ) << 32 ) | kernel.dwLowDateTime;
+        const uint64_t user_time   = ( static_cast<uint64_t>( user.dwHighDateTime   ) << 32 ) | user.dwLowDateTime;
+        return ( kernel_time + user_time ) * 1e-7;
+#else
+        rusage usage;
+        if( getrusage( RUSAGE_SELF, &usage ) != 0 ){
+            return 0.0;
+        }
+        return ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) * 1e-6;
+#endif
+    }
+
+    uint64_t get_peak_rss_bytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) ){
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage;
+        if( getrusage( RUSAGE_SELF, &usage ) != 0 ){
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<uint64_t>( usage.ru_maxrss );
+#else
+        return static_cast<uint64_t>( usage.ru_maxrss ) * 1024;
+#endif
+#endif
+    }
+
+    std::string escape_json( const std::string& text )
+    {
+        std::string escaped;
+        for( const char character : text ){
+            if( character == '"' || character == '\\' ){
+                escaped.push_back( '\\' );
+            }
+            escaped.push_back( character );
+        }
+        return escaped;
+    }
+
+    void set_environment( const char* name, const char* value )
+    {
+#ifdef _WIN32
+        _putenv_s( name, value );
+#else
+        setenv( name, value, 1 );
+#endif
+    }
+
+    struct BenchmarkFrame
+    {
+        OniFrame frame;
+        std::vector<uint8_t> data;
+        int32_t references;
+    };
+
+    // Stream of driver with stream services that OpenNI would provide, measures frames that are raised
+    class BenchmarkStream
+    {
+        public:
+            BenchmarkStream( DeviceBase* device, OniSensorType sensor_type )
+                : device( device ),
+                  sensor_type( sensor_type ),
+                  stream( nullptr ),
+                  is_measuring( false )
+            {
+                // Methods of StreamServices hide callbacks of OniStreamServices that have same names
+                OniStreamServices& callbacks = services;
+                callbacks.streamServices              = this;
+                callbacks.getDefaultRequiredFrameSize = &BenchmarkStream::get_default_required_frame_size;
+                callbacks.acquireFrame                = &BenchmarkStream::acquire_frame;
+                callbacks.addFrameRef                 = &BenchmarkStream::add_frame_ref;
+                callbacks.releaseFrame                = &BenchmarkStream::release_frame;
+
+                stream = device->createStream( sensor_type );
+                if( stream ){
+                    stream->setServices( &services );
+                    stream->setNewFrameCallback( &BenchmarkStream::new_frame, this );
+                }
+                reset();
+            }
+
+            ~BenchmarkStream()
+            {
+                if( stream ){
+                    stream->stop();
+                    device->destroyStream( stream );
+                }
+            }
+
+            inline bool is_valid() const { return stream != nullptr; }
+            inline OniSensorType get_sensor_type() const { return sensor_type; }
+
+            bool set_video_mode( const OniVideoMode& video_mode )
+            {
+                return stream->setProperty( ONI_STREAM_PROPERTY_VIDEO_MODE, &video_mode, sizeof( video_mode ) ) == ONI_STATUS_OK;
+            }
+
+            OniVideoMode get_video_mode()
+            {
+                OniVideoMode video_mode = {};
+                int size = sizeof( video_mode );
+                stream->getProperty( ONI_STREAM_PROPERTY_VIDEO_MODE, &video_mode, &size );
+                return video_mode;
+            }
+
+            int get_required_frame_size()
+            {
+                return stream->getRequiredFrameSize();
+            }
+
+            bool start()
+            {
+                return stream->start() == ONI_STATUS_OK;
+            }
+
+            void stop()
+            {
+                stream->stop();
+            }
+
+            void reset()
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                frame_count = 0;
+                index_gaps  = 0;
+                last_index  = -1;
+                for( std::vector<double>& latency : latencies ){
+                    latency.clear();
+                }
+            }
+
+            void measure( bool is_measuring )
+            {
+                this->is_measuring = is_measuring;
+            }
+
+            void write( std::FILE* file, double seconds )
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                const OniVideoMode video_mode = get_video_mode();
+                std::fprintf( file, "        {\n" );
+                std::fprintf( file, "          \"sensor\": \"%s\",\n", get_sensor_name( sensor_type ) );
+                std::fprintf( file, "          \"width\": %d, \"height\": %d, \"fps\": %d, \"pixel_format\": %d,\n", video_mode.resolutionX, video_mode.resolutionY, video_mode.fps, static_cast<int32_t>( video_mode.pixelFormat ) );
+                std::fprintf( file, "          \"frames\": %llu,\n", static_cast<unsigned long long>( frame_count ) );
+                std::fprintf( file, "          \"frames_per_second\": %.3f,\n", seconds > 0.0 ? frame_count / seconds : 0.0 );
+                std::fprintf( file, "          \"index_gaps\": %llu,\n", static_cast<unsigned long long>( index_gaps ) );
+
+                // Drops counted by driver since stream was created
+                K4AStreamStatistics statistics = {};
+                int size = sizeof( statistics );
+                stream->getProperty( K4A_STREAM_PROPERTY_STATISTICS, &statistics, &size );
+                std::fprintf( file, "          \"dropped_queue_full\": %llu, \"dropped_sync\": %llu, \"dropped_registration\": %llu, \"time_stamp_gaps\": %llu,\n",
+                              static_cast<unsigned long long>( statistics.dropped_queue_full ), static_cast<unsigned long long>( statistics.dropped_sync ),
+                              static_cast<unsigned long long>( statistics.dropped_registration ), static_cast<unsigned long long>( statistics.time_stamp_gaps ) );
+                std::fprintf( file, "          \"latency_us\": {\n" );
+                for( int32_t stage = 0; stage < STAGE_COUNT; stage++ ){
+                    std::vector<double>& latency = latencies[stage];
+                    std::sort( latency.begin(), latency.end() );
+                    std::fprintf( file, "            \"%s\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }%s\n",
+                                  STAGE_NAMES[stage], percentile( latency, 0.50 ), percentile( latency, 0.90 ), percentile( latency, 0.99 ), latency.empty() ? 0.0 : latency.back(),
+                                  ( stage + 1 < STAGE_COUNT ) ? "," : "" );
+                }
+                std::fprintf( file, "          }\n" );
+                std::fprintf( file, "        }" );
+            }
+
+            double get_frames_per_second( double seconds )
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                return seconds > 0.0 ? frame_count / seconds : 0.0;
+            }
+
+        protected:
+            BenchmarkStream( const BenchmarkStream& );
+            void operator=( const BenchmarkStream& );
+
+        private:
+            static double percentile( const std::vector<double>& sorted, double rank )
+            {
+                if( sorted.empty() ){
+                    return 0.0;
+                }
+                const size_t index = static_cast<size_t>( rank * ( sorted.size() - 1 ) + 0.5 );
+                return sorted[std::min( index, sorted.size() - 1 )];
+            }
+
+            static int ONI_CALLBACK_TYPE get_default_required_frame_size( void* cookie )
+            {
+                BenchmarkStream* benchmark_stream = reinterpret_cast<BenchmarkStream*>( cookie );
+                const OniVideoMode video_mode = benchmark_stream->get_video_mode();
+                return video_mode.resolutionX * video_mode.resolutionY * get_bytes_per_pixel( video_mode.pixelFormat );
+            }
+
+            static OniFrame* ONI_CALLBACK_TYPE acquire_frame( void* cookie )
+            {
+                BenchmarkStream* benchmark_stream = reinterpret_cast<BenchmarkStream*>( cookie );
+                const int size = benchmark_stream->stream->getRequiredFrameSize();
+
+                // Frames are recycled like frame pool of OpenNI, so that allocation is not measured
+                std::lock_guard<std::mutex> lock( benchmark_stream->mutex );
+                BenchmarkFrame* free_frame = nullptr;
+                for( std::unique_ptr<BenchmarkFrame>& frame : benchmark_stream->frames ){
+                    if( frame->references == 0 ){
+                        free_frame = frame.get();
+                        break;
+                    }
+                }
+                if( !free_frame ){
+                    benchmark_stream->frames.emplace_back( new BenchmarkFrame() );
+                    free_frame = benchmark_stream->frames.back().get();
+                }
+
+                if( free_frame->data.size() < static_cast<size_t>( size ) ){
+                    free_frame->data.resize( size );
+                }
+                std::memset( &free_frame->frame, 0, sizeof( free_frame->frame ) );
+                free_frame->frame.data     = free_frame->data.data();
+                free_frame->frame.dataSize = size;
+                free_frame->references     = 1;
+                return &free_frame->frame;
+            }
+
+            static void ONI_CALLBACK_TYPE add_frame_ref( void* cookie, OniFrame* pFrame )
+            {
+                BenchmarkStream* benchmark_stream = reinterpret_cast<BenchmarkStream*>( cookie );
+                std::lock_guard<std::mutex> lock( benchmark_stream->mutex );
+                reinterpret_cast<BenchmarkFrame*>( pFrame )->references++;
+            }
+
+            static void ONI_CALLBACK_TYPE release_frame( void* cookie, OniFrame* pFrame )
+            {
+                BenchmarkStream* benchmark_stream = reinterpret_cast<BenchmarkStream*>( cookie );
+                std::lock_guard<std::mutex> lock( benchmark_stream->mutex );
+                reinterpret_cast<BenchmarkFrame*>( pFrame )->references--;
+            }
+
+            static void ONI_CALLBACK_TYPE new_frame( StreamBase* pStream, OniFrame* pFrame, void* cookie )
+            {
+                const std::chrono::steady_clock::time_point raise_time = std::chrono::steady_clock::now();
+
+                BenchmarkStream* benchmark_stream = reinterpret_cast<BenchmarkStream*>( cookie );
+                if( !benchmark_stream->is_measuring ){
+                    return;
+                }
+
+                // Stream thread of driver calls this inside raiseNewFrame, so stage times belong to this frame
+                const K4AStageTimes& stage_times = static_cast<K4AStream*>( pStream )->getStageTimes();
+                typedef std::chrono::duration<double, std::micro> microseconds;
+
+                std::lock_guard<std::mutex> lock( benchmark_stream->mutex );
+                benchmark_stream->latencies[STAGE_CAPTURE_TO_QUEUE  ].push_back( microseconds( stage_times.queue   - stage_times.capture ).count() );
+                benchmark_stream->latencies[STAGE_QUEUE_TO_DEQUEUE  ].push_back( microseconds( stage_times.dequeue - stage_times.queue   ).count() );
+                benchmark_stream->latencies[STAGE_DEQUEUE_TO_CONVERT].push_back( microseconds( stage_times.convert - stage_times.dequeue ).count() );
+                benchmark_stream->latencies[STAGE_CONVERT_TO_RAISE  ].push_back( microseconds( raise_time          - stage_times.convert ).count() );
+                benchmark_stream->latencies[STAGE_CAPTURE_TO_RAISE  ].push_back( microseconds( raise_time          - stage_times.capture ).count() );
+
+                if( benchmark_stream->last_index >= 0 && pFrame->frameIndex > benchmark_stream->last_index + 1 ){
+                    benchmark_stream->index_gaps += pFrame->frameIndex - benchmark_stream->last_index - 1;
+                }
+                benchmark_stream->last_index = pFrame->frameIndex;
+                benchmark_stream->frame_count++;
+            }
+
+        protected:
+            DeviceBase* device;
+            OniSensorType sensor_type;
+            StreamBase* stream;
+            StreamServices services;
+
+            std::mutex mutex;
+            std::vector<std::unique_ptr<BenchmarkFrame>> frames;
+
+            std::atomic_bool is_measuring;
+            uint64_t frame_count;
+            uint64_t index_gaps;
+            int32_t last_index;
+            std::vector<double> latencies[STAGE_COUNT];
+    };
+
+    struct Scenario
+    {
+        std::string name;
+        std::vector<std::pair<OniSensorType, OniVideoMode>> streams;
+        bool use_video_mode;
+        bool registration;
+        K4AColorDecoder color_decoder;
+    };
+
+    std::vector<Scenario> create_scenarios( DeviceBase* device )
+    {
+        std::vector<Scenario> scenarios;
+
+        OniSensorInfo* sensors = nullptr;
+        int sensor_count = 0;
+        if( device->getSensorInfoList( &sensors, &sensor_count ) != ONI_STATUS_OK ){
+            return scenarios;
+        }
+
+        // Each sensor alone in each supported video mode
+        for( int sensor = 0; sensor < sensor_count; sensor++ ){
+            for( int mode = 0; mode < sensors[sensor].numSupportedVideoModes; mode++ ){
+                const OniVideoMode& video_mode = sensors[sensor].pSupportedVideoModes[mode];
+                char name[128];
+                std::snprintf( name, sizeof( name ), "%s %s %dx%d@%d", get_sensor_name( sensors[sensor].sensorType ), get_format_name( video_mode.pixelFormat ), video_mode.resolutionX, video_mode.resolutionY, video_mode.fps );
+
+                Scenario scenario;
+                scenario.name = name;
+                scenario.streams.push_back( std::make_pair( sensors[sensor].sensorType, video_mode ) );
+                scenario.use_video_mode = true;
+                scenario.registration   = false;
+                scenario.color_decoder  = K4A_COLOR_DECODER_SDK;
+                scenarios.push_back( scenario );
+            }
+        }
+
+        // RGB888 color decoded by decoder pool of driver, when driver and device support it
+        const K4AColorDecoder pool_decoder = K4A_COLOR_DECODER_POOL;
+        if( device->setProperty( K4A_DEVICE_PROPERTY_COLOR_DECODER, &pool_decoder, sizeof( pool_decoder ) ) == ONI_STATUS_OK ){
+            for( int sensor = 0; sensor < sensor_count; sensor++ ){
+                if( sensors[sensor].sensorType != ONI_SENSOR_COLOR ){
+                    continue;
+                }
+                for( int mode = 0; mode < sensors[sensor].numSupportedVideoModes; mode++ ){
+                    const OniVideoMode& video_mode = sensors[sensor].pSupportedVideoModes[mode];
+                    if( video_mode.pixelFormat != ONI_PIXEL_FORMAT_RGB888 ){
+                        continue;
+                    }
+                    char name[128];
+                    std::snprintf( name, sizeof( name ), "color rgb888 %dx%d@%d pool", video_mode.resolutionX, video_mode.resolutionY, video_mode.fps );
+
+                    Scenario scenario;
+                    scenario.name = name;
+                    scenario.streams.push_back( std::make_pair( ONI_SENSOR_COLOR, video_mode ) );
+                    scenario.use_video_mode = true;
+                    scenario.registration   = false;
+                    scenario.color_decoder  = K4A_COLOR_DECODER_POOL;
+                    scenarios.push_back( scenario );
+                }
+            }
+        }
+
+        // All sensors together in default video modes, with and without registration
+        Scenario scenario;
+        scenario.name = "all";
+        scenario.use_video_mode = false;
+        scenario.registration   = false;
+        scenario.color_decoder  = K4A_COLOR_DECODER_SDK;
+        for( int sensor = 0; sensor < sensor_count; sensor++ ){
+            scenario.streams.push_back( std::make_pair( sensors[sensor].sensorType, OniVideoMode() ) );
+        }
+        scenarios.push_back( scenario );
+
+        scenario.name = "all registration";
+        scenario.registration = true;
+        scenarios.push_back( scenario );
+
+        return scenarios;
+    }
+
+    // Scenario is written without separator, caller separates scenarios
+    void run_scenario( DeviceBase* device, const Scenario& scenario, double warmup, double duration, std::FILE* file )
+    {
+        // Scenario that could not be configured as requested is still measured, and reported as not configured
+        bool is_configured = true;
+
+        if( scenario.color_decoder != K4A_COLOR_DECODER_SDK && device->setProperty( K4A_DEVICE_PROPERTY_COLOR_DECODER, &scenario.color_decoder, sizeof( scenario.color_decoder ) ) != ONI_STATUS_OK ){
+            std::fprintf( stderr, "failed to set color decoder of %s\n", scenario.name.c_str() );
+            is_configured = false;
+        }
+
+        // Registration is set before streams are created, so that depth streams start in registered mode
+        const OniImageRegistrationMode registration_mode = scenario.registration ? ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR : ONI_IMAGE_REGISTRATION_OFF;
+        if( device->setProperty( ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION, &registration_mode, sizeof( registration_mode ) ) != ONI_STATUS_OK && scenario.registration ){
+            std::fprintf( stderr, "failed to enable registration of %s\n", scenario.name.c_str() );
+            is_configured = false;
+        }
+
+        std::vector<std::unique_ptr<BenchmarkStream>> streams;
+        for( const std::pair<OniSensorType, OniVideoMode>& stream : scenario.streams ){
+            std::unique_ptr<BenchmarkStream> benchmark_stream( new BenchmarkStream( device, stream.first ) );
+            if( !benchmark_stream->is_valid() ){
+                std::fprintf( stderr, "failed to create %s stream\n", get_sensor_name( stream.first ) );
+                is_configured = false;
+                continue;
+            }
+            if( scenario.use_video_mode && !benchmark_stream->set_video_mode( stream.second ) ){
+                std::fprintf( stderr, "failed to set video mode of %s\n", scenario.name.c_str() );
+                is_configured = false;
+            }
+            streams.push_back( std::move( benchmark_stream ) );
+        }
+
+        // Registered depth has resolution of color camera, and frame of stream must hold it
+        if( scenario.registration ){
+            const k4a_calibration_camera_t& color_camera = static_cast<K4ADevice*>( device )->getCalibration().color_camera_calibration;
+            for( std::unique_ptr<BenchmarkStream>& stream : streams ){
+                if( stream->get_sensor_type() != ONI_SENSOR_DEPTH ){
+                    continue;
+                }
+                const OniVideoMode video_mode = stream->get_video_mode();
+                if( video_mode.resolutionX != color_camera.resolution_width || video_mode.resolutionY != color_camera.resolution_height
+                    || stream->get_required_frame_size() < video_mode.resolutionX * video_mode.resolutionY * static_cast<int>( sizeof( uint16_t ) ) ){
+                    std::fprintf( stderr, "depth of %s is %dx%d, not registered to color %dx%d\n", scenario.name.c_str(), video_mode.resolutionX, video_mode.resolutionY, color_camera.resolution_width, color_camera.resolution_height );
+                    is_configured = false;
+                }
+            }
+        }
+
+        for( std::unique_ptr<BenchmarkStream>& stream : streams ){
+            stream->start();
+        }
+
+        std::this_thread::sleep_for( std::chrono::duration<double>( warmup ) );
+
+        for( std::unique_ptr<BenchmarkStream>& stream : streams ){
+            stream->reset();
+            stream->measure( true );
+        }
+        const double cpu_begin = get_cpu_seconds();
+        const std::chrono::steady_clock::time_point time_begin = std::chrono::steady_clock::now();
+
+        std::this_thread::sleep_for( std::chrono::duration<double>( duration ) );
+
+        for( std::unique_ptr<BenchmarkStream>& stream : streams ){
+            stream->measure( false );
+        }
+        const double cpu_seconds = get_cpu_seconds() - cpu_begin;
+        const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - time_begin ).count();
+
+        std::fprintf( file, "    {\n" );
+        std::fprintf( file, "      \"name\": \"%s\",\n", scenario.name.c_str() );
+        std::fprintf( file, "      \"registration\": %s,\n", scenario.registration ? "true" : "false" );
+        std::fprintf( file, "      \"color_decoder\": \"%s\",\n", ( scenario.color_decoder == K4A_COLOR_DECODER_POOL ) ? "pool" : "sdk" );
+        std::fprintf( file, "      \"configured\": %s,\n", is_configured ? "true" : "false" );
+        std::fprintf( file, "      \"seconds\": %.3f,\n", seconds );
+        std::fprintf( file, "      \"cpu_seconds\": %.3f,\n", cpu_seconds );
+        std::fprintf( file, "      \"cpu_utilization\": %.3f,\n", seconds > 0.0 ? cpu_seconds / seconds : 0.0 );
+        std::fprintf( file, "      \"peak_rss_bytes\": %llu,\n", static_cast<unsigned long long>( get_peak_rss_bytes() ) );
+        std::fprintf( file, "      \"streams\": [\n" );
+        for( size_t index = 0; index < streams.size(); index++ ){
+            streams[index]->write( file, seconds );
+            std::fprintf( file, "%s\n", ( index + 1 < streams.size() ) ? "," : "" );
+        }
+        std::fprintf( file, "      ]\n" );
+        std::fprintf( file, "    }" );
+        std::fflush( file );
+
+        for( std::unique_ptr<BenchmarkStream>& stream : streams ){
+            std::fprintf( stderr, "%-36s %-6s %8.2f fps\n", scenario.name.c_str(), get_sensor_name( stream->get_sensor_type() ), stream->get_frames_per_second( seconds ) );
+            stream->stop();
+        }
+        streams.clear();
+    }
+
+    struct RegistrationAccuracy
+    {
+        int32_t width;
+        int32_t height;
+        uint64_t sdk_pixels;     // pixels with depth in image of SDK
+        uint64_t matched_pixels; // pixels of SDK that table engine has within 1 color pixel and 1 mm
+        uint64_t missing_pixels; // pixels of SDK that table engine has no depth around
+        uint64_t extra_pixels;   // pixels of table engine that SDK has no depth around
+    };
+
+    // Depth within 1 mm in 3x3 neighborhood of pixel
+    bool has_depth_around( const uint16_t* image, int32_t width, int32_t height, int32_t x, int32_t y, int32_t depth, int32_t tolerance )
+    {
+        for( int32_t ny = std::max( y - 1, 0 ); ny <= std::min( y + 1, height - 1 ); ny++ ){
+            for( int32_t nx = std::max( x - 1, 0 ); nx <= std::min( x + 1, width - 1 ); nx++ ){
+                const int32_t value = image[static_cast<size_t>( ny ) * width + nx];
+                if( value != 0 && ( tolerance < 0 || std::abs( value - depth ) <= tolerance ) ){
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Registers one depth frame of source with table engine and with k4a::transformation in color mode of device
+    bool compare_registration( K4ADevice* device, const OniVideoMode& color_mode, RegistrationAccuracy& accuracy )
+    {
+        if( device->setVideoMode( ONI_SENSOR_COLOR, color_mode ) != ONI_STATUS_OK ){
+            return false;
+        }
+        const std::shared_ptr<const K4ACalibrationTable> table = device->getCalibrationTable();
+        if( !table->is_valid() ){
+            return false;
+        }
+
+        try{
+            K4ASource* source = device->getSource();
+            k4a::image depth_image;
+            source->start_cameras( device->getDeviceConfiguration() );
+            for( int32_t retry = 0; retry < 10 && !depth_image; retry++ ){
+                k4a::capture capture;
+                if( source->get_capture( &capture, std::chrono::milliseconds( 1000 ) ) ){
+                    depth_image = capture.get_depth_image();
+                }
+            }
+            source->stop_cameras();
+            if( !depth_image ){
+                return false;
+            }
+
+            const int32_t width  = table->color_width;
+            const int32_t height = table->color_height;
+            k4a::image table_image = k4a::image::create( K4A_IMAGE_FORMAT_DEPTH16, width, height, width * static_cast<int32_t>( sizeof( uint16_t ) ) );
+            K4ARegistration registration( table );
+            if( !registration.depth_image_to_color_camera( depth_image, table_image ) ){
+                return false;
+            }
+            const k4a::transformation transformation( device->getCalibration() );
+            const k4a::image sdk_image = transformation.depth_image_to_color_camera( depth_image );
+            if( sdk_image.get_width_pixels() != width || sdk_image.get_height_pixels() != height || sdk_image.get_stride_bytes() != width * static_cast<int32_t>( sizeof( uint16_t ) ) ){
+                return false;
+            }
+
+            const uint16_t* table_depth = reinterpret_cast<const uint16_t*>( table_image.get_buffer() );
+            const uint16_t* sdk_depth   = reinterpret_cast<const uint16_t*>( sdk_image.get_buffer() );
+            accuracy = RegistrationAccuracy();
+            accuracy.width  = width;
+            accuracy.height = height;
+            for( int32_t y = 0; y < height; y++ ){
+                for( int32_t x = 0; x < width; x++ ){
+                    const size_t index = static_cast<size_t>( y ) * width + x;
+                    if( sdk_depth[index] != 0 ){
+                        accuracy.sdk_pixels++;
+                        if( has_depth_around( table_depth, width, height, x, y, sdk_depth[index], 1 ) ){
+                            accuracy.matched_pixels++;
+                        }
+                        else if( !has_depth_around( table_depth, width, height, x, y, 0, -1 ) ){
+                            accuracy.missing_pixels++;
+                        }
+                    }
+                    if( table_depth[index] != 0 && !has_depth_around( sdk_depth, width, height, x, y, 0, -1 ) ){
+                        accuracy.extra_pixels++;
+                    }
+                }
+            }
+        }
+        catch( const k4a::error& error ){
+            std::fprintf( stderr, "failed to compare registration - %s\n", error.what() );
+            return false;
+        }
+
+        return true;
+    }
+
+    void write_registration_accuracy( DeviceBase* device, std::FILE* file )
+    {
+        OniSensorInfo* sensors = nullptr;
+        int sensor_count = 0;
+        device->getSensorInfoList( &sensors, &sensor_count );
+
+        // One mode of each color resolution, engines only depend on calibration of resolution
+        std::vector<OniVideoMode> color_modes;
+        for( int sensor = 0; sensor < sensor_count; sensor++ ){
+            if( sensors[sensor].sensorType != ONI_SENSOR_COLOR ){
+                continue;
+            }
+            for( int mode = 0; mode < sensors[sensor].numSupportedVideoModes; mode++ ){
+                const OniVideoMode& video_mode = sensors[sensor].pSupportedVideoModes[mode];
+                const bool is_listed = std::any_of( color_modes.begin(), color_modes.end(), [&]( const OniVideoMode& listed ){ return listed.resolutionX == video_mode.resolutionX && listed.resolutionY == video_mode.resolutionY; } );
+                if( video_mode.pixelFormat == ONI_PIXEL_FORMAT_RGB888 && !is_listed ){
+                    color_modes.push_back( video_mode );
+                }
+            }
+        }
+
+        std::vector<RegistrationAccuracy> accuracies;
+        for( const OniVideoMode& color_mode : color_modes ){
+            RegistrationAccuracy accuracy;
+            if( !compare_registration( static_cast<K4ADevice*>( device ), color_mode, accuracy ) ){
+                std::fprintf( stderr, "failed to compare registration at %dx%d\n", color_mode.resolutionX, color_mode.resolutionY );
+                continue;
+            }
+            const double matched = accuracy.sdk_pixels > 0 ? static_cast<double>( accuracy.matched_pixels ) / accuracy.sdk_pixels : 0.0;
+            std::fprintf( stderr, "%-36s %8.4f matched\n", ( "registration " + std::to_string( accuracy.width ) + "x" + std::to_string( accuracy.height ) ).c_str(), matched );
+            accuracies.push_back( accuracy );
+        }
+
+        std::fprintf( file, "  \"registration_accuracy\": [\n" );
+        for( size_t index = 0; index < accuracies.size(); index++ ){
+            const RegistrationAccuracy& accuracy = accuracies[index];
+            std::fprintf( file, "    { \"width\": %d, \"height\": %d, \"sdk_pixels\": %llu, \"matched_pixels\": %llu, \"missing_pixels\": %llu, \"extra_pixels\": %llu, \"matched_ratio\": %.6f }%s\n",
+                          accuracy.width, accuracy.height, static_cast<unsigned long long>( accuracy.sdk_pixels ), static_cast<unsigned long long>( accuracy.matched_pixels ),
+                          static_cast<unsigned long long>( accuracy.missing_pixels ), static_cast<unsigned long long>( accuracy.extra_pixels ),
+                          accuracy.sdk_pixels > 0 ? static_cast<double>( accuracy.matched_pixels ) / accuracy.sdk_pixels : 0.0,
+                          ( index + 1 < accuracies.size() ) ? "," : "" );
+        }
+        std::fprintf( file, "  ],\n" );
+    }
+
+    struct RecordRoundTrip
+    {
+        uint64_t written_frames; // frames that recorder reported as written
+        uint64_t indexed_frames; // frames found through index of recording
+        uint64_t scanned_frames; // frames found by scanning chunks of recording without index
+        uint64_t invalid_frames; // frames whose header does not match index, or whose index or time stamp does not increase in its sensor
+    };
+
+    // Copy of beginning of recording, as it is left when recording is not stopped cleanly
+    bool copy_file( const std::string& path, const std::string& copy_path, uint64_t copy_size )
+    {
+        std::FILE* source = std::fopen( path.c_str(), "rb" );
+        if( !source ){
+            return false;
+        }
+        std::FILE* target = std::fopen( copy_path.c_str(), "wb" );
+        if( !target ){
+            std::fclose( source );
+            return false;
+        }
+
+        std::vector<char> buffer( 1 << 20 );
+        while( copy_size > 0 ){
+            const size_t size = static_cast<size_t>( std::min<uint64_t>( copy_size, buffer.size() ) );
+            if( std::fread( &buffer[0], 1, size, source ) != size || std::fwrite( &buffer[0], 1, size, target ) != size ){
+                break;
+            }
+            copy_size -= size;
+        }
+        std::fclose( source );
+        std::fclose( target );
+        return ( copy_size == 0 );
+    }
+
+    // Records all sensors of device for duration, and reads recording back
+    bool check_record_round_trip( DeviceBase* device, const std::string& path, double duration, RecordRoundTrip& round_trip )
+    {
+        round_trip = RecordRoundTrip();
+
+        std::vector<std::unique_ptr<BenchmarkStream>> streams;
+        for( OniSensorType sensor_type : { ONI_SENSOR_COLOR, ONI_SENSOR_DEPTH, ONI_SENSOR_IR } ){
+            std::unique_ptr<BenchmarkStream> stream( new BenchmarkStream( device, sensor_type ) );
+            if( stream->is_valid() && stream->start() ){
+                streams.push_back( std::move( stream ) );
+            }
+        }
+        if( streams.empty() ){
+            return false;
+        }
+
+        OniBool is_recording = TRUE;
+        if( device->setProperty( K4A_DEVICE_PROPERTY_RECORD_PATH, path.c_str(), static_cast<int>( path.size() + 1 ) ) != ONI_STATUS_OK
+            || device->setProperty( K4A_DEVICE_PROPERTY_RECORDING, &is_recording, sizeof( is_recording ) ) != ONI_STATUS_OK ){
+            return false;
+        }
+        std::this_thread::sleep_for( std::chrono::duration<double>( duration ) );
+        is_recording = FALSE;
+        device->setProperty( K4A_DEVICE_PROPERTY_RECORDING, &is_recording, sizeof( is_recording ) );
+
+        K4ARecordStatistics statistics = {};
+        int size = sizeof( statistics );
+        device->getProperty( K4A_DEVICE_PROPERTY_RECORD_STATISTICS, &statistics, &size );
+        round_trip.written_frames = statistics.written_frames;
+        streams.clear();
+
+        K4ARecordReader reader;
+        if( !reader.open( path ) || !reader.is_indexed() ){
+            return false;
+        }
+        const std::vector<K4ARecordIndexEntry> index = reader.get_index();
+        round_trip.indexed_frames = index.size();
+
+        std::map<int32_t, K4ARecordIndexEntry> previous_entries;
+        K4ARecordFrameHeader header = {};
+        std::vector<uint8_t> data;
+        for( size_t entry = 0; entry < index.size(); entry++ ){
+            bool is_valid = reader.read_frame( entry, header, data ) && header.time_stamp == index[entry].time_stamp
+                            && ( header.format == K4A_IMAGE_FORMAT_COLOR_MJPG || header.size == static_cast<uint64_t>( header.stride ) * static_cast<uint64_t>( header.height ) );
+            const std::map<int32_t, K4ARecordIndexEntry>::const_iterator previous = previous_entries.find( index[entry].sensor_type );
+            if( previous != previous_entries.end() && ( index[entry].index <= previous->second.index || index[entry].time_stamp <= previous->second.time_stamp ) ){
+                is_valid = false;
+            }
+            previous_entries[index[entry].sensor_type] = index[entry];
+            if( !is_valid ){
+                round_trip.invalid_frames++;
+            }
+        }
+        reader.close();
+
+        const std::string scan_path = path + ".noindex";
+        const uint64_t index_size = index.size() * sizeof( K4ARecordIndexEntry ) + sizeof( K4ARecordFileFooter );
+        const bool is_copied = ( statistics.written_bytes >= index_size ) && copy_file( path, scan_path, statistics.written_bytes - index_size );
+        std::remove( path.c_str() );
+        if( !is_copied || !reader.open( scan_path ) || reader.is_indexed() ){
+            std::remove( scan_path.c_str() );
+            return false;
+        }
+        const std::vector<K4ARecordIndexEntry>& scanned_index = reader.get_index();
+        round_trip.scanned_frames = scanned_index.size();
+        for( size_t entry = 0; entry < std::min( index.size(), scanned_index.size() ); entry++ ){
+            if( std::memcmp( &index[entry], &scanned_index[entry], sizeof( K4ARecordIndexEntry ) ) != 0 ){
+                round_trip.invalid_frames++;
+            }
+        }
+        reader.close();
+        std::remove( scan_path.c_str() );
+
+        return true;
+    }
+
+    // Returns whether every written frame was read back
+    bool write_record_round_trip( DeviceBase* device, const std::string& path, double duration, std::FILE* file )
+    {
+        RecordRoundTrip round_trip;
+        const bool is_checked = check_record_round_trip( device, path, duration, round_trip );
+        const bool is_valid = is_checked && round_trip.written_frames > 0 && round_trip.indexed_frames == round_trip.written_frames
+                              && round_trip.scanned_frames == round_trip.written_frames && round_trip.invalid_frames == 0;
+        std::fprintf( stderr, "%-36s %8llu frames %s\n", "record round trip", static_cast<unsigned long long>( round_trip.written_frames ), is_valid ? "valid" : "invalid" );
+
+        std::fprintf( file, "  \"record_round_trip\": { \"written_frames\": %llu, \"indexed_frames\": %llu, \"scanned_frames\": %llu, \"invalid_frames\": %llu, \"valid\": %s }\n",
+                      static_cast<unsigned long long>( round_trip.written_frames ), static_cast<unsigned long long>( round_trip.indexed_frames ),
+                      static_cast<unsigned long long>( round_trip.scanned_frames ), static_cast<unsigned long long>( round_trip.invalid_frames ),
+                      is_valid ? "true" : "false" );
+        return is_valid;
+    }
+
+    void ONI_CALLBACK_TYPE device_connected( const OniDeviceInfo* info, void* )
+    {
+        std::fprintf( stderr, "device connected : %s\n", info->uri );
+    }
+
+    void ONI_CALLBACK_TYPE device_disconnected( const OniDeviceInfo*, void* )
+    {
+    }
+
+    void ONI_CALLBACK_TYPE device_state_changed( const OniDeviceInfo*, int, void* )
+    {
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    std::string uri    = "synthetic://0";
+    std::string output = "k4abenchmark.json";
+    double duration    = 3.0;
+    double warmup      = 1.0;
+    bool has_speed     = false;
+    float speed        = 1.0f;
+
+    for( int index = 1; index < argc; index++ ){
+        const std::string argument = argv[index];
+        const bool has_value = ( index + 1 < argc );
+        if( argument == "--uri" && has_value ){
+            uri = argv[++index];
+        }
+        else if( argument == "--output" && has_value ){
+            output = argv[++index];
+        }
+        else if( argument == "--duration" && has_value ){
+            duration = std::atof( argv[++index] );
+        }
+        else if( argument == "--warmup" && has_value ){
+            warmup = std::atof( argv[++index] );
+        }
+        else if( argument == "--speed" && has_value ){
+            speed = static_cast<float>( std::atof( argv[++index] ) );
+            has_speed = true;
+        }
+        else{
+            std::fprintf( stderr, "usage : %s [--uri synthetic://0] [--duration 3] [--warmup 1] [--speed 0] [--output k4abenchmark.json]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Driver publishes synthetic devices only when they are requested
+    if( uri.compare( 0, std::strlen( "synthetic://" ), "synthetic://" ) == 0 ){
+        const std::string count = std::to_string( std::atoi( uri.c_str() + std::strlen( "synthetic://" ) ) + 1 );
+        set_environment( "K4A_SYNTHETIC_DEVICES", count.c_str() );
+    }
+
+    // Driver does not log through services, so they are left empty
+    OniDriverServices driver_services = {};
+    std::unique_ptr<K4ADriver> driver( new K4ADriver( &driver_services ) );
+    if( driver->initialize( &device_connected, &device_disconnected, &device_state_changed, nullptr ) != ONI_STATUS_OK ){
+        std::fprintf( stderr, "failed to initialize driver\n" );
+        return EXIT_FAILURE;
+    }
+
+    DeviceBase* device = driver->deviceOpen( uri.c_str(), "" );
+    if( !device ){
+        std::fprintf( stderr, "failed to open %s\n", uri.c_str() );
+        return EXIT_FAILURE;
+    }
+    const std::vector<Scenario> scenarios = create_scenarios( device );
+    driver->deviceClose( device );
+
+    std::FILE* file = std::fopen( output.c_str(), "w" );
+    if( !file ){
+        std::fprintf( stderr, "failed to open %s\n", output.c_str() );
+        return EXIT_FAILURE;
+    }
+
+    std::fprintf( file, "{\n" );
+    std::fprintf( file, "  \"uri\": \"%s\",\n", escape_json( uri ).c_str() );
+    std::fprintf( file, "  \"warmup_seconds\": %.3f,\n", warmup );
+    std::fprintf( file, "  \"duration_seconds\": %.3f,\n", duration );
+    std::fprintf( file, "  \"scenarios\": [\n" );
+    // Scenario whose device can not be opened is skipped, and benchmark fails after writing the others
+    bool is_failed = false;
+    size_t written_scenarios = 0;
+    for( size_t index = 0; index < scenarios.size(); index++ ){
+        // Device is opened for each scenario, so that modes of previous scenario do not restrict next one
+        device = driver->deviceOpen( uri.c_str(), "" );
+        if( !device ){
+            std::fprintf( stderr, "failed to open %s for %s\n", uri.c_str(), scenarios[index].name.c_str() );
+            is_failed = true;
+            continue;
+        }
+        if( has_speed ){
+            device->setProperty( ONI_DEVICE_PROPERTY_PLAYBACK_SPEED, &speed, sizeof( speed ) );
+        }
+
+        std::fprintf( file, "%s", ( written_scenarios++ > 0 ) ? ",\n" : "" );
+        run_scenario( device, scenarios[index], warmup, duration, file );
+        driver->deviceClose( device );
+    }
+    std::fprintf( file, "%s  ],\n", ( written_scenarios > 0 ) ? "\n" : "" );
+
+    // Registration is compared on device that has no stream, so that cameras of source are free
+    device = driver->deviceOpen( uri.c_str(), "" );
+    if( device ){
+        write_registration_accuracy( device, file );
+        driver->deviceClose( device );
+    }
+    else{
+        std::fprintf( stderr, "failed to open %s for registration accuracy\n", uri.c_str() );
+        std::fprintf( file, "  \"registration_accuracy\": [],\n" );
+        is_failed = true;
+    }
+
+    // Recording is written next to output, and removed after it was read back
+    device = driver->deviceOpen( uri.c_str(), "" );
+    if( device ){
+        if( !write_record_round_trip( device, output + ".k4arec", duration, file ) ){
+            is_failed = true;
+        }
+        driver->deviceClose( device );
+    }
+    else{
+        std::fprintf( stderr, "failed to open %s for record round trip\n", uri.c_str() );
+        std::fprintf( file, "  \"record_round_trip\": {}\n" );
+        is_failed = true;
+    }
+    std::fprintf( file, "}\n" );
+    std::fclose( file );
+
+    driver.reset();
+
+    return is_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}